@@ -59,17 +59,6 @@ struct cam_epid {
 
 LIST_HEAD(sclist);
 
-LIST_HEAD(pid_empty_queue);
-LIST_HEAD(pid_list);
-
-struct fdmap_list {
-  struct list_head list;
-  unsigned int pid;
-  int fd;
-};
-LIST_HEAD(fdmap_empty_queue);
-LIST_HEAD(fdmap_ll);
-
 struct scopt_list {
   char cmd[32];
   char value[256];
@@ -81,14 +70,14 @@ static char scCap[80];
 
 extern const char *externalAU;
 extern void update_keys(int, unsigned char, int, unsigned char *, int);
-extern void SetCAMPrint(const char *_plugin_name, unsigned int plugin_id, unsigned int _print_level, unsigned int *_log_level);
+extern void SetCAMPrint(const char *_plugin_name, unsigned int _print_level, const unsigned char *_log_level);
 const char *cPlugin::ConfigDirectory(const char *PluginName) {return opt_camdir;}
 
 static int init_sc(void) {
   sc=(cPlugin *)VDRPluginCreator();
 
   dprintf0("initializing FFdecsawrapper, %s\n", sc->Description());
-  SetCAMPrint(DBG_NAME, PLUGIN_ID, 0, &_dbglvl);
+  SetCAMPrint(DBG_NAME, 0, &_dbglevels[DBG_SLOT(PLUGIN_ID)]);
   if (!sc->Initialize()) {
     dprintf0("Failed to initialize FFdecsawrapper\n");
     return false;
@@ -119,7 +108,7 @@ void cam_del_pid(struct sc_data *sc_data, struct cam_epid *cam_epid) {
   struct cam_epid *cam_epid1;
   int epidlist[MAXDPIDS], *epidptr = epidlist;
   list_del(&cam_epid->list);
-  list_for_each(ptr, &pid_list) {
+  list_for_each(ptr, &sc_data->pid_list) {
     cam_epid1 = list_entry(ptr, struct cam_epid);
     if(cam_epid1->sid == cam_epid->sid)
       *(epidptr++) = cam_epid1->epid;
@@ -130,7 +119,7 @@ void cam_del_pid(struct sc_data *sc_data, struct cam_epid *cam_epid) {
   //link.data.pids.pid=cam_epid->epid;
   //link.data.pids.type=cam_epid->type;
   //DoScLinkOp(sc, &link);
-  list_add(&cam_epid->list, &pid_empty_queue);
+  list_add(&cam_epid->list, &sc_data->pid_empty_queue);
 }
 
 void _SetCaDescr(int adapter, ca_descr_t *ca_descr) {
@@ -196,8 +185,8 @@ void process_cam(struct msg *msg, unsigned int priority)
     sc_data = find_sc_from_adpt(msg->id);
     assert(sc_data);
     dprintf1("Got MSG_RESETSID\n");
-    while(! list_empty(&pid_list)) {
-      cam_epid = list_entry(pid_list.next, struct cam_epid);
+    while(! list_empty(&sc_data->pid_list)) {
+      cam_epid = list_entry(sc_data->pid_list.next, struct cam_epid);
       cam_del_pid(sc_data, cam_epid);
     }
     sc_data->cam->Stop();
@@ -213,9 +202,11 @@ void process_cam(struct msg *msg, unsigned int priority)
   }
   if (msg->type == MSG_REMOVESID) {
     unsigned int sid = 0xffff & (unsigned long)(msg->data);
+    sc_data = find_sc_from_adpt(msg->id);
+    assert(sc_data);
     dprintf1("Got MSG_REMOVESID with sid: %d\n", sid);
     //delay removal of pids so we can continue to watch for key-rolls
-    list_for_each(ptr, &pid_list) {
+    list_for_each(ptr, &sc_data->pid_list) {
       cam_epid = list_entry(ptr, struct cam_epid);
       if(cam_epid->sid == sid) {
         dprintf1("Mapped sid to %d\n", cam_epid->epid);
@@ -254,7 +245,7 @@ void process_cam(struct msg *msg, unsigned int priority)
     //if the sid is the same as last time, and a tune hasn't happened, we're
     //already good to go
     if(sc_data->valid) {
-      list_for_each(ptr, &pid_list) {
+      list_for_each(ptr, &sc_data->pid_list) {
         cam_epid = list_entry(ptr, struct cam_epid);
         if(cam_epid->delayclose && cam_epid->sid == sidmsg->sid) {
           dprintf1("Reenabling delayed-closed sid: %d\n", sidmsg->sid);
@@ -269,7 +260,7 @@ void process_cam(struct msg *msg, unsigned int priority)
     //the sid is different, but we may be on the same transponder, so clear
     //all delayed-close pids before proceeding
     while (1) {
-      ll_find_elem(cam_epid, pid_list, delayclose, 1, struct cam_epid);
+      ll_find_elem(cam_epid, sc_data->pid_list, delayclose, 1, struct cam_epid);
       if(cam_epid == NULL)
         break;
       dprintf1("Mapped sid %d to epid %d\n", cam_epid->sid, cam_epid->epid);
@@ -324,12 +315,12 @@ void process_cam(struct msg *msg, unsigned int priority)
 
   int i, epidlist[MAXDPIDS], *epidptr = epidlist;
   for(i=0; i < sidmsg->epid_count && i < MAXDPIDS; i++) {
-    pop_entry_from_queue(cam_epid, &pid_empty_queue, struct cam_epid);
+    pop_entry_from_queue(cam_epid, &sc_data->pid_empty_queue, struct cam_epid);
     cam_epid->delayclose = 0;
     cam_epid->epid = sidmsg->epid[i];
     cam_epid->type = 5; //epid->type;
     cam_epid->sid = sidmsg->sid;
-    list_add(&cam_epid->list, &pid_list);
+    list_add(&cam_epid->list, &sc_data->pid_list);
     *(epidptr++) = sidmsg->epid[i];
     dprintf1("Adding pid %d for sid %d to pidlist\n", cam_epid->epid, cam_epid->sid);
     //PrepareScLink(&link, sc_data->dev, OP_ADDPID);
@@ -453,25 +444,34 @@ static void replace_cat(unsigned char *buf, int len, int pid)
   }
 }
 
+//The demux callbacks run on the demux thread of their own adapter, so the
+//fd->pid map lives in that adapter's sc_data and is indexed by the poll_ll
+//slot rather than searched
+static inline int *find_fdmap(struct parser_cmds *pc, struct poll_ll *fdptr)
+{
+  struct sc_data *sc_data = find_sc_from_adpt(pc->common->real_adapt);
+  if(! sc_data)
+    return NULL;
+  return &sc_data->fdmap[fdptr - pc->realfd_ll];
+}
+
 static void dmxread_call(struct parser_cmds *pc, struct poll_ll *fdptr,
                       cmdret_t *result, int *ret, 
                       unsigned long int cmd, unsigned char *data)
 {
-  struct fdmap_list *fd_map;
-  ll_find_elem(fd_map, fdmap_ll, fd, fdptr->fd, struct fdmap_list);
-  if(! fd_map)
+  int *fd_map = find_fdmap(pc, fdptr);
+  if(! fd_map || *fd_map < 0)
     return;
-  replace_cat(pc->mmap, *ret, fd_map->pid);
+  replace_cat(pc->mmap, *ret, *fd_map);
 }
 
 static void dmxioctl_call(struct parser_cmds *pc, struct poll_ll *fdptr,
                       cmdret_t *result, int *ret, 
                       unsigned long int cmd, unsigned char *data)
 {
-  struct fdmap_list *fd_map;
+  int *fd_map = find_fdmap(pc, fdptr);
   int pid;
-  ll_find_elem(fd_map, fdmap_ll, fd, fdptr->fd, struct fdmap_list);
-  if(fd_map)
+  if(! fd_map || *fd_map >= 0)
     return;
   if(cmd == DMX_SET_FILTER) {
     struct dmx_sct_filter_params *dmx =
@@ -489,21 +489,15 @@ static void dmxioctl_call(struct parser_cmds *pc, struct poll_ll *fdptr,
   //This is a hack.  We need to get the pmt handels from the pat like getsid
   if(pid > 100)
     return;
-  pop_entry_from_queue(fd_map, &fdmap_empty_queue, struct fdmap_list);
-  fd_map->fd = fdptr->fd;
-  fd_map->pid = pid;
-  list_add(&fd_map->list, &fdmap_ll);
+  *fd_map = pid;
 }
 static void dmxclose_call(struct parser_cmds *pc, struct poll_ll *fdptr,
                       cmdret_t *result, int *ret, 
                       unsigned long int cmd, unsigned char *data)
 {
-  struct fdmap_list *fd_map;
-  ll_find_elem(fd_map, fdmap_ll, fd, fdptr->fd, struct fdmap_list);
-  if(fd_map) {
-    list_del(&fd_map->list);
-    list_add(&fd_map->list, &fdmap_empty_queue);
-  }
+  int *fd_map = find_fdmap(pc, fdptr);
+  if(fd_map)
+    *fd_map = -1;
 }
 
 void connect_cam(struct parser_adpt *pc_all)
@@ -531,6 +525,10 @@ void connect_cam(struct parser_adpt *pc_all)
   sc_data->real = cardnum;
   sc_data->cam = new sascCam(cardnum);
   sc_data->cafd = -1;
+  INIT_LIST_HEAD(&sc_data->pid_list);
+  INIT_LIST_HEAD(&sc_data->pid_empty_queue);
+  for(int i = 0; i < DVBLB_MAXFD; i++)
+    sc_data->fdmap[i] = -1;
   list_add(&sc_data->list, &sclist);
   if(opt_fixcat) {
     ATTACH_CALLBACK(&pc_all->demux->pre_ioctl, dmxioctl_call, 0);
@@ -5,6 +5,9 @@ class sascCam;
 struct sc_data {
   struct list_head list;
   sascCam *cam;
+  struct list_head pid_list;        //cam_epid entries for this adapter
+  struct list_head pid_empty_queue;
+  int fdmap[DVBLB_MAXFD];           //demux pid indexed by poll_ll slot, -1=unused
   unsigned int lastsid;
   int cafd;
   int virt;
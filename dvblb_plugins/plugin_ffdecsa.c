@@ -313,7 +313,7 @@ static int process_ts(struct csastruct *csa, unsigned char *buffer, uint end,
         }
         pthread_mutex_unlock(&csa->keylock);
 
-        if((_dbglvl >> PLUGIN_ID) & 3) {
+        if(DBG_LEVEL(PLUGIN_ID)) {
           csa->avg = (csa->avg * 99 + pkt_count*100) / 100;
           if(csa->avg == 0)
             csa->avg = 1;
@@ -10,18 +10,53 @@ enum {
   DVBDBG_RINGBUF  = 12,
   DVBDBG_DSS      = 14,
 };
+
+/* One debug level (0-3) per plugin, indexed by PLUGIN_ID/2.
+   _dbglvl is the old packed form (2 bits at PLUGIN_ID) and only kept in sync
+   for reading. Use dbg_setmask()/dbg_setlevel() to change levels. */
+#define DBG_MAX_SLOTS 16
+#define DBG_SLOT(id)  (((id) >> 1) & (DBG_MAX_SLOTS - 1))
+#define DBG_LEVEL(id) __atomic_load_n(&_dbglevels[DBG_SLOT(id)], __ATOMIC_RELAXED)
+
+/* Highest dprintfN level compiled in. Release builds use 2, so dprintf3 in
+   the data path costs nothing there. */
+#ifndef DBG_CUTOFF
+#define DBG_CUTOFF 3
+#endif
+
 extern unsigned int _dbglvl;
+extern unsigned char _dbglevels[DBG_MAX_SLOTS];
 int tmprintf(const char *plugin, const char *fmt, ...);
+void tmputs(const char *stamp, const char *plugin, const char *msg);
+/* if set, tmprintf() hands preformatted lines to this sink first */
+extern int (*tmqueue)(const char *stamp, const char *plugin, const char *msg);
+void dbg_register(int id, const char *name);
+void dbg_setmask(unsigned int mask);
+int dbg_setlevel(const char *name, int level);
+int dbg_parse(const char *str);
+int dbg_levels(char *buf, int len);
 
 #define dprintf(args...) tmprintf("", args)
 #define dprintf0(args...) tmprintf(DBG_NAME, args)
-#define dprintf1(args...) if(1 <= ((_dbglvl >> PLUGIN_ID) & 3)) \
+#if DBG_CUTOFF >= 1
+#define dprintf1(args...) if(1 <= DBG_LEVEL(PLUGIN_ID)) \
 	tmprintf(DBG_NAME, args)
-#define dprintf2(args...) if(2 <= ((_dbglvl >> PLUGIN_ID) & 3)) \
+#else
+#define dprintf1(args...) if(0) tmprintf(DBG_NAME, args)
+#endif
+#if DBG_CUTOFF >= 2
+#define dprintf2(args...) if(2 <= DBG_LEVEL(PLUGIN_ID)) \
 	tmprintf(DBG_NAME, args)
-#define dprintf3(args...) if(3 == ((_dbglvl >> PLUGIN_ID) & 3)) \
+#else
+#define dprintf2(args...) if(0) tmprintf(DBG_NAME, args)
+#endif
+#if DBG_CUTOFF >= 3
+#define dprintf3(args...) if(3 == DBG_LEVEL(PLUGIN_ID)) \
 	tmprintf(DBG_NAME, args)
 #else
+#define dprintf3(args...) if(0) tmprintf(DBG_NAME, args)
+#endif
+#else
 #ifdef PLUGIN_ID
   #if (PLUGIN_ID % 2) == 1
     #undef  dprintf1
@@ -36,4 +71,3 @@ int tmprintf(const char *plugin, const char *fmt, ...);
   #endif
 #endif //#ifdef PLUGIN_ID
 #endif
-
@@ -62,6 +62,9 @@ struct t_adaptermap {
 
 LIST_HEAD(plugin_cmdlist);
 unsigned int _dbglvl;
+unsigned char _dbglevels[DBG_MAX_SLOTS];
+static const char *dbg_names[DBG_MAX_SLOTS];
+int (*tmqueue)(const char *stamp, const char *plugin, const char *msg) = NULL;
 void * listen_loop(void * arg);
 extern const char *source_version;
 pthread_attr_t default_attr;
@@ -79,30 +82,124 @@ static struct {
   unsigned int logmode;
 } logcfg = {LOGMODE_STDOUT};
 
-int tmprintf(const char *plugin, const char *fmt, ...)
+static void tmstamp(char *stamp, int len)
 {
-  va_list args;
   struct timeval tv;
   struct tm tm;
-  unsigned long usec;
-  char stamp[32], logmsg[1024];
+  int q;
   gettimeofday(&tv, NULL);
-  localtime_r(&tv.tv_sec, &tm);
-  strftime(stamp,sizeof(stamp),"%b %e %T",localtime_r(&tv.tv_sec, &tm));
-  usec = tv.tv_usec;
-  pthread_mutex_lock(&tmprintf_mutex);
+  q = strftime(stamp, len, "%b %e %T", localtime_r(&tv.tv_sec, &tm));
+  snprintf(stamp+q, len-q, ".%03lu", (unsigned long)tv.tv_usec/1000);
+}
+
+int tmprintf(const char *plugin, const char *fmt, ...)
+{
+  va_list args;
+  char stamp[32], logmsg[1024];
+  tmstamp(stamp, sizeof(stamp));
   /*
    ** Display the remainder of the message
    */
   va_start(args,fmt);
   vsnprintf(logmsg,sizeof(logmsg),fmt,args);
   va_end(args); 
+  if(! tmqueue || ! tmqueue(stamp, plugin, logmsg))
+    tmputs(stamp, plugin, logmsg);
+  return 0;
+}
+
+void tmputs(const char *stamp, const char *plugin, const char *msg)
+{
+  char now[32];
+  if(! stamp || ! *stamp) {
+    tmstamp(now, sizeof(now));
+    stamp = now;
+  }
+  pthread_mutex_lock(&tmprintf_mutex);
   if(logcfg.logmode & LOGMODE_STDOUT)
-    fprintf(stdout, "%s.%03lu %s: %s", stamp, usec/1000, plugin, logmsg);
+    fprintf(stdout, "%s %s: %s", stamp, plugin, msg);
   if(logcfg.logmode & LOGMODE_SYSLOG)
-    syslog(LOG_INFO, "%s: %s", plugin, logmsg);
+    syslog(LOG_INFO, "%s: %s", plugin, msg);
   pthread_mutex_unlock(&tmprintf_mutex);
-   return 0;
+}
+
+static void dbg_sync()
+{
+  unsigned int mask = 0;
+  for(int i = 0; i < DBG_MAX_SLOTS; i++)
+    mask |= DBG_LEVEL(2*i) << (2*i);
+  __atomic_store_n(&_dbglvl, mask, __ATOMIC_RELAXED);
+}
+
+void dbg_register(int id, const char *name)
+{
+  // odd ids share the slot of the even one below and have no dprintf1-3
+  if(id >= 0 && id < 2*DBG_MAX_SLOTS && ! (id & 1))
+    dbg_names[DBG_SLOT(id)] = name;
+}
+
+void dbg_setmask(unsigned int mask)
+{
+  for(int i = 0; i < DBG_MAX_SLOTS; i++)
+    __atomic_store_n(&_dbglevels[i], (mask >> (2*i)) & 3, __ATOMIC_RELAXED);
+  __atomic_store_n(&_dbglvl, mask, __ATOMIC_RELAXED);
+}
+
+int dbg_setlevel(const char *name, int level)
+{
+  int found = 0;
+  if(level < 0)
+    level = 0;
+  if(level > 3)
+    level = 3;
+  for(int i = 0; i < DBG_MAX_SLOTS; i++) {
+    if(strcasecmp(name, "all") == 0 ||
+       (dbg_names[i] && strcasecmp(name, dbg_names[i]) == 0)) {
+      __atomic_store_n(&_dbglevels[i], level, __ATOMIC_RELAXED);
+      found = 1;
+    }
+  }
+  if(! found)
+    return -1;
+  dbg_sync();
+  return 0;
+}
+
+/* Accepts a numeric bitmask or a list of name=level pairs separated by
+   spaces or commas, e.g. "ringbuf=3,cam=1" or "all=0". */
+int dbg_parse(const char *str)
+{
+  char buf[256], *tok, *save, *end, *eq;
+  int count = 0;
+  unsigned long mask = strtoul(str, &end, 0);
+  if(end != str && *end == '\0') {
+    dbg_setmask(mask);
+    return 1;
+  }
+  snprintf(buf, sizeof(buf), "%s", str);
+  for(tok = strtok_r(buf, " ,", &save); tok; tok = strtok_r(NULL, " ,", &save)) {
+    if(! (eq = strchr(tok, '=')))
+      return -1;
+    *eq = '\0';
+    if(dbg_setlevel(tok, atoi(eq+1)) < 0)
+      return -1;
+    count++;
+  }
+  return count;
+}
+
+int dbg_levels(char *buf, int len)
+{
+  int q = 0;
+  buf[0] = '\0';
+  for(int i = 0; i < DBG_MAX_SLOTS && q < len; i++) {
+    if(dbg_names[i])
+      q += snprintf(buf+q, len-q, "%s%s=%d", q ? " " : "", dbg_names[i],
+                    DBG_LEVEL(2*i));
+  }
+  if(q < len)
+    q += snprintf(buf+q, len-q, "\n");
+  return q < len ? q : len-1;
 }
 
 int get_adapters(struct t_adaptermap **adaptermap)
@@ -158,6 +255,7 @@ void show_help()
   printf("   -i/--identify     : List all available adpaters\n");
   printf("   -b/--buffer <num> : Set size of read buffer (default: 16M)\n");
   printf("   -d/--debug <num>  : Set debug level (this is a 32bit bitmask)\n");
+  printf("                       or a list of <module>=<level> (e.g. cam=1,ringbuf=3)\n");
   printf("   -l/--log          : Set log file for output\n");
   printf("   -n/--noload <num> : Don't load module <num>. Use with care!\n");
   printf("   -o/--osd          : Enable passthrough for cards with mpeg2 decoders\n");
@@ -300,7 +398,7 @@ int main(int argc, char *argv[])
   pthread_attr_setstacksize(&default_attr, PTHREAD_STACK_MIN + 0x4000);
   main_thread = pthread_self();
 
-  _dbglvl = 0;
+  dbg_setmask(0);
   //enable unbuffered stdout 
   setbuf(stdout, 0); 
 
@@ -337,6 +435,13 @@ int main(int argc, char *argv[])
   }
   memset(LongOpts+optcount, 0, sizeof(struct option));
 
+  for(int i = 3; i <= 6; i++)
+    dbg_register(2*(i-3), dnames[i]);
+  list_for_each(ptr, &plugin_cmdlist) {
+    struct plugin_cmd *cmd = list_entry(ptr, struct plugin_cmd);
+    dbg_register(cmd->plugin, cmd->name);
+  }
+
   while (1) {
 
     c = getopt_long(argc, argv, "b:d:hij:l:n:op:DP:", LongOpts, &Option_Index); 
@@ -357,7 +462,10 @@ int main(int argc, char *argv[])
           }
         }
       case 'd':
-        _dbglvl = strtol(optarg, NULL, 0);
+        if(dbg_parse(optarg) < 0) {
+          printf("Unknown debug setting: %s\n", optarg);
+          illegal_opt = 1;
+        }
         break;
       case 'D':
         use_daemon = 1;
@@ -575,7 +683,8 @@ void * listen_loop(void * arg)
     struct list_head *ptr;
     int sockfd, opt = 0;
     unsigned int len;
-    char buf[256];
+    int n;
+    char buf[256], reply[512];
     struct sockaddr_in serv_addr, cli_addr;
 
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -613,7 +722,11 @@ void * listen_loop(void * arg)
         perror("Connection failed:");
         continue;
       }
-      len = read(connfd, buf, 256);
+      n = read(connfd, buf, sizeof(buf) - 1);
+      if(n < 0)
+        n = 0;
+      buf[n] = '\0';
+      len = n;
       found = 0;
       list_for_each(ptr, &plugin_cmdlist) {
         struct plugin_cmd *cmd = list_entry(ptr, struct plugin_cmd);
@@ -629,12 +742,22 @@ void * listen_loop(void * arg)
           }
         }
       }
+      if(! found && strncasecmp(buf, "debug", 5) == 0 &&
+         (buf[5] == '\0' || strchr(" \r\n", buf[5]))) {
+        char *p;
+        if((p = strchr(buf, '\r')) || (p = strchr(buf, '\n'))) { *p = '\0'; }
+        if(buf[5] && dbg_parse(&buf[6]) < 0)
+          tmprintf("DEBUG","Got bad debug command: %s\n", &buf[6]);
+        n = dbg_levels(reply, sizeof(reply));
+        if(write(connfd, reply, n) < 0)
+          perror("Debug reply failed:");
+        found = 1;
+      }
       if(! found) {
         if(len < sizeof(int)) {
           tmprintf("DEBUG","Got bad command\n");
         } else {
-          /* This isn't thread safe, but that's ok*/
-          _dbglvl = *(unsigned int *)&buf;
+          dbg_setmask(*(unsigned int *)&buf);
           tmprintf("DEBUG","Got debug value: %u\n", _dbglvl);
         }
       }
@@ -52,7 +52,7 @@ static void fe_ioctl(struct parser_cmds *pc, struct poll_ll *fdptr,
     __u32 d32 = (*(unsigned long *)data) & 0xffffffff;
     __u16 d16 = d32 & 0xffff;
     char str[256], str1[80];;
-    if(! ((_dbglvl >> DVBDBG_IOCTL) & 1))
+    if(! (DBG_LEVEL(DVBDBG_IOCTL) & 1))
       return;
     switch(cmd) {
       case FE_GET_INFO:
@@ -230,7 +230,7 @@ static void demux_ioctl(struct parser_cmds *pc, struct poll_ll *fdptr,
 {
     char str[256], str1[80];
     __u32 d32 = (*(unsigned long *)data) & 0xffffffff;
-    if(! ((_dbglvl >> DVBDBG_IOCTL) & 2))
+    if(! (DBG_LEVEL(DVBDBG_IOCTL) & 2))
       return;
     switch(cmd) {
       case DMX_START:
@@ -46,6 +46,7 @@
 #define IDLE_SYNC        2000 // idleTime when in sync
 
 #define CW_REPEAT_TIME   2000 // rewrite CW after X ms
+#define CW_MARGIN_WARN   1000 // warn if CW is ready less than X ms before the predicted flip
 #define LOG_COUNT           3 // stop logging after X complete ECM cycles
 #define CHAIN_HOLD     120000 // min. time to hold a logger chain
 #define ECM_DATA_TIME    6000 // time to wait for ECM data updates
@@ -163,7 +164,7 @@ class cHookManager : public cAction {
   const char *devId;
   cSimpleList<cLogHook> hooks;
   //
-  cPidFilter *AddFilter(int Pid, int Section, int Mask, int IdleTime);
+  cPidFilter *AddFilter(int Pid, const cSectFilter &Filter, int IdleTime);
   void ClearHooks(void);
   void DelHook(cLogHook *hook);
 protected:
@@ -185,6 +186,7 @@ cHookManager::cHookManager(cDevice *Device, const char *DevId)
 
 cHookManager::~cHookManager()
 {
+  Detach();
   Down();
 }
 
@@ -216,7 +218,7 @@ void cHookManager::AddHook(cLogHook *hook)
   hook->delay.Set(CHAIN_HOLD);
   hooks.Add(hook);
   for(cPid *pid=hook->pids.First(); pid; pid=hook->pids.Next(pid)) {
-    cPidFilter *filter=AddFilter(pid->pid,pid->sct,pid->mask,CHAIN_HOLD/8);
+    cPidFilter *filter=AddFilter(pid->pid,pid->sf,CHAIN_HOLD/8);
     if(filter) {
       filter->userData=(void *)hook;
       pid->filter=filter;
@@ -238,13 +240,13 @@ void cHookManager::DelHook(cLogHook *hook)
   hooks.Del(hook);
 }
 
-cPidFilter *cHookManager::AddFilter(int Pid, int Section, int Mask, int IdleTime)
+cPidFilter *cHookManager::AddFilter(int Pid, const cSectFilter &Filter, int IdleTime)
 {
   cPidFilter *filter=NewFilter(IdleTime);
   if(filter) {
     filter->SetBuffSize(32768);
-    filter->Start(Pid,Section,Mask);
-    PRINTF(L_CORE_HOOK,"%s: added filter pid=0x%.4x sct=0x%.2x/0x%.2x idle=%d",devId,Pid,Section,Mask,IdleTime);
+    filter->Start(Pid,Filter);
+    PRINTF(L_CORE_HOOK,"%s: added filter pid=0x%.4x sct=0x%.2x/0x%.2x idle=%d",devId,Pid,Filter.filter[0],Filter.mask[0],IdleTime);
     }
   else PRINTF(L_GEN_ERROR,"no free slot or filter failed to open for hookmanager %s",devId);
   return filter;
@@ -341,6 +343,20 @@ bool cLogChain::Parse(const unsigned char *cat)
 
 // -- cLogger ------------------------------------------------------------------
 
+// Status changes from the handlers and the cam are queued and applied from
+// the logger's reactor, so callers never wait for a running card update.
+
+enum eLogReq { lrEcmOn, lrEcmOff, lrPreScan, lrDown };
+
+class cLogRequest : public cSimpleItem {
+public:
+  int req, source, transponder;
+  cEcmInfo *ecm;
+  //
+  cLogRequest(int Req) { req=Req; source=transponder=0; ecm=0; }
+  virtual ~cLogRequest() { delete ecm; }
+  };
+
 class cLogger : public cAction {
 private:
   cCam *cam;
@@ -348,6 +364,8 @@ private:
   bool softCSA, up;
   cSimpleList<cLogChain> chains;
   cSimpleList<cEcmInfo> active;
+  cMutex reqMutex;
+  cSimpleList<cLogRequest> requests;
   //
   cPidFilter *catfilt;
   int catVers;
@@ -357,19 +375,24 @@ private:
   ePreMode prescan;
   cTimeMs pretime;
   //
-  cPidFilter *AddFilter(int Pid, int Section, int Mask, int IdleTime);
+  cPidFilter *AddFilter(int Pid, const cSectFilter &Filter, int IdleTime);
   void SetChains(void);
   void ClearChains(void);
   void StartChain(cLogChain *chain);
   void StopChain(cLogChain *chain, bool force);
   void ProcessCat(unsigned char *data, int len);
+  void Request(cLogRequest *r);
+  void Up(void);
+  void SetDown(void);
+  void SetEcmStatus(const cEcmInfo *ecm, bool on);
+  void SetPreScan(int src, int tr);
 protected:
   virtual void Process(cPidFilter *filter, unsigned char *data, int len);
+  virtual void Woken(void);
 public:
   cLogger(cCam *Cam, cDevice *Device, const char *DevId, bool soft);
   virtual ~cLogger();
   void EcmStatus(const cEcmInfo *ecm, bool on);
-  void Up(void);
   void Down(void);
   void PreScan(int src, int tr);
   };
@@ -384,44 +407,85 @@ cLogger::cLogger(cCam *Cam, cDevice *Device, const char *DevId, bool soft)
 
 cLogger::~cLogger()
 {
-  Down();
+  Detach();
+  Lock();
+  SetDown();
+  Unlock();
+}
+
+void cLogger::Request(cLogRequest *r)
+{
+  reqMutex.Lock();
+  requests.Add(r);
+  reqMutex.Unlock();
+  Wakeup();
+}
+
+void cLogger::Woken(void)
+{
+  while(1) {
+    reqMutex.Lock();
+    cLogRequest *r=requests.First();
+    if(r) requests.Del(r,false);
+    reqMutex.Unlock();
+    if(!r) break;
+    switch(r->req) {
+      case lrEcmOn:
+      case lrEcmOff:  SetEcmStatus(r->ecm,r->req==lrEcmOn); break;
+      case lrPreScan: SetPreScan(r->source,r->transponder); break;
+      case lrDown:    SetDown(); break;
+      }
+    delete r;
+    }
+}
+
+void cLogger::EcmStatus(const cEcmInfo *ecm, bool on)
+{
+  cLogRequest *r=new cLogRequest(on ? lrEcmOn:lrEcmOff);
+  r->ecm=new cEcmInfo(ecm);
+  Request(r);
+}
+
+void cLogger::PreScan(int src, int tr)
+{
+  cLogRequest *r=new cLogRequest(lrPreScan);
+  r->source=src; r->transponder=tr;
+  Request(r);
+}
+
+void cLogger::Down(void)
+{
+  Request(new cLogRequest(lrDown));
 }
 
 void cLogger::Up(void)
 {
-  Lock();
   if(!up) {
     PRINTF(L_CORE_AUEXTRA,"%s: UP",devId);
     catVers=-1;
-    catfilt=AddFilter(1,0x01,0xFF,0);
+    catfilt=AddFilter(1,cSectFilter(0x01,0xFF),0);
     up=true;
     }
-  Unlock();
 }
 
-void cLogger::Down(void)
+void cLogger::SetDown(void)
 {
-  Lock();
   if(up) {
     PRINTF(L_CORE_AUEXTRA,"%s: DOWN",devId);
     ClearChains();
     DelAllFilter();
     catfilt=0; up=false; prescan=pmNone;
     }
-  Unlock();
 }
 
-void cLogger::PreScan(int src, int tr)
+void cLogger::SetPreScan(int src, int tr)
 {
-  Lock();
   source=src; transponder=tr;
   prescan=pmStart; Up();
-  Unlock();
 }
 
-void cLogger::EcmStatus(const cEcmInfo *ecm, bool on)
+void cLogger::SetEcmStatus(const cEcmInfo *ecm, bool on)
 {
-  Lock();
   PRINTF(L_CORE_AUEXTRA,"%s: ecm prgid=%d caid=%04x prov=%.4x %s",devId,ecm->prgId,ecm->caId,ecm->provId,on ? "active":"inactive");
   source=ecm->source; transponder=ecm->transponder;
   cEcmInfo *e;
@@ -440,7 +504,6 @@ void cLogger::EcmStatus(const cEcmInfo *ecm, bool on)
   if(prescan>=pmWait) prescan=pmStop;
   SetChains();
   prescan=pmNone;
-  Unlock();
 }
 
 void cLogger::SetChains(void)
@@ -475,7 +538,7 @@ void cLogger::StartChain(cLogChain *chain)
     PRINTF(L_CORE_AU,"%s: starting chain %04x",devId,chain->caid);
     chain->active=true;
     for(cPid *pid=chain->pids.First(); pid; pid=chain->pids.Next(pid)) {
-      cPidFilter *filter=AddFilter(pid->pid,pid->sct,pid->mask,CHAIN_HOLD/8);
+      cPidFilter *filter=AddFilter(pid->pid,pid->sf,CHAIN_HOLD/8);
       if(filter) {
         filter->userData=(void *)chain;
         pid->filter=filter;
@@ -506,13 +569,16 @@ void cLogger::StopChain(cLogChain *chain, bool force)
     }
 }
 
-cPidFilter *cLogger::AddFilter(int Pid, int Section, int Mask, int IdleTime)
+cPidFilter *cLogger::AddFilter(int Pid, const cSectFilter &Filter, int IdleTime)
 {
   cPidFilter *filter=NewFilter(IdleTime);
   if(filter) {
-    if(Pid>1) filter->SetBuffSize(KILOBYTE(64));
-    filter->Start(Pid,Section,Mask);
-    PRINTF(L_CORE_AUEXTRA,"%s: added filter pid=0x%.4x sct=0x%.2x/0x%.2x idle=%d",devId,Pid,Section,Mask,IdleTime);
+    if(Pid>1) {
+      filter->SetBuffSize(KILOBYTE(64));
+      filter->SetTsMode(true);
+      }
+    filter->Start(Pid,Filter);
+    PRINTF(L_CORE_AUEXTRA,"%s: added filter pid=0x%.4x sct=0x%.2x/0x%.2x idle=%d",devId,Pid,Filter.filter[0],Filter.mask[0],IdleTime);
     }
   else PRINTF(L_GEN_ERROR,"no free slot or filter failed to open for logger %s",devId);
   return filter;
@@ -646,9 +712,13 @@ cString NewSourceToString(int Code)
 #define CACHE_VERS 2
 
 class cEcmData : public cEcmInfo {
+friend class cEcmCache;
+private:
+  cEcmData *hashNext;
+  bool saved;
 public:
-  cEcmData(void):cEcmInfo() {}
-  cEcmData(cEcmInfo *e):cEcmInfo(e) {}
+  cEcmData(void):cEcmInfo() { hashNext=0; saved=false; }
+  cEcmData(cEcmInfo *e):cEcmInfo(e) { hashNext=0; saved=false; }
   virtual cString ToString(bool hide);
   bool Parse(const char *buf);
   };
@@ -710,11 +780,58 @@ cString cEcmData::ToString(bool hide)
 
 // -- cEcmCache ----------------------------------------------------------------
 
+// The cache is indexed by (grPrgId,source,transponder), which is what
+// GetCached() looks up on every channel start and what Exists() narrows down
+// before the full Compare().
+// New entries are appended to ECMCACHE_FILE on the next save. The file is
+// only rewritten as a whole if existing entries were changed or deleted.
+// In both cases the lines are collected under the list lock and written
+// after releasing it, so ECM handlers don't stall on file I/O.
+
 cEcmCache ecmcache;
 
 cEcmCache::cEcmCache(void)
 :cStructListPlain<cEcmData>("ecm cache",ECMCACHE_FILE,SL_READWRITE|SL_MISSINGOK)
-{}
+{
+  HashClear();
+  rewrite=true;
+}
+
+cEcmData **cEcmCache::Bucket(int sid, int Source, int Transponder)
+{
+  unsigned int h=(unsigned int)sid*2654435761U ^ (unsigned int)Source*40503U ^ (unsigned int)Transponder;
+  h^=h>>16;
+  return &hash[h%ECMCACHE_HASH];
+}
+
+void cEcmCache::HashAdd(cEcmData *dat)
+{
+  // append to chain to keep the list order for GetCached()
+  cEcmData **p=Bucket(dat->grPrgId,dat->source,dat->transponder);
+  while(*p) p=&(*p)->hashNext;
+  dat->hashNext=0; *p=dat;
+}
+
+void cEcmCache::HashDel(cEcmData *dat)
+{
+  for(cEcmData **p=Bucket(dat->grPrgId,dat->source,dat->transponder); *p; p=&(*p)->hashNext)
+    if(*p==dat) { *p=dat->hashNext; dat->hashNext=0; break; }
+}
+
+void cEcmCache::HashClear(void)
+{
+  memset(hash,0,sizeof(hash));
+}
+
+void cEcmCache::PreLoad(void)
+{
+  // list and index must be cleared together, readers walk the hash chains
+  ListLock(true);
+  Clear();
+  HashClear();
+  Modified(false); rewrite=false;
+  ListUnlock();
+}
 
 void cEcmCache::New(cEcmInfo *e)
 {
@@ -724,16 +841,18 @@ void cEcmCache::New(cEcmInfo *e)
   if(!(dat=Exists(e))) {
     dat=new cEcmData(e);
     Add(dat);
+    HashAdd(dat);
     Modified();
     PRINTF(L_CORE_ECM,"cache add prgId=%d source=%x transponder=%x ecm=%x/%x",e->grPrgId,e->source,e->transponder,e->ecm_pid,e->ecm_table);
     }
   else {
     if(strcasecmp(e->name,dat->name)) {
       dat->SetName(e->name);
-      Modified();
+      Modified(); rewrite=true;
+      }
+    if(dat->AddCaDescr(e)) {
+      Modified(); rewrite=true;
       }
-    if(dat->AddCaDescr(e))
-      Modified();
     }
   ListUnlock();
   e->SetCached();
@@ -742,7 +861,7 @@ void cEcmCache::New(cEcmInfo *e)
 cEcmData *cEcmCache::Exists(cEcmInfo *e)
 {
   cEcmData *dat;
-  for(dat=First(); dat; dat=Next(dat))
+  for(dat=*Bucket(e->grPrgId,e->source,e->transponder); dat; dat=dat->hashNext)
     if(dat->Compare(e)) break;
   return dat;
 }
@@ -753,7 +872,7 @@ int cEcmCache::GetCached(cSimpleList<cEcmInfo> *list, int sid, int Source, int T
   list->Clear();
   if(ScSetup.EcmCache>1) return 0;
   ListLock(false);
-  for(cEcmData *dat=First(); dat; dat=Next(dat)) {
+  for(cEcmData *dat=*Bucket(sid,Source,Transponder); dat; dat=dat->hashNext) {
     if(dat->grPrgId==sid && dat->source==Source && dat->transponder==Transponder) {
       cEcmInfo *e=new cEcmInfo(dat);
       if(e) {
@@ -771,20 +890,23 @@ int cEcmCache::GetCached(cSimpleList<cEcmInfo> *list, int sid, int Source, int T
 void cEcmCache::Delete(cEcmInfo *e)
 {
   if(ScSetup.EcmCache>0) return;
-  ListLock(false);
+  ListLock(true);
   cEcmData *dat=Exists(e);
-  ListUnlock();
   if(dat) {
+    HashDel(dat);
     DelItem(dat);
+    rewrite=true;
     PRINTF(L_CORE_ECM,"invalidated cached prgId=%d source=%x transponder=%x ecm=%x/%x",dat->grPrgId,dat->source,dat->transponder,dat->ecm_pid,dat->ecm_table);
     }
+  ListUnlock();
 }
 
 void cEcmCache::Flush(void)
 {
   ListLock(true);
   Clear();
-  Modified();
+  HashClear();
+  Modified(); rewrite=true;
   PRINTF(L_CORE_ECM,"cache flushed");
   ListUnlock();
 }
@@ -792,27 +914,91 @@ void cEcmCache::Flush(void)
 bool cEcmCache::ParseLinePlain(const char *line)
 {
   cEcmData *dat=new cEcmData;
-  if(dat && dat->Parse(line) && !Exists(dat)) Add(dat);
+  if(dat && dat->Parse(line) && !Exists(dat)) {
+    dat->saved=true;
+    Add(dat);
+    HashAdd(dat);
+    }
   else delete dat;
   return true;
 }
 
+void cEcmCache::Save(void)
+{
+  if(!CheckDoSave()) return;
+  cStringList lines(Count()+1);
+  ListLock(true);
+  bool full=rewrite;
+  for(cEcmData *dat=First(); dat; dat=Next(dat))
+    if(full || !dat->saved) {
+      lines.Append(strdup(*dat->ToString(false)));
+      dat->saved=true;
+      }
+  Modified(false); rewrite=false;
+  ListUnlock();
+
+  bool ok=false;
+  if(full) {
+    cSafeFile f(path);
+    if(f.Open()) {
+      PreSave(f);
+      for(int i=0; i<lines.Size(); i++) fprintf(f,"%s\n",lines[i]);
+      ok=f.Close();
+      }
+    }
+  else if(lines.Size()>0) {
+    FILE *f=fopen(path,"a");
+    if(f) {
+      for(int i=0; i<lines.Size(); i++) fprintf(f,"%s\n",lines[i]);
+      ok=(fclose(f)==0);
+      }
+    else PRINTF(L_GEN_ERROR,"failed open %s: %s",path,strerror(errno));
+    }
+  else ok=true;
+  if(ok)
+    PRINTF(L_CORE_LOAD,"%s %d %s to %s",full?"saved":"appended",lines.Size(),type,path);
+  else {
+    // retry with a complete rewrite next time
+    ListLock(true);
+    Modified(); rewrite=true;
+    ListUnlock();
+    }
+}
+
 // -- cCaDescr -----------------------------------------------------------------
 
 cCaDescr::cCaDescr(void)
 {
-  descr=0; len=0;
+  Init();
 }
 
 cCaDescr::cCaDescr(const cCaDescr &cd)
 {
-  descr=0; len=0;
+  Init();
   Set(cd.descr,cd.len);
 }
 
 cCaDescr::~cCaDescr()
 {
-  Clear();
+  if(mem!=sbuff) free(mem);
+}
+
+void cCaDescr::Init(void)
+{
+  descr=0; len=0;
+  mem=sbuff; size=sizeof(sbuff);
+}
+
+bool cCaDescr::Reserve(int l)
+{
+  if(l<=size) return true;
+  unsigned char *m=MALLOC(unsigned char,l);
+  if(!m) return false;
+  if(len) memcpy(m,mem,len);
+  if(mem!=sbuff) free(mem);
+  mem=m; size=l;
+  if(descr) descr=mem;
+  return true;
 }
 
 const unsigned char *cCaDescr::Get(int &l) const
@@ -823,42 +1009,34 @@ const unsigned char *cCaDescr::Get(int &l) const
 
 void cCaDescr::Set(const cCaDescr *d)
 {
-  Set(d->descr,d->len);
+  if(d!=this) Set(d->descr,d->len);
 }
 
 void cCaDescr::Set(const unsigned char *de, int l)
 {
   Clear();
-  if(l) {
-    descr=MALLOC(unsigned char,l);
-    if(descr) {
-      memcpy(descr,de,l);
-      len=l;
-      }
+  if(l && Reserve(l)) {
+    memmove(mem,de,l);
+    descr=mem; len=l;
     }
 }
 
 void cCaDescr::Clear(void)
 {
-  free(descr); descr=0; len=0;
+  descr=0; len=0;
 }
 
 void cCaDescr::Join(const cCaDescr *cd, bool rev)
 {
-  if(cd->descr) {
+  if(cd->descr && cd!=this) {
     int l=len+cd->len;
-    unsigned char *m=MALLOC(unsigned char,l);
-    if(m) {
-      if(!rev) {
-        if(descr) memcpy(m,descr,len);
-        memcpy(m+len,cd->descr,cd->len);
-        }
+    if(Reserve(l)) {
+      if(!rev) memcpy(mem+len,cd->descr,cd->len);
       else {
-        memcpy(m,cd->descr,cd->len);
-        if(descr) memcpy(m+cd->len,descr,len);
+        memmove(mem+cd->len,mem,len);
+        memcpy(mem,cd->descr,cd->len);
         }
-      Clear();
-      descr=m; len=l;
+      descr=mem; len=l;
       }
     }
 }
@@ -877,8 +1055,34 @@ cString cCaDescr::ToString(void)
   return str;
 }
 
+// -- cPrgPid ------------------------------------------------------------------
+
+static cItemPool prgPidPool(sizeof(cPrgPid),256);
+
+void *cPrgPid::operator new(size_t size)
+{
+  return prgPidPool.Alloc(size);
+}
+
+void cPrgPid::operator delete(void *p, size_t size)
+{
+  prgPidPool.Free(p,size);
+}
+
 // -- cPrg ---------------------------------------------------------------------
 
+static cItemPool prgPool(sizeof(cPrg),32);
+
+void *cPrg::operator new(size_t size)
+{
+  return prgPool.Alloc(size);
+}
+
+void cPrg::operator delete(void *p, size_t size)
+{
+  prgPool.Free(p,size);
+}
+
 cPrg::cPrg(void)
 {
   Setup();
@@ -937,11 +1141,26 @@ class cEcmPri : public cSimpleItem {
 public:
   cEcmInfo *ecm;
   int pri, sysIdent;
+  //
+  static void *operator new(size_t size);
+  static void operator delete(void *p, size_t size);
   };
 
+static cItemPool ecmPriPool(sizeof(cEcmPri),128);
+
+void *cEcmPri::operator new(size_t size)
+{
+  return ecmPriPool.Alloc(size);
+}
+
+void cEcmPri::operator delete(void *p, size_t size)
+{
+  ecmPriPool.Free(p,size);
+}
+
 // -- cEcmHandler --------------------------------------------------------------
 
-class cEcmHandler : public cSimpleItem, public cAction {
+class cEcmHandler : public cSimpleItem, public cAction, private cEcmCallback {
 private:
   const char *devId;
   int cwIndex;
@@ -960,9 +1179,20 @@ private:
   bool sync, noKey, trigger, ecmUpd;
   int triggerMode;
   int mode, count;
-  cTimeMs lastsync, startecm, resendTime;
+  cTimeMs lastsync, startecm;
   unsigned int cryptPeriod;
+  enum eEcmTimer { etResend, etSyncLoss, etHold, etCount };
+  uint64_t deadline[etCount];
+  int keyStamp;
   unsigned char parity;
+  cEcmJob *job;
+  int jobId;
+  int seenParity;
+  uint64_t flipTime;
+  bool flipPending, periodOk;
+  struct {
+    int period, count, proc, procMax, margin, marginMin, marginAvg, low;
+    } timing;
   cMsgCache failed;
   //
   cSimpleList<cEcmInfo> ecmList;
@@ -974,6 +1204,13 @@ private:
   //
   void DeleteSys(void);
   void NoSync(bool clearParity);
+  void Schedule(int tm, int ms);
+  bool Expired(int tm, uint64_t now);
+  void Arm(void);
+  void Flip(int par, uint64_t when);
+  void Margin(void);
+  void EcmResult(const unsigned char *data, int ecmid, bool cwok, int elapsed);
+  virtual void EcmDone(cEcmJob *job);
   cEcmInfo *NewEcm(void);
   cEcmInfo *JumpEcm(void);
   void StopEcm(void);
@@ -991,6 +1228,7 @@ public:
   void SetPrg(cPrg *Prg);
   void ShiftCwIndex(int cwindex);
   char *CurrentKeyStr(void) const;
+  char *TimingStr(void);
   bool IsRemoveable(void);
   bool IsIdle(void);
   int Sid(void) const { return prg.sid; }
@@ -1008,11 +1246,16 @@ cEcmHandler::cEcmHandler(cCam *Cam, cDevice *Device, const char *DevId, int cwin
   sys=0; filter=0; ecm=0; ecmPri=0; mode=-1;
   trigger=ecmUpd=false; triggerMode=-1;
   filterSource=filterTransponder=0; filterCwIndex=-1; filterSid=-1;
+  memset(deadline,0,sizeof(deadline)); keyStamp=0;
+  job=0; jobId=0;
+  seenParity=-1; flipTime=0; flipPending=periodOk=false;
+  memset(&timing,0,sizeof(timing));
   id=bprintf("%s.%d",devId,cwindex);
 }
 
 cEcmHandler::~cEcmHandler()
 {
+  Detach();
   Lock();
   StopEcm();
   DelAllFilter(); // delete filters before sys for multi-threading reasons
@@ -1166,9 +1409,18 @@ void cEcmHandler::Process(cPidFilter *filter, unsigned char *data, int len)
 PRINTF(L_CORE_ECM,"%s: new caDescr: %s",id,*filterCaDescr.ToString());
       }
     triggerMode=-1;
+    if(IsIdle()) Schedule(etHold,max(1,MAX_ECM_HOLD-(int)idleTime.Elapsed()));
+    else Schedule(etHold,0);
     }
   dataMutex.Unlock();
 
+  uint64_t now=cTimeMs::Now();
+  bool resendDue=Expired(etResend,now), syncLossDue=Expired(etSyncLoss,now);
+  if(Expired(etHold,now) && mode>0 && IsIdle()) {
+    PRINTF(L_CORE_ECM,"%s: hold timeout expired",id);
+    mode=0;
+    }
+
   switch(mode) {
     case -1:
       filter->SetIdleTime(IDLE_SLEEP);
@@ -1176,6 +1428,7 @@ PRINTF(L_CORE_ECM,"%s: new caDescr: %s",id,*filterCaDescr.ToString());
 
     case 0:
       StopEcm();
+      Schedule(etResend,0); Schedule(etSyncLoss,0);
       if(filterSid<0 || IsIdle()) { mode=-1; break; }
 
       dolog=LOG_COUNT;
@@ -1200,11 +1453,14 @@ PRINTF(L_CORE_ECM,"%s: new caDescr: %s",id,*filterCaDescr.ToString());
 
     case 4:
     case 5:
+      // a running job's result belongs to the old failed cache
+      if(job) jobId=-1;
       NoSync(mode==4);
       failed.Clear();
       filter->SetIdleTime(IDLE_NO_SYNC/2);
       lastsync.Set();
       cryptPeriod=20*1000;
+      seenParity=-1; flipPending=periodOk=false;
       mode=2;
       // fall through
           
@@ -1223,14 +1479,37 @@ PRINTF(L_CORE_ECM,"%s: new caDescr: %s",id,*filterCaDescr.ToString());
 
     case 3:
       {
-      bool resend=false, cwok=false;
-      if(resendTime.TimedOut()) {
-        resend=sync; resendTime.Set(8*24*60*60*1000);
+      bool cwok=false;
+      unsigned char jbuff[MAX_SECT_SIZE];
+      if(resendDue && sync) {
+        PRINTF(L_CORE_ECMPROC,"%s: resending CW",id);
+        cam->WriteCW(filterCwIndex,lastCw,true);
+        }
+      if(syncLossDue && sync) {
+        PRINTF(L_CORE_ECM,"%s: lost sync (period %d, elapsed %d)",id,cryptPeriod,(int)lastsync.Elapsed());
+        NoSync(true);
         }
 
       if(startecm.Elapsed()<3*60*1000) cam->DumpAV7110();
 
-      if(data && len>0) {
+      if(job) {
+        if(!job->Done()) {
+          // keep draining the filter while the system is busy
+          if(data && len>0 && SCT_LEN(data)==len && (data[0]&1)!=seenParity)
+            Flip(data[0]&1,filter->DataTime());
+          break;
+          }
+        if(jobId<0) {
+          PRINTF(L_CORE_ECMPROC,"%s: dropping stale result",id);
+          delete job; job=0;
+          break;
+          }
+        len=job->Len(); memcpy(jbuff,job->Data(),len); data=jbuff;
+        cwok=job->Result();
+        EcmResult(data,jobId,cwok,job->Duration());
+        delete job; job=0;
+        }
+      else if(data && len>0) {
         HEXDUMP(L_HEX_ECM,data,len,"ECM sys 0x%04x id 0x%02x pid 0x%04x",ecm->caId,ecm->provId,filter->Pid());
         if(SCT_LEN(data)==len) {
           if(ecm->rewriter) {
@@ -1238,31 +1517,29 @@ PRINTF(L_CORE_ECM,"%s: new caDescr: %s",id,*filterCaDescr.ToString());
             HEXDUMP(L_HEX_ECM,data,len,"rewritten to");
             }
           LDUMP(L_CORE_ECMPROC,data,16,"%s: ECM",id);
-          int n;
+          if((data[0]&1)!=seenParity) Flip(data[0]&1,filter->DataTime());
+          int n, fk, nk;
+          cSystem::KeyStats(fk,nk);
+          if(!sync && parity!=0xFF && nk!=keyStamp) {
+            // keys changed since the last failure, don't wait for the next parity
+            PRINTF(L_CORE_ECMPROC,"%s: new keys, retrying",id);
+            parity=0xFF; failed.Clear();
+            }
+          keyStamp=nk;
           if(!(n=sys->CheckECM(ecm,data,sync))) {
-            if(resend || parity!=(data[0]&1)) {
-              int ecmid;
-              cTimeMs procTime;
-              cwok=(ecmid=failed.Get(data,len,0))>=0 && sys->ProcessECM(ecm,data);
-              n=(ecmid>0)?failed.Cache(ecmid,cwok,0):99;
-              sys->CheckECMResult(ecm,data,cwok);
-              if(cwok) {
-                parity=data[0]&1;
+            if(parity!=(data[0]&1)) {
+              // the CW must be ready before the next parity flip
+              ecm->deadline=flipTime ? flipTime+cryptPeriod : 0;
+              int ecmid=failed.Get(data,len,0);
+              if(ecmid>=0 && sys->Async()) {
+                // result is picked up in a later call, see EcmDone()
+                jobId=ecmid;
+                job=sys->ProcessECMAsync(ecm,data,this);
+                break;
                 }
-              else {
-                if(procTime.Elapsed()>6000) {
-                  PRINTF(L_CORE_ECM,"%s: filter flush (elapsed %d)",id,(int)procTime.Elapsed());
-                  filter->Flush();
-                  }
-                if(n>=2) { count++; if(n==2) count++; }
-                parity=0xFF;
-                if(sync && lastsync.Elapsed()>cryptPeriod*2) {
-                  PRINTF(L_CORE_ECM,"%s: lost sync (period %d, elapsed %d)",id,cryptPeriod,(int)lastsync.Elapsed());
-                  NoSync(true);
-                  }
-                }
-              PRINTF(L_CORE_ECMPROC,"%s: (%s) cwok=%d ecmid=%d n=%d sync=%d parity=%d count=%d ELA=%d",
-                    id,sys->Name(),cwok,ecmid,n,sync,parity,count,(int)procTime.Elapsed());
+              cTimeMs procTime;
+              cwok=ecmid>=0 && sys->ProcessECM(ecm,data);
+              EcmResult(data,ecmid,cwok,procTime.Elapsed());
               }
             }
           else {
@@ -1290,20 +1567,25 @@ PRINTF(L_CORE_ECM,"%s: new caDescr: %s",id,*filterCaDescr.ToString());
 
       if(cwok) {
         dolog=LOG_COUNT; sys->DoLog(true);
-        cam->WriteCW(filterCwIndex,sys->CW(),resend || !sync);
+        cam->WriteCW(filterCwIndex,sys->CW(),!sync);
         memcpy(lastCw,sys->CW(),sizeof(lastCw));
         noKey=false; count=0;
         UpdateEcm(); EcmOk();
+        if(flipPending && data) {
+          flipPending=false;
+          if(periodOk) Margin();
+          }
         if(!sync) {
           sync=true;
           filter->SetIdleTime(IDLE_SYNC);
           PRINTF(L_CORE_ECM,"%s: correct key found",id);
           if(!cam->IsSoftCSA(filterCwIndex==0))
-            resendTime.Set(CW_REPEAT_TIME);
+            Schedule(etResend,CW_REPEAT_TIME);
           }
-        else if(!resend)
+        else if(!periodOk)
           cryptPeriod=max(5000,min(60000,(int)lastsync.Elapsed()));
         lastsync.Set();
+        Schedule(etSyncLoss,cryptPeriod*2);
         }
 
       if(!sync && !trigger) {
@@ -1328,25 +1610,120 @@ PRINTF(L_CORE_ECM,"%s: new caDescr: %s",id,*filterCaDescr.ToString());
           }
         }
         
-      if(IsIdle() && idleTime.Elapsed()>MAX_ECM_HOLD) {
-        PRINTF(L_CORE_ECM,"%s: hold timeout expired",id);
-        mode=0;
-        }
-
       break;
       }
     }
+  Arm();
+}
+
+void cEcmHandler::Schedule(int tm, int ms)
+{
+  deadline[tm]=ms>0 ? cTimeMs::Now()+ms : 0;
+}
+
+bool cEcmHandler::Expired(int tm, uint64_t now)
+{
+  if(deadline[tm] && deadline[tm]<=now) {
+    deadline[tm]=0;
+    return true;
+    }
+  return false;
+}
+
+void cEcmHandler::Arm(void)
+{
+  // wake up for the earliest pending deadline. Expired ones have been
+  // consumed at the start of Process()
+  uint64_t next=0;
+  for(int i=0; i<etCount; i++)
+    if(deadline[i] && (!next || deadline[i]<next)) next=deadline[i];
+  uint64_t now=cTimeMs::Now();
+  filter->SetTimer(!next ? 0 : next>now ? (int)(next-now) : 1);
+}
+
+void cEcmHandler::EcmResult(const unsigned char *data, int ecmid, bool cwok, int elapsed)
+{
+  int n=(ecmid>0)?failed.Cache(ecmid,cwok,0):99;
+  sys->CheckECMResult(ecm,data,cwok);
+  if(cwok) {
+    parity=data[0]&1;
+    }
+  else {
+    if(elapsed>6000) {
+      PRINTF(L_CORE_ECM,"%s: filter flush (elapsed %d)",id,elapsed);
+      filter->Flush();
+      }
+    if(n>=2) { count++; if(n==2) count++; }
+    parity=0xFF;
+    }
+  PRINTF(L_CORE_ECMPROC,"%s: (%s) cwok=%d ecmid=%d n=%d sync=%d parity=%d count=%d ELA=%d",
+        id,sys->Name(),cwok,ecmid,n,sync,parity,count,elapsed);
+}
+
+void cEcmHandler::EcmDone(cEcmJob *Job)
+{
+  if(filter) filter->Wakeup();
+}
+
+void cEcmHandler::Flip(int par, uint64_t when)
+{
+  // the ECM with the new table id carries the CW for the next crypto period.
+  // Measure the period between flips at arrival time, so processing delays
+  // don't add jitter.
+  if(seenParity>=0 && sync) {
+    int p=(int)(when-flipTime);
+    if(p>=5000 && p<=60000) { cryptPeriod=p; periodOk=true; }
+    else periodOk=false;
+    }
+  PRINTF(L_CORE_ECMPROC,"%s: parity flip to %d (period %d%s)",id,par,cryptPeriod,periodOk?"":" guessed");
+  seenParity=par; flipTime=when; flipPending=true;
+}
+
+void cEcmHandler::Margin(void)
+{
+  // time left between CW write and the predicted next flip
+  int proc=(int)(cTimeMs::Now()-flipTime), margin=cryptPeriod-proc;
+  dataMutex.Lock();
+  bool wasLow=timing.count>0 && timing.margin<CW_MARGIN_WARN;
+  if(!timing.count++) timing.marginMin=timing.marginAvg=margin;
+  else {
+    timing.marginMin=min(timing.marginMin,margin);
+    timing.marginAvg=(timing.marginAvg*7+margin)/8;
+    }
+  timing.period=cryptPeriod;
+  timing.proc=proc; timing.procMax=max(timing.procMax,proc);
+  timing.margin=margin;
+  if(margin<CW_MARGIN_WARN) timing.low++;
+  dataMutex.Unlock();
+  if(margin<CW_MARGIN_WARN && !wasLow)
+    PRINTF(L_GEN_WARN,"%s: CW ready only %d ms before parity flip (processing %d ms, period %d ms)",id,margin,proc,cryptPeriod);
+  else
+    PRINTF(L_CORE_ECMPROC,"%s: CW ready %d ms before parity flip (processing %d ms)",id,margin,proc);
+}
+
+char *cEcmHandler::TimingStr(void)
+{
+  cMutexLock lock(&dataMutex);
+  if(!timing.count) return strdup("no data");
+  return bprintf("period %d ms, processing %d ms (max %d), margin %d ms (min %d, avg %d), %d of %d low",
+                 timing.period,timing.proc,timing.procMax,timing.margin,timing.marginMin,timing.marginAvg,timing.low,timing.count);
 }
 
 void cEcmHandler::NoSync(bool clearParity)
 {
   if(clearParity) parity=0xFF;
   count=0; sync=false;
+  Schedule(etResend,0); Schedule(etSyncLoss,0);
 }
 
 void cEcmHandler::DeleteSys(void)
 {
-  delete sys; sys=0;
+  if(job) {
+    // don't block the reactor, the job frees the system when it's done
+    job->Abandon(true); job=0;
+    }
+  else delete sys;
+  sys=0;
 }
 
 char *cEcmHandler::CurrentKeyStr(void) const
@@ -2077,6 +2454,14 @@ char *cGlobal::CurrKeyStr(int camindex, int num, const char **id)
   return str;
 }
 
+char *cGlobal::TimingStr(int camindex, int num, const char **id)
+{
+  cMutexLock lock(&cams.listMutex);
+  cCam *c;
+  for(c=cams.First(); c && camindex>0; c=cams.Next(c), camindex--);
+  return c ? c->TimingStr(num,id) : 0;
+}
+
 void cGlobal::HouseKeeping(void)
 {
   cMutexLock lock(&cams.listMutex);
@@ -2142,6 +2527,8 @@ cCam::~cCam()
 {
   cams.Unregister(this);
   handlerList.Clear();
+  // abandoned ECM jobs may still call back through their system
+  cEcmJob::WaitAbandoned();
   delete hookman;
   delete logger;
 #ifndef FFDECSAWRAPPER
@@ -2539,6 +2926,16 @@ char *cCam::CurrentKeyStr(int num, const char **id)
   return 0;
 }
 
+char *cCam::TimingStr(int num, const char **id)
+{
+  cMutexLock lock(&camMutex);
+  if(id) *id=devId;
+  cEcmHandler *handler;
+  for(handler=handlerList.First(); handler; handler=handlerList.Next(handler))
+    if(--num<0) return handler->TimingStr();
+  return 0;
+}
+
 bool cCam::Active(bool log)
 {
   cMutexLock lock(&camMutex);
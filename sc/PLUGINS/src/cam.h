@@ -42,17 +42,28 @@ class cScDevicePlugin;
 
 // ----------------------------------------------------------------
 
+#define ECMCACHE_HASH 256
+
 class cEcmCache : public cStructListPlain<cEcmData> {
 private:
+  cEcmData *hash[ECMCACHE_HASH];
+  bool rewrite;
+  //
+  cEcmData **Bucket(int sid, int Source, int Transponder);
+  void HashAdd(cEcmData *dat);
+  void HashDel(cEcmData *dat);
+  void HashClear(void);
   cEcmData *Exists(cEcmInfo *e);
 protected:
   virtual bool ParseLinePlain(const char *line);
+  virtual void PreLoad(void);
 public:
   cEcmCache(void);
   void New(cEcmInfo *e);
   int GetCached(cSimpleList<cEcmInfo> *list, int sid, int Source, int Transponder);
   void Delete(cEcmInfo *e);
   void Flush(void);
+  virtual void Save(void);
   };
 
 extern cEcmCache ecmcache;
@@ -79,10 +90,16 @@ public:
 
 // ----------------------------------------------------------------
 
+#define CADESCR_SBUFF 64
+
 class cCaDescr {
 private:
-  unsigned char *descr;
-  int len;
+  unsigned char *descr, *mem;
+  int len, size;
+  unsigned char sbuff[CADESCR_SBUFF];
+  //
+  void Init(void);
+  bool Reserve(int l);
 public:
   cCaDescr(void);
   cCaDescr(const cCaDescr &arg);
@@ -106,6 +123,8 @@ public:
   cCaDescr caDescr;
   //
   cPrgPid(int Type, int Pid) { type=Type; pid=Pid; proc=false; }
+  static void *operator new(size_t size);
+  static void operator delete(void *p, size_t size);
   bool Proc(void) const { return proc; }
   void Proc(bool is) { proc=is; };
   };
@@ -124,6 +143,8 @@ public:
   //
   cPrg(void);
   cPrg(int Sid, bool IsUpdate);
+  static void *operator new(size_t size);
+  static void operator delete(void *p, size_t size);
   bool IsUpdate(void) const { return isUpdate; }
   bool HasPidCaDescr(void) const { return pidCaDescr; }
   void SetPidCaDescr(bool val) { pidCaDescr=val; }
@@ -223,6 +244,7 @@ public:
   void PostTune(void);
   void SetPid(int type, int pid, bool on);
   char *CurrentKeyStr(int num, const char **id);
+  char *TimingStr(int num, const char **id);
 #ifndef FFDECSAWRAPPER
   bool OwnSlot(const cCamSlot *slot) const;
   cDeCSA *DeCSA(void) const { return decsa; }
@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <openssl/evp.h>
 
 #include "crypto.h"
 #include "helper.h"
@@ -174,12 +176,87 @@ int cRSA::Output(unsigned char *out, int n, cBN *r, bool LE) const
   else   return r->Put(out,n);
 }
 
-int cRSA::RSA(unsigned char *out, const unsigned char *in, int n, const BIGNUM *exp, const BIGNUM *mod, bool LE) const
+// Each thread keeps a BN_CTX and the Montgomery contexts of the last few
+// moduli, keyed on the modulus value. Only odd moduli have one, others fall
+// back to BN_mod_exp().
+
+#define RSA_MONT_CACHE 8
+
+struct RsaMontEntry {
+  BIGNUM *mod;
+  BN_MONT_CTX *mont;
+  };
+
+struct RsaCache {
+  BN_CTX *ctx;
+  struct RsaMontEntry e[RSA_MONT_CACHE];
+  int next;
+  };
+
+static pthread_key_t rsaCacheKey;
+static pthread_once_t rsaCacheOnce=PTHREAD_ONCE_INIT;
+
+static void RsaCacheFree(void *p)
 {
+  struct RsaCache *c=(struct RsaCache *)p;
+  for(int i=0; i<RSA_MONT_CACHE; i++) {
+    BN_free(c->e[i].mod);
+    BN_MONT_CTX_free(c->e[i].mont);
+    }
+  BN_CTX_free(c->ctx);
+  free(c);
+}
+
+static void RsaCacheInit(void)
+{
+  pthread_key_create(&rsaCacheKey,RsaCacheFree);
+}
+
+static struct RsaCache *RsaCacheGet(void)
+{
+  pthread_once(&rsaCacheOnce,RsaCacheInit);
+  struct RsaCache *c=(struct RsaCache *)pthread_getspecific(rsaCacheKey);
+  if(!c) {
+    if(!(c=(struct RsaCache *)calloc(1,sizeof(struct RsaCache)))) return 0;
+    if(!(c->ctx=BN_CTX_new())) { free(c); return 0; }
+    pthread_setspecific(rsaCacheKey,c);
+    }
+  return c;
+}
+
+static BN_MONT_CTX *RsaMont(struct RsaCache *c, const BIGNUM *mod)
+{
+  if(!BN_is_odd(mod)) return 0;
+  for(int i=0; i<RSA_MONT_CACHE; i++)
+    if(c->e[i].mont && !BN_cmp(c->e[i].mod,mod)) return c->e[i].mont;
+  struct RsaMontEntry *e=&c->e[c->next];
+  c->next=(c->next+1)%RSA_MONT_CACHE;
+  BN_free(e->mod); e->mod=0;
+  BN_MONT_CTX_free(e->mont); e->mont=0;
+  if(!(e->mod=BN_dup(mod)) || !(e->mont=BN_MONT_CTX_new()) || !BN_MONT_CTX_set(e->mont,mod,c->ctx)) {
+    BN_free(e->mod); e->mod=0;
+    BN_MONT_CTX_free(e->mont); e->mont=0;
+    }
+  return e->mont;
+}
+
+bool cRSA::ModExp(BIGNUM *r, BIGNUM *d, const BIGNUM *exp, const BIGNUM *mod) const
+{
+  struct RsaCache *c=RsaCacheGet();
+  if(c) {
+    BN_MONT_CTX *mont=RsaMont(c,mod);
+    if(mont) return BN_mod_exp_mont(r,d,exp,mod,c->ctx,mont);
+    return BN_mod_exp(r,d,exp,mod,c->ctx);
+    }
   cBNctx ctx;
+  return BN_mod_exp(r,d,exp,mod,ctx);
+}
+
+int cRSA::RSA(unsigned char *out, const unsigned char *in, int n, const BIGNUM *exp, const BIGNUM *mod, bool LE) const
+{
   cBN r, d;
   if(Input(&d,in,n,LE)) {
-    if(BN_mod_exp(r,d,exp,mod,ctx)) return Output(out,n,&r,LE);
+    if(ModExp(r,d,exp,mod)) return Output(out,n,&r,LE);
     PRINTF(L_GEN_ERROR,"rsa: mod-exp failed");
     }
   return 0;
@@ -187,10 +264,9 @@ int cRSA::RSA(unsigned char *out, const unsigned char *in, int n, const BIGNUM *
 
 int cRSA::RSA(BIGNUM *out, const unsigned char *in, int n, const BIGNUM *exp, const BIGNUM *mod, bool LE) const
 {
-  cBNctx ctx;
   cBN d;
   if(Input(&d,in,n,LE)) {
-    if(BN_mod_exp(out,d,exp,mod,ctx)) return BN_num_bytes(out);
+    if(ModExp(out,d,exp,mod)) return BN_num_bytes(out);
     PRINTF(L_GEN_ERROR,"rsa: mod-exp failed");
     }
   return 0;
@@ -198,13 +274,28 @@ int cRSA::RSA(BIGNUM *out, const unsigned char *in, int n, const BIGNUM *exp, co
 
 int cRSA::RSA(unsigned char *out, int n, BIGNUM *in, const BIGNUM *exp, const BIGNUM *mod, bool LE) const
 {
-  cBNctx ctx;
   cBN r;
-  if(BN_mod_exp(r,in,exp,mod,ctx)) return Output(out,n,&r,LE);
+  if(ModExp(r,in,exp,mod)) return Output(out,n,&r,LE);
   PRINTF(L_GEN_ERROR,"rsa: mod-exp failed");
   return 0;
 }
 
+int cRSA::RSABatch(struct RsaJob *jobs, int count, const BIGNUM *exp, const BIGNUM *mod, bool LE) const
+{
+  cBN r, d;
+  int ok=0;
+  for(int i=0; i<count; i++) {
+    struct RsaJob *j=&jobs[i];
+    j->res=0;
+    if(Input(&d,j->in,j->len,LE)) {
+      if(ModExp(r,d,exp,mod)) j->res=Output(j->out,j->len,&r,LE);
+      else PRINTF(L_GEN_ERROR,"rsa: mod-exp failed");
+      }
+    if(j->res>0) ok++;
+    }
+  return ok;
+}
+
 // -- cDes ---------------------------------------------------------------------
 
 const unsigned char cDes::_PC1[] = {
@@ -322,22 +413,76 @@ const unsigned char cDes::LS[] = { 1,1,2,2,2,2,2,2,1,2,2,2,2,2,2,1 };
 #define hash(T) ((T&0x0000ffffL) | ((T>>8)&0x00ff0000L) | ((T<<8)&0xff000000L))
 #endif
 
-#define DESROUND(C,D,T) { \
-   unsigned int s=0; \
-   for(int j=7, k=0; j>=0; j--) { \
-     unsigned int v=0, K=0; \
-     for(int t=5; t>=0; t--, k++) { \
-       v=shiftin(v,T,E[k]); \
-       if(PC2[k]<29) K=shiftin(K,C,28-PC2[k]); \
-       else          K=shiftin(K,D,56-PC2[k]); \
-       } \
-     s=(s<<4) + S[7-j][v^K]; \
-     } \
-   T=0; \
-   for(int j=31; j>=0; j--) T=shiftin(T,s,P[j]); \
+#define DESHASH(T) { if(mode&DES_HASH) T=hash(T); }
+
+// The round function works on combined S/P tables: SP[b][x] is the output of
+// S-box b for input x, already shifted into place and run through P. IP and
+// FP are done with nibble tables. All tables are built once from the bit
+// tables above, so they match the generic code bit for bit.
+
+class cDesTables {
+public:
+  unsigned int SP[8][64];
+  uint64_t IP[16][16], FP[16][16];
+  //
+  cDesTables(void);
+  static void PermTable(uint64_t T[16][16], const unsigned char *P);
+  static uint64_t Perm(const uint64_t T[16][16], uint64_t v);
+  };
+
+static cDesTables desTables;
+
+cDesTables::cDesTables(void)
+{
+  for(int b=0; b<8; b++)
+    for(int x=0; x<64; x++) {
+      const unsigned int s=cDes::S[b][x]<<(4*(7-b));
+      unsigned int T=0;
+      for(int j=0; j<32; j++) T=shiftin(T,s,32-cDes::_P[j]);
+      SP[b][x]=T;
+      }
+  PermTable(IP,cDes::IP);
+  PermTable(FP,cDes::FP);
+}
+
+void cDesTables::PermTable(uint64_t T[16][16], const unsigned char *P)
+{
+  memset(T,0,sizeof(uint64_t)*16*16);
+  for(int k=0; k<64; k++) {
+    const int t=64-P[k];      // source bit, counted from LSB
+    const int n=15-(t>>2);    // source nibble, counted from MSB
+    for(int v=0; v<16; v++)
+      if(v&(1<<(t&3))) T[n][v]|=1ULL<<(63-k);
+    }
+}
+
+uint64_t cDesTables::Perm(const uint64_t T[16][16], uint64_t v)
+{
+  uint64_t r=0;
+  for(int n=15; n>=0; n--, v>>=4) r|=T[n][v&15];
+  return r;
+}
+
+#define DESE(T,b) ((((b)==0 ? (T<<31 | T>>1) : (T<<(4*(b)-1) | T>>(33-4*(b))))>>26)&0x3f)
+#define DESROUND(T,k) { \
+   T=desTables.SP[0][DESE(T,0)^k[0]] ^ desTables.SP[1][DESE(T,1)^k[1]] \
+    ^ desTables.SP[2][DESE(T,2)^k[2]] ^ desTables.SP[3][DESE(T,3)^k[3]] \
+    ^ desTables.SP[4][DESE(T,4)^k[4]] ^ desTables.SP[5][DESE(T,5)^k[5]] \
+    ^ desTables.SP[6][DESE(T,6)^k[6]] ^ desTables.SP[7][DESE(T,7)^k[7]]; \
    }
 
-#define DESHASH(T) { if(mode&DES_HASH) T=hash(T); }
+// per thread cache of the last key schedules
+#define DES_KS_CACHE 4
+
+struct DesKeyCache {
+  const unsigned char *pc1, *pc2;
+  int pc1mode;
+  unsigned char key[8];
+  unsigned char ks[16][8];
+  };
+
+static __thread struct DesKeyCache desCache[DES_KS_CACHE];
+static __thread int desCacheNext=0;
 
 cDes::cDes(const unsigned char *pc1, const unsigned char *pc2)
 {
@@ -361,7 +506,8 @@ void cDes::Permute(unsigned char *data, const unsigned char *P, int n) const
   memcpy(data,pin,8);
 }
 
-void cDes::Des(unsigned char *data, const unsigned char *key, int mode) const
+// subkeys of the 16 rounds in encryption order, 6 bits per S-box
+void cDes::Schedule(unsigned char *ks, const unsigned char *key, int mode) const
 {
   unsigned char mkey[8];
   if(mode&DES_PC1) {
@@ -369,41 +515,143 @@ void cDes::Des(unsigned char *data, const unsigned char *key, int mode) const
     Permute(mkey,PC1,56);
     key=mkey;
     }
-  if(mode&DES_IP) Permute(data,IP,64);
   unsigned int C=UINT32_BE(key  ) >> 4;
   unsigned int D=UINT32_BE(key+3) & 0xfffffffL;
-  unsigned int L=UINT32_BE(data  );
-  unsigned int R=UINT32_BE(data+4);
-  if(!(mode&DES_RIGHT)) {
-    for(int i=15; i>=0; i--) {
-      C=rol28(C,LS[15-i]); D=rol28(D,LS[15-i]);
-      unsigned int T=R;
-      if(mode&DES_MOD) T=Mod(T,key[7]); // apply costum mod e.g. Viaccess
-      DESROUND(C,D,T);
-      DESHASH(T);
-      T^=L; L=R; R=T;
+  for(int i=0; i<16; i++) {
+    C=rol28(C,LS[i]); D=rol28(D,LS[i]);
+    for(int b=0, k=0; b<8; b++) {
+      unsigned int K=0;
+      for(int t=5; t>=0; t--, k++) {
+        if(PC2[k]<29) K=shiftin(K,C,28-PC2[k]);
+        else          K=shiftin(K,D,56-PC2[k]);
+        }
+      *ks++=K;
       }
     }
+}
+
+const unsigned char *cDes::KeySchedule(const unsigned char *key, int mode) const
+{
+  const int pc1mode=mode&DES_PC1;
+  const int klen=pc1mode ? 8:7;
+  for(int i=0; i<DES_KS_CACHE; i++) {
+    struct DesKeyCache *c=&desCache[i];
+    if(c->pc2==PC2 && c->pc1mode==pc1mode && (!pc1mode || c->pc1==PC1) && !memcmp(c->key,key,klen))
+      return &c->ks[0][0];
+    }
+  struct DesKeyCache *c=&desCache[desCacheNext];
+  desCacheNext=(desCacheNext+1)%DES_KS_CACHE;
+  Schedule(&c->ks[0][0],key,mode);
+  c->pc1=PC1; c->pc2=PC2; c->pc1mode=pc1mode;
+  memcpy(c->key,key,klen);
+  return &c->ks[0][0];
+}
+
+void cDes::Des(unsigned char *data, const unsigned char *key, int mode) const
+{
+  const unsigned char *ks=KeySchedule(key,mode);
+  // custom mods get key byte 7 (undefined with PC1, as the permuted key has
+  // only 7 bytes)
+  const unsigned int key7=(mode&DES_PC1) ? 0 : key[7];
+  unsigned int L, R;
+  if(mode&DES_IP) {
+    const uint64_t v=cDesTables::Perm(desTables.IP,((uint64_t)UINT32_BE(data)<<32) | UINT32_BE(data+4));
+    L=v>>32; R=v;
+    }
   else {
-    for(int i=15; i>=0; i--) {
-      unsigned int T=R;
-      if(mode&DES_MOD) T=Mod(T,key[7]); // apply costum mod e.g. Viaccess
-      DESROUND(C,D,T);
-      DESHASH(T);
-      T^=L; L=R; R=T;
-      C=ror28(C,LS[i]); D=ror28(D,LS[i]);
-      }
+    L=UINT32_BE(data  );
+    R=UINT32_BE(data+4);
+    }
+  for(int i=0; i<16; i++) {
+    const unsigned char *k=ks+8*((mode&DES_RIGHT) ? 15-i : i);
+    unsigned int T=R;
+    if(mode&DES_MOD) T=Mod(T,key7); // apply costum mod e.g. Viaccess
+    DESROUND(T,k);
+    DESHASH(T);
+    T^=L; L=R; R=T;
+    }
+  if(mode&DES_FP) {
+    const uint64_t v=cDesTables::Perm(desTables.FP,((uint64_t)R<<32) | L);
+    R=v>>32; L=v;
     }
   BYTE4_BE(data  ,R);
   BYTE4_BE(data+4,L);
-  if(mode&DES_FP) Permute(data,FP,64);
 }
 
 // -- cAES ---------------------------------------------------------------------
 
-#ifndef OPENSSL_HAS_AES
-#warning ** openssl lacks AES support. Using deprecated static support code. Update your openssl package.
-#include "support/aes_core.c"
+#ifdef OPENSSL_HAS_AES
+
+// Each thread keeps a few EVP contexts, keyed on key and direction, so the
+// key schedule is only set up once per key even if a new cAES is created for
+// every message. Multi-block ECB calls let EVP use AES-NI/VAES if present.
+
+#define AES_CTX_CACHE 4
+
+struct AesCtxEntry {
+  EVP_CIPHER_CTX *ctx;
+  unsigned char key[16];
+  bool enc, valid;
+  };
+
+struct AesCtxCache {
+  struct AesCtxEntry e[AES_CTX_CACHE];
+  int next;
+  };
+
+static pthread_key_t aesCacheKey;
+static pthread_once_t aesCacheOnce=PTHREAD_ONCE_INIT;
+
+static void AesCacheFree(void *p)
+{
+  struct AesCtxCache *c=(struct AesCtxCache *)p;
+  for(int i=0; i<AES_CTX_CACHE; i++)
+    if(c->e[i].ctx) EVP_CIPHER_CTX_free(c->e[i].ctx);
+  free(c);
+}
+
+static void AesCacheInit(void)
+{
+  pthread_key_create(&aesCacheKey,AesCacheFree);
+}
+
+static EVP_CIPHER_CTX *AesContext(const unsigned char *key, bool enc)
+{
+  pthread_once(&aesCacheOnce,AesCacheInit);
+  struct AesCtxCache *c=(struct AesCtxCache *)pthread_getspecific(aesCacheKey);
+  if(!c) {
+    if(!(c=(struct AesCtxCache *)calloc(1,sizeof(struct AesCtxCache)))) return 0;
+    pthread_setspecific(aesCacheKey,c);
+    }
+  for(int i=0; i<AES_CTX_CACHE; i++) {
+    struct AesCtxEntry *e=&c->e[i];
+    if(e->valid && e->enc==enc && !memcmp(e->key,key,16)) return e->ctx;
+    }
+  struct AesCtxEntry *e=&c->e[c->next];
+  c->next=(c->next+1)%AES_CTX_CACHE;
+  e->valid=false;
+  if(!e->ctx && !(e->ctx=EVP_CIPHER_CTX_new())) return 0;
+  if(!EVP_CipherInit_ex(e->ctx,EVP_aes_128_ecb(),0,key,0,enc)) {
+    PRINTF(L_GEN_ERROR,"AES: cipher init failed");
+    return 0;
+    }
+  EVP_CIPHER_CTX_set_padding(e->ctx,0);
+  memcpy(e->key,key,16); e->enc=enc; e->valid=true;
+  return e->ctx;
+}
+
+static bool AesCrypt(const unsigned char *key, bool enc, const unsigned char *in, unsigned char *out, int len)
+{
+  EVP_CIPHER_CTX *ctx=AesContext(key,enc);
+  int n;
+  return ctx && EVP_CipherUpdate(ctx,out,&n,in,len) && n==len;
+}
+
+#else
+
+#warning ** openssl lacks AES support. Using the constant time support code. Update your openssl package.
+#include "support/aes_ct.c"
+
 #endif
 
 cAES::cAES(void)
@@ -411,10 +659,12 @@ cAES::cAES(void)
   active=false;
 }
 
-void cAES::SetKey(const unsigned char *key)
+void cAES::SetKey(const unsigned char *Key)
 {
-  AES_set_decrypt_key(key,128,&dkey);
-  AES_set_encrypt_key(key,128,&ekey);
+  memcpy(key,Key,sizeof(key));
+#ifndef OPENSSL_HAS_AES
+  AesCtSetKey(rk,key);
+#endif
   active=true;
 }
 
@@ -422,7 +672,11 @@ int cAES::Encrypt(const unsigned char *data, int len, unsigned char *crypt) cons
 {
   if(active) {
     len=(len+15)&(~15); // pad up to a multiple of 16
-    for(int i=0; i<len; i+=16) AES_encrypt(data+i,crypt+i,(const AES_KEY *)&ekey);
+#ifdef OPENSSL_HAS_AES
+    if(!AesCrypt(key,true,data,crypt,len)) return -1;
+#else
+    for(int i=0; i<len; i+=16) AesCtEncrypt(rk,data+i,crypt+i);
+#endif
     return len;
     }
   return -1;
@@ -430,18 +684,19 @@ int cAES::Encrypt(const unsigned char *data, int len, unsigned char *crypt) cons
 
 bool cAES::Decrypt(unsigned char *data, int len) const
 {
-  if(active) {
-    for(int i=0; i<len; i+=16) AES_decrypt(data+i,data+i,(const AES_KEY *)&dkey);
-    return true;
-    }
-  return false;
+  return Decrypt(data,len,data);
 }
 
 bool cAES::Decrypt(const unsigned char *data, int len, unsigned char *decrypt) const
 {
   if(active) {
-    for(int i=0; i<len; i+=16) AES_decrypt(data+i,decrypt+i,(const AES_KEY *)&dkey);
+    len=(len+15)&(~15); // whole blocks, as before
+#ifdef OPENSSL_HAS_AES
+    return AesCrypt(key,false,data,decrypt,len);
+#else
+    for(int i=0; i<len; i+=16) AesCtDecrypt(rk,data+i,decrypt+i);
     return true;
+#endif
     }
   return false;
 }
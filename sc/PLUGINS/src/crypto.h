@@ -25,7 +25,7 @@
 //       They may be called from different threads concurrently.
 //
 // NOTE: cAES is not fully reentrant. Encrypt/Decrypt are reentrant
-//       (as AES_KEY is const there), but SetKey is not. Be carefull.
+//       (they use per thread cipher contexts), but SetKey is not. Be carefull.
 //
 
 #include <openssl/opensslv.h>
@@ -64,10 +64,14 @@
 #define NAGRA_DES_DECR PRV_DES_DECRYPT
 
 class cDes {
+friend class cDesTables;
 private:
-  static const unsigned char _E[], _P[], _PC1[], _PC2[], IP[], FP[];
+  static const unsigned char _E[], _P[], _PC1[], _PC2[];
+  //
+  void Schedule(unsigned char *ks, const unsigned char *key, int mode) const;
+  const unsigned char *KeySchedule(const unsigned char *key, int mode) const;
 protected:
-  static const unsigned char S[][64], LS[];
+  static const unsigned char S[][64], LS[], IP[], FP[];
   const unsigned char *PC1, *PC2;
   unsigned char E[48], P[32];
   //
@@ -81,17 +85,17 @@ public:
 
 // ----------------------------------------------------------------
 
-#if defined(OPENSSL_NO_AES) | defined(NO_AES) | OPENSSL_VERSION_NUMBER<0x0090700fL
-#include "support/aes.h"
-#else
+#if !(defined(OPENSSL_NO_AES) | defined(NO_AES) | OPENSSL_VERSION_NUMBER<0x1000000fL)
 #define OPENSSL_HAS_AES
-#include <openssl/aes.h>
 #endif
 
 class cAES {
 private:
   bool active;
-  AES_KEY dkey, ekey;
+  unsigned char key[16];
+#ifndef OPENSSL_HAS_AES
+  unsigned char rk[176];
+#endif
 public:
   cAES(void);
   void SetKey(const unsigned char *key);
@@ -127,14 +131,24 @@ public:
 
 // ----------------------------------------------------------------
 
+struct RsaJob {
+  unsigned char *out;
+  const unsigned char *in;
+  int len;
+  int res; // set by RSABatch(), same as RSA() would return
+  };
+
 class cRSA {
 private:
   bool Input(cBN *d, const unsigned char *in, int n, bool LE) const;
   int Output(unsigned char *out, int n, cBN *r, bool LE) const;
+  bool ModExp(BIGNUM *r, BIGNUM *d, const BIGNUM *exp, const BIGNUM *mod) const;
 public:
   int RSA(unsigned char *out, const unsigned char *in, int n, const BIGNUM *exp, const BIGNUM *mod, bool LE=true) const;
   int RSA(BIGNUM *out, const unsigned char *in, int n, const BIGNUM *exp, const BIGNUM *mod, bool LE=true) const;
   int RSA(unsigned char *out, int len, BIGNUM *in, const BIGNUM *exp, const BIGNUM *mod, bool LE=true) const;
+  // several messages with the same key, returns the number of successful jobs
+  int RSABatch(struct RsaJob *jobs, int count, const BIGNUM *exp, const BIGNUM *mod, bool LE=true) const;
   };
 
 // ----------------------------------------------------------------
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 
@@ -147,11 +148,13 @@ cFileMap *cFileMaps::GetFileMap(const char *name, const char *domain, bool rw)
 cStructItem::cStructItem(void)
 {
   comment=0; deleted=special=false;
+  loadMark=0; lineHash=0; line=0;
 }
 
 cStructItem::~cStructItem()
 {
   free(comment);
+  free(line);
 }
 
 void cStructItem::SetComment(const char *com)
@@ -178,8 +181,101 @@ cCommentItem::cCommentItem(void)
   SetSpecial();
 }
 
+// -- cLineFile ----------------------------------------------------------------
+
+// Read into memory instead of being mapped, as the files may be rewritten
+// while they are parsed and accessing a mapping of a truncated file raises
+// SIGBUS.
+
+class cLineFile {
+private:
+  char *buff;
+  size_t len, pos;
+public:
+  cLineFile(void);
+  ~cLineFile();
+  bool Open(const char *path);
+  char *Next(void);
+  };
+
+cLineFile::cLineFile(void)
+{
+  buff=0; len=pos=0;
+}
+
+cLineFile::~cLineFile()
+{
+  free(buff);
+}
+
+bool cLineFile::Open(const char *path)
+{
+  int fd=open(path,O_RDONLY);
+  if(fd<0) return false;
+  struct stat64 st;
+  // one spare byte for the terminator, one to see EOF without growing
+  size_t size=(fstat64(fd,&st)==0 ? st.st_size:0)+2;
+  int r;
+  while(1) {
+    if(!buff || len+1>=size) {
+      if(buff) size*=2;
+      char *n=(char *)realloc(buff,size);
+      if(!n) { errno=ENOMEM; r=-1; break; }
+      buff=n;
+      }
+    do { r=read(fd,buff+len,size-1-len); } while(r<0 && errno==EINTR);
+    if(r<=0) break;
+    len+=r;
+    }
+  int err=errno;
+  close(fd);
+  if(r<0) {
+    free(buff); buff=0; len=0;
+    errno=err;
+    return false;
+    }
+  return true;
+}
+
+char *cLineFile::Next(void)
+{
+  if(pos>=len) return 0;
+  char *s=buff+pos;
+  char *e=(char *)memchr(s,'\n',len-pos);
+  if(e) { *e=0; pos=e-buff+1; }
+  else { buff[len]=0; pos=len; }
+  strreplace(s,'\r',0);
+  return s;
+}
+
 // -- cStructLoader ------------------------------------------------------------
 
+struct LineIndex {
+  uint64_t hash;
+  cStructItem *item;
+  };
+
+static int LineIndexCmp(const void *a, const void *b)
+{
+  uint64_t ha=((const struct LineIndex *)a)->hash, hb=((const struct LineIndex *)b)->hash;
+  return ha<hb ? -1 : (ha>hb ? 1 : 0);
+}
+
+struct AddedItem {
+  int pos;
+  cStructItem *item;
+  };
+
+static uint64_t LineHash(const char *line)
+{
+  unsigned char h[16];
+  Hash128((const unsigned char *)line,strlen(line),h);
+  uint64_t r;
+  memcpy(&r,h,sizeof(r));
+  return r|1; // 0 marks items which didn't come from the file
+}
+
+
 cStructLoader::cStructLoader(const char *Type, const char *Filename, int Flags)
 :lock(true)
 {
@@ -198,7 +294,9 @@ void cStructLoader::AddItem(cStructItem *n, const char *com, cStructItem *ref)
   n->SetComment(com);
   ListLock(true);
   cStructItem *a=0;
-  if(ref) { // insert before reference
+  if(ref && ref->Deleted()) // takes the place of a deleted reference
+    a=ref;
+  else if(ref) { // insert before reference
     for(a=First(); a; a=Next(a))
       if(Next(a)==ref) break;
     }
@@ -210,6 +308,7 @@ void cStructLoader::AddItem(cStructItem *n, const char *com, cStructItem *ref)
       }
     }
   Add(n,a);
+  ItemAdded(n,ref);
   Modified();
   ListUnlock();
 }
@@ -299,43 +398,79 @@ void cStructLoader::OpenFailed(void)
   else SL_CLRFLAG(SL_LOADED);
 }
 
+#define LM_OLD    1 // item existed when the reload started
+#define LM_REUSED 2 // item matches an unchanged line
+
+// Marks all current items and builds a sorted hash index of the items which
+// are unchanged since they were read from the file. Call with list lock held.
+int cStructLoader::IndexItems(struct LineIndex *&index, bool build)
+{
+  index=0;
+  if(!Count()) return 0;
+  if(build) index=MALLOC(struct LineIndex,Count());
+  int n=0;
+  for(cStructItem *a=First(); a; a=Next(a)) {
+    a->loadMark=LM_OLD;
+    if(index && a->lineHash && !a->Deleted()) {
+      index[n].hash=a->lineHash;
+      index[n].item=a;
+      n++;
+      }
+    }
+  if(n) qsort(index,n,sizeof(struct LineIndex),LineIndexCmp);
+  return n;
+}
+
 void cStructLoader::Load(bool reload)
 {
   if(SL_TSTFLAG(SL_DISABLED) || (reload && !SL_TSTFLAG(SL_WATCH))) return;
-  FILE *f=fopen(path,"r");
-  if(f) {
-    PreLoad();
+  cLineFile file;
+  if(file.Open(path)) {
     int curr_mtime=MTime(true);
-    ListLock(true);
-    bool doload=false;
-    if(!reload) {
-      Clear(); Modified(false);
-      mtime=curr_mtime;
-      doload=true;
+    if(reload && mtime>=curr_mtime) {
+      LoadFinished();
+      return;
       }
-    else if(mtime<curr_mtime) {
-      PRINTF(L_CORE_LOAD,"detected change of %s",path);
-      if(IsModified())
-        PRINTF(L_CORE_LOAD,"discarding in-memory changes");
-      for(cStructItem *a=First(); a; a=Next(a)) DelItem(a);
-      Modified(false);
-      mtime=curr_mtime;
-      doload=true;
-      }
-    if(doload) {
-      SL_SETFLAG(SL_LOADED);
-      PRINTF(L_GEN_INFO,"loading %s from %s",type,path);
-      CheckAccess();
-      int lineNum=0, num=0;
-      char buff[4096];
-      while(fgets(buff,sizeof(buff),f)) {
-        lineNum++;
-        if(!index(buff,'\n') && !feof(f)) {
-          PRINTF(L_GEN_ERROR,"file %s readbuffer overflow line#%d",path,lineNum);
-          SL_CLRFLAG(SL_LOADED);
-          break;
+    PreLoad();
+    struct LineIndex *index=0;
+    if(reload) PRINTF(L_CORE_LOAD,"detected change of %s",path);
+    ListLock(false);
+    // items may have been changed in place, so don't reuse anything then
+    if(reload && IsModified())
+      PRINTF(L_CORE_LOAD,"discarding in-memory changes");
+    int numIndex=IndexItems(index,reload && !IsModified());
+    ListUnlock();
+    mtime=curr_mtime;
+    SL_SETFLAG(SL_LOADED);
+    PRINTF(L_GEN_INFO,"loading %s from %s",type,path);
+    CheckAccess();
+    // parse into a private list without holding the list lock. Unchanged lines
+    // reuse the existing item, so pointers held elsewhere stay valid.
+    cStructItem **items=0;
+    int numItems=0, maxItems=0, lineNum=0, num=0, reuse=0;
+    char *buff;
+    while((buff=file.Next())) {
+      lineNum++;
+      uint64_t hash=LineHash(buff);
+      cStructItem *it=0;
+      if(numIndex) {
+        struct LineIndex key, *li;
+        key.hash=hash;
+        if((li=(struct LineIndex *)bsearch(&key,index,numIndex,sizeof(struct LineIndex),LineIndexCmp))) {
+          while(li>index && li[-1].hash==hash) li--;
+          for(; li<index+numIndex && li->hash==hash; li++)
+            if(li->item && !strcmp(li->item->line,buff)) {
+              it=li->item; li->item=0;
+              it->loadMark=LM_REUSED;
+              if(it->Valid()) num++;
+              reuse++;
+              break;
+              }
           }
-        strreplace(buff,'\n',0); strreplace(buff,'\r',0); // chomp
+        }
+      if(!it) {
+        // the parser may modify the line
+        char *text=strdup(buff);
         bool hasContent=false;
         char *ls;
         for(ls=buff; *ls; ls++) {
@@ -346,7 +481,6 @@ void cStructLoader::Load(bool reload)
             }
           if(*ls>' ') hasContent=true;		  // line contains something usefull
           }
-        cStructItem *it=0;
         if(hasContent) {
           char save=*ls;
           *ls=0; it=ParseLine(skipspace(buff)); *ls=save;
@@ -358,23 +492,78 @@ void cStructLoader::Load(bool reload)
           }
         else ls=buff;
         if(!it) it=new cCommentItem;
-        if(it) {
+        if(it && text) {
           it->SetComment(ls);
-          Add(it);
+          it->lineHash=hash;
+          it->line=text;
           }
+        else free(text);
+        }
+      if(it && numItems>=maxItems) {
+        int m=maxItems ? maxItems*2 : 256;
+        cStructItem **n=(cStructItem **)realloc(items,m*sizeof(cStructItem *));
+        if(n) { items=n; maxItems=m; }
         else {
-          PRINTF(L_GEN_ERROR,"out of memory loading file %s",path);
-          SL_CLRFLAG(SL_LOADED);
-          break;
+          if(it->loadMark==LM_REUSED) it->loadMark=LM_OLD;
+          else delete it;
+          it=0;
           }
         }
-      ListUnlock();
-      PRINTF(L_CORE_LOAD,"loaded %d %s from %s",num,type,path);
-      PostLoad();
+      if(!it) {
+        PRINTF(L_GEN_ERROR,"out of memory loading file %s",path);
+        SL_CLRFLAG(SL_LOADED);
+        break;
+        }
+      items[numItems++]=it;
       }
-    else ListUnlock();
+    free(index);
 
-    fclose(f);
+    ListLock(true);
+    // Rebuild the list from the parsed items. Items added by AddItem()
+    // meanwhile keep their place between the lines of the old list, so the
+    // lookup order doesn't change. Old items not found in the file anymore
+    // are kept marked deleted until Purge(), as someone may still hold a
+    // pointer to them.
+    int numAdded=0, pos=0, added=0;
+    for(cStructItem *a=First(); a; a=Next(a))
+      if(!a->loadMark) numAdded++;
+    struct AddedItem *adds=numAdded ? MALLOC(struct AddedItem,numAdded) : 0;
+    numAdded=0;
+    cSimpleList<cStructItem> old;
+    cStructItem *a=First();
+    first=last=0; count=0;
+    while(a) {
+      cStructItem *n=Next(a);
+      int mark=a->loadMark;
+      a->loadMark=0;
+      if(mark) pos++;
+      if(mark==LM_OLD) {
+        if(!reload) delete a;
+        else { a->Delete(); old.Add(a); }
+        }
+      else if(!mark) {
+        if(!a->Deleted()) added++;
+        if(adds) { adds[numAdded].pos=pos; adds[numAdded].item=a; numAdded++; }
+        else old.Add(a);
+        }
+      a=n;
+      }
+    int j=0;
+    for(int i=0; i<numItems; i++) {
+      while(j<numAdded && adds[j].pos<=i) Add(adds[j++].item);
+      items[i]->loadMark=0;
+      Add(items[i]);
+      }
+    while(j<numAdded) Add(adds[j++].item);
+    while((a=old.First())) { old.Del(a,false); Add(a); }
+    free(adds);
+    Modified(added>0);
+    Reindex();
+    ListUnlock();
+    free(items);
+    if(reuse) PRINTF(L_CORE_LOAD,"loaded %d %s from %s (%d lines unchanged)",num,type,path,reuse);
+    else PRINTF(L_CORE_LOAD,"loaded %d %s from %s",num,type,path);
+    PostLoad();
     LoadFinished();
     }
   else
@@ -413,7 +602,7 @@ void cStructLoader::Save(void)
 
 void cStructLoader::SafeClear(void)
 {
-  ListLock(true); Clear(); ListUnlock();
+  ListLock(true); Clear(); Reindex(); ListUnlock();
 }
 
 // -- cStructLoaderPlain -------------------------------------------------------
@@ -432,23 +621,17 @@ void cStructLoaderPlain::PreLoad(void)
 void cStructLoaderPlain::Load(bool reload)
 {
   if(SL_TSTFLAG(SL_DISABLED) || reload) return;
-  FILE *f=fopen(path,"r");
-  if(f) {
+  cLineFile file;
+  if(file.Open(path)) {
     PreLoad();
     ListLock(true);
     SL_SETFLAG(SL_LOADED);
     PRINTF(L_GEN_INFO,"loading %s from %s",type,path);
     CheckAccess();
     int lineNum=0;
-    char buff[4096];
-    while(fgets(buff,sizeof(buff),f)) {
+    char *buff;
+    while((buff=file.Next())) {
       lineNum++;
-      if(!index(buff,'\n') && !feof(f)) {
-        PRINTF(L_GEN_ERROR,"file %s readbuffer overflow line#%d",path,lineNum);
-        SL_CLRFLAG(SL_LOADED);
-        break;
-        }
-      strreplace(buff,'\n',0); strreplace(buff,'\r',0); // chomp
       bool hasContent=false;
       char *ls;
       for(ls=buff; *ls; ls++) {
@@ -463,7 +646,6 @@ void cStructLoaderPlain::Load(bool reload)
       }
     ListUnlock();
     PostLoad();
-    fclose(f);
     LoadFinished();
     }
   else
@@ -545,6 +727,7 @@ void cStructLoaders::Purge(void)
 // -- cPid ---------------------------------------------------------------------
 
 cPid::cPid(int Pid, int Section, int Mask)
+:sf(Section,Mask)
 {
   pid=Pid;
   sct=Section;
@@ -552,14 +735,35 @@ cPid::cPid(int Pid, int Section, int Mask)
   filter=0;
 }
 
+cPid::cPid(int Pid, const cSectFilter &Filter)
+:sf(Filter)
+{
+  pid=Pid;
+  sct=Filter.filter[0];
+  mask=Filter.mask[0];
+  filter=0;
+}
+
 // -- cPids --------------------------------------------------------------------
 
 void cPids::AddPid(int Pid, int Section, int Mask)
 {
-  if(!HasPid(Pid,Section,Mask)) {
-    cPid *pid=new cPid(Pid,Section,Mask);
-    Add(pid);
+  AddPid(Pid,cSectFilter(Section,Mask));
+}
+
+void cPids::AddPid(int Pid, const cSectFilter &Filter)
+{
+  // overlapping filters would deliver a section twice, so a filter which
+  // covers another one replaces it.
+  for(cPid *pid=First(); pid;) {
+    cPid *next=Next(pid);
+    if(pid->pid==Pid) {
+      if(pid->sf.Covers(Filter)) return;
+      if(Filter.Covers(pid->sf)) Del(pid);
+      }
+    pid=next;
     }
+  Add(new cPid(Pid,Filter));
 }
 
 bool cPids::HasPid(int Pid, int Section, int Mask)
@@ -572,6 +776,18 @@ bool cPids::HasPid(int Pid, int Section, int Mask)
 
 // -- cEcmInfo -----------------------------------------------------------------
 
+static cItemPool ecmInfoPool(sizeof(cEcmInfo),64);
+
+void *cEcmInfo::operator new(size_t size)
+{
+  return ecmInfoPool.Alloc(size);
+}
+
+void cEcmInfo::operator delete(void *p, size_t size)
+{
+  ecmInfoPool.Free(p,size);
+}
+
 cEcmInfo::cEcmInfo(void)
 {
   Setup();
@@ -606,7 +822,7 @@ cEcmInfo::cEcmInfo(const char *Name, int Pid, int CaId, int ProvId)
 cEcmInfo::~cEcmInfo()
 {
   ClearCaDescr();
-  free(name);
+  if(name!=nameBuff) free(name);
   delete rewriter;
 }
 
@@ -614,10 +830,12 @@ void cEcmInfo::Setup(void)
 {
   cached=failed=false;
   name=0; caDescr=0; caDescrLen=0; dataIdx=-1;
+  caMem=caBuff; caSize=sizeof(caBuff);
   prgId=grPrgId=source=transponder=-1;
   ecm_table=0x80; emmCaId=0;
   rewriter=0; rewriterId=0;
   dvbAdapter=dvbFrontend=-1;
+  deadline=0;
 }
 
 bool cEcmInfo::Compare(const cEcmInfo *e)
@@ -640,7 +858,9 @@ void cEcmInfo::SetSource(int GrPrgId, int Source, int Transponder)
 
 void cEcmInfo::ClearCaDescr(void)
 {
-  free(caDescr); caDescr=0; caDescrLen=0;
+  if(caMem!=caBuff) free(caMem);
+  caMem=caBuff; caSize=sizeof(caBuff);
+  caDescr=0; caDescrLen=0;
 }
 
 bool cEcmInfo::AddCaDescr(const cEcmInfo *e)
@@ -669,14 +889,18 @@ bool cEcmInfo::AddCaDescr(const unsigned char *descr, int len)
 {
   bool res=false;
   if(descr && (!caDescr || caDescrLen!=len || memcmp(caDescr,descr,len)!=0)) {
-    unsigned char *mem=MALLOC(unsigned char,len);
-    if(mem) {
+    if(len>caSize) {
+      unsigned char *mem=MALLOC(unsigned char,len);
+      if(!mem) {
+        PRINTF(L_GEN_ERROR,"malloc failed in cEcmInfo::AddCaDescr()");
+        return false;
+        }
       ClearCaDescr();
-      memcpy(mem,descr,len);
-      caDescr=mem; caDescrLen=len;
-      res=true;
+      caMem=mem; caSize=len;
       }
-    else PRINTF(L_GEN_ERROR,"malloc failed in cEcmInfo::AddCaDescr()");
+    memmove(caMem,descr,len);
+    caDescr=caMem; caDescrLen=len;
+    res=true;
     }
   return res;
 }
@@ -699,8 +923,10 @@ const unsigned char *cEcmInfo::Data(void) const
 
 void cEcmInfo::SetName(const char *Name)
 {
-  free(name);
-  name=strdup(Name);
+  if(Name==name) return;
+  if(name!=nameBuff) free(name);
+  if(Name && strlen(Name)<sizeof(nameBuff)) name=strcpy(nameBuff,Name);
+  else name=Name ? strdup(Name) : 0;
 }
 
 // -- cPlainKey ----------------------------------------------------------------
@@ -708,6 +934,7 @@ void cEcmInfo::SetName(const char *Name)
 cPlainKey::cPlainKey(bool CanSupersede)
 {
   super=CanSupersede;
+  hashNext=0;
 }
 
 bool cPlainKey::Set(int Type, int Id, int Keynr, void *Key, int Keylen)
@@ -884,7 +1111,14 @@ cPlainKeyType *cPlainKeys::first=0;
 
 cPlainKeys::cPlainKeys(void)
 :cStructList<cPlainKey>("keys",KEY_FILE,SL_READWRITE|SL_MISSINGOK|SL_WATCH|SL_VERBOSE)
-{}
+{
+  hash=0; hashSize=hashCount=0;
+}
+
+cPlainKeys::~cPlainKeys()
+{
+  free(hash);
+}
 
 void cPlainKeys::Register(cPlainKeyType *pkt, bool Super)
 {
@@ -910,13 +1144,115 @@ cPlainKey *cPlainKeys::FindKey(int Type, int Id, int Keynr, int Size, cPlainKey
 cPlainKey *cPlainKeys::FindKeyNoTrig(int Type, int Id, int Keynr, int Size, cPlainKey *key)
 {
   ListLock(false);
-  for(key=key?Next(key):First(); key; key=Next(key))
-    if(key->type==Type && key->id==Id && key->keynr==Keynr && (Size<0 || key->Size()==Size))
-      break;
+  if(hash) {
+    for(key=key?key->hashNext:*Bucket(Type,Id,Keynr); key; key=key->hashNext)
+      if(key->type==Type && key->id==Id && key->keynr==Keynr && (Size<0 || key->Size()==Size) && key->Valid())
+        break;
+    }
+  else {
+    for(key=key?Next(key):First(); key; key=Next(key))
+      if(key->type==Type && key->id==Id && key->keynr==Keynr && (Size<0 || key->Size()==Size))
+        break;
+    }
   ListUnlock();
   return key;
 }
 
+// The key index hashes on (type,id,keynr). Each bucket chain holds the valid
+// keys in the same order as the key list, so walking a chain with the 'key'
+// continuation argument returns the same keys as walking the list did.
+// A key taken out of a chain keeps its hashNext, so a loop which deletes the
+// key it just found can continue from it.
+
+cPlainKey **cPlainKeys::Bucket(int Type, int Id, int Keynr) const
+{
+  unsigned int h=((unsigned int)Type<<24) ^ ((unsigned int)Keynr<<16) ^ (unsigned int)Id;
+  h*=2654435761U;
+  return &hash[(h>>8)&(hashSize-1)];
+}
+
+void cPlainKeys::Reindex(void)
+{
+  int size=64;
+  while(size<Count()) size<<=1;
+  if(size!=hashSize || !hash) {
+    free(hash);
+    hash=MALLOC(cPlainKey *,size);
+    hashSize=hash ? size:0;
+    if(!hash) {
+      PRINTF(L_GEN_ERROR,"no memory for key index");
+      return;
+      }
+    }
+  memset(hash,0,sizeof(cPlainKey *)*hashSize);
+  cPlainKey **tails=MALLOC(cPlainKey *,hashSize);
+  if(!tails) {
+    PRINTF(L_GEN_ERROR,"no memory for key index");
+    free(hash); hash=0; hashSize=0;
+    return;
+    }
+  memset(tails,0,sizeof(cPlainKey *)*hashSize);
+  hashCount=0;
+  for(cPlainKey *k=First(); k; k=Next(k)) {
+    cPlainKey **b=Bucket(k->type,k->id,k->keynr);
+    k->hashNext=0;
+    if(tails[b-hash]) tails[b-hash]->hashNext=k; else *b=k;
+    tails[b-hash]=k;
+    hashCount++;
+    }
+  free(tails);
+  PRINTF(L_CORE_KEYS,"key index rebuilt (%d keys, %d buckets)",hashCount,hashSize);
+}
+
+#define SAMEKEY(a,b) ((a)->type==(b)->type && (a)->id==(b)->id && (a)->keynr==(b)->keynr)
+
+void cPlainKeys::HashAdd(cPlainKey *k, cPlainKey *ref)
+{
+  if(!hash || hashCount>=hashSize*2) { Reindex(); return; }
+  cPlainKey **b=Bucket(k->type,k->id,k->keynr), **p=b;
+  // AddItem() put the key right before ref, which is a key of the same kind,
+  // or right behind it, if ref was superseded and is already unindexed
+  bool found=false;
+  if(ref && ref->Deleted() && cStructLoader::Next(ref)==k) {
+    cPlainKey *n=ref->hashNext;
+    while(n && n->Deleted()) n=n->hashNext;
+    while(*p && *p!=n) p=&(*p)->hashNext;
+    found=(*p==n);
+    }
+  else if(ref && cStructLoader::Next(k)==ref) {
+    while(*p && *p!=ref) p=&(*p)->hashNext;
+    found=(*p!=0);
+    }
+  if(!found) {
+    // otherwise it went in at the list head, behind the special items. Find
+    // the last key of the same kind before it, if any.
+    cPlainKey *prev=0;
+    for(cPlainKey *n=First(); n && n!=k; n=Next(n))
+      if(SAMEKEY(n,k)) prev=n;
+    p=b;
+    if(prev) {
+      while(*p && *p!=prev) p=&(*p)->hashNext;
+      if(*p) p=&(*p)->hashNext;
+      }
+    else
+      while(*p && !SAMEKEY(*p,k)) p=&(*p)->hashNext;
+    }
+  k->hashNext=*p; *p=k;
+  hashCount++;
+}
+
+void cPlainKeys::HashDel(cPlainKey *k)
+{
+  if(!hash) return;
+  for(cPlainKey **p=Bucket(k->type,k->id,k->keynr); *p; p=&(*p)->hashNext)
+    if(*p==k) { *p=k->hashNext; hashCount--; break; }
+}
+
+void cPlainKeys::ItemAdded(cStructItem *it, cStructItem *ref)
+{
+  HashAdd((cPlainKey *)it,(cPlainKey *)ref);
+}
+
 cPlainKey *cPlainKeys::NewFromType(int type)
 {
   cPlainKeyType *pkt;
@@ -941,6 +1277,8 @@ bool cPlainKeys::AddNewKey(cPlainKey *nk, const char *reason)
     if(!k->CmpExtId(nk)) continue;
     if(nk->CanSupersede()) {
       PRINTF(L_GEN_INFO,"supersedes key: %s",*k->ToString(true));
+      // a Reindex() between unindexing and deleting would index it again
+      ListLock(true); HashDel(k); k->Delete(); ListUnlock();
       DelItem(k,ScSetup.SuperKeys==0);
       }
     if(!ref) ref=k;
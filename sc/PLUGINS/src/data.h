@@ -24,6 +24,7 @@
 #include <ffdecsawrapper/tools.h>
 
 #include "misc.h"
+#include "filter.h"
 
 class cStructLoaders;
 class cLoaders;
@@ -71,9 +72,13 @@ extern cFileMaps filemaps;
 //--------------------------------------------------------------
 
 class cStructItem : public cSimpleItem {
+friend class cStructLoader;
 private:
   char *comment;
   bool deleted, special;
+  int loadMark;
+  uint64_t lineHash;
+  char *line;
 protected:
   void SetSpecial(void) { special=true; }
 public:
@@ -126,6 +131,7 @@ protected:
   void OpenFailed(void);
   bool CheckDoSave(void);
   time_t MTime(bool log);
+  int IndexItems(struct LineIndex *&index, bool build);
   //
   virtual cStructItem *ParseLine(char *line)=0;
   void Modified(bool mod=true) { if(mod) SL_SETFLAG(SL_MODIFIED); else SL_CLRFLAG(SL_MODIFIED); }
@@ -134,6 +140,8 @@ protected:
   void ListUnlock(void) { lock.Unlock(); }
   virtual void PreLoad(void) {}
   virtual void PostLoad(void) {}
+  virtual void Reindex(void) {} // called with write lock after list was rebuilt
+  virtual void ItemAdded(cStructItem *it, cStructItem *ref) {} // called with write lock from AddItem()
 public:
   cStructLoader(const char *Type, const char *Filename, int Flags);
   virtual ~cStructLoader();
@@ -203,9 +211,11 @@ public:
 class cPid : public cSimpleItem {
 public:
   int pid, sct, mask;
+  cSectFilter sf;
   cPidFilter *filter;
   //
   cPid(int Pid, int Section, int Mask);
+  cPid(int Pid, const cSectFilter &Filter);
   };
 
 // ----------------------------------------------------------------
@@ -213,6 +223,7 @@ public:
 class cPids : public cSimpleList<cPid> {
 public:
   void AddPid(int Pid, int Section, int Mask);
+  void AddPid(int Pid, const cSectFilter &Filter);
   bool HasPid(int Pid, int Section, int Mask);
   };
 
@@ -220,9 +231,15 @@ public:
 
 #define SIDGRP_SHIFT 100000 // for group in split ECM handling
 
+#define ECMINFO_NAME    16
+#define ECMINFO_CADESCR 64
+
 class cEcmInfo : public cStructItem {
 private:
   bool cached, failed;
+  char nameBuff[ECMINFO_NAME];
+  unsigned char caBuff[ECMINFO_CADESCR], *caMem;
+  int caSize;
   //
   void Setup(void);
 protected:
@@ -238,11 +255,14 @@ public:
   cRewriter *rewriter;
   int rewriterId;
   int dvbAdapter, dvbFrontend;
+  uint64_t deadline; // time (cTimeMs::Now) the current CW is needed, 0=unknown
   //
   cEcmInfo(void);
   cEcmInfo(const cEcmInfo *e);
   cEcmInfo(const char *Name, int Pid, int CaId, int ProvId);
   ~cEcmInfo();
+  static void *operator new(size_t size);
+  static void operator delete(void *p, size_t size);
   virtual cString ToString(bool hide=false) { return ""; }
   bool Compare(const cEcmInfo *e);
   void SetDvb(int DvbAdapter, int DvbFrontend);
@@ -269,6 +289,7 @@ friend class cPlainKeys;
 friend class cMutableKey;
 private:
   bool super;
+  cPlainKey *hashNext;
 protected:
   void SetSupersede(bool val) { super=val; }
   bool CanSupersede(void) const { return super; }
@@ -349,16 +370,24 @@ private:
   static cPlainKeyType *first;
   cTimeMs trigger, last;
   cLastKey lastkey;
+  cPlainKey **hash;
+  int hashSize, hashCount;
   //
   static void Register(cPlainKeyType *pkt, bool Super);
   cPlainKey *NewFromType(int type);
   bool AddNewKey(cPlainKey *nk, const char *reason);
   void ExternalUpdate(void);
+  cPlainKey **Bucket(int Type, int Id, int Keynr) const;
+  void HashAdd(cPlainKey *k, cPlainKey *ref);
+  void HashDel(cPlainKey *k);
 protected:
   virtual void Action(void);
   virtual void PostLoad(void);
+  virtual void Reindex(void);
+  virtual void ItemAdded(cStructItem *it, cStructItem *ref);
 public:
   cPlainKeys(void);
+  virtual ~cPlainKeys();
   virtual cPlainKey *ParseLine(char *line);
   cPlainKey *FindKey(int Type, int Id, int Keynr, int Size, cPlainKey *key=0);
   cPlainKey *FindKeyNoTrig(int Type, int Id, int Keynr, int Size, cPlainKey *key=0);
@@ -22,7 +22,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include <linux/dvb/dmx.h>
@@ -30,17 +32,184 @@
 #include <ffdecsawrapper/device.h>
 #include <ffdecsawrapper/tools.h>
 
+#include <libsi/util.h>
+
 #include "filter.h"
 #include "misc.h"
 #include "log-core.h"
 
+#define TS_BUFFSIZE     (TS_SIZE*1024)
+#define MAX_SECT_QUEUE  32
+
+// -- cSectFilter --------------------------------------------------------------
+
+cSectFilter::cSectFilter(int Section, int Mask)
+{
+  memset(filter,0,sizeof(filter));
+  memset(mask,0,sizeof(mask));
+  memset(mode,0,sizeof(mode));
+  filter[0]=Section; mask[0]=Mask;
+}
+
+void cSectFilter::Set(int Offset, const unsigned char *Data, int Len, int Mask)
+{
+  for(int i=0; i<Len; i++) {
+    int n=Offset+i;
+    if(n>=3) n-=2;
+    else if(n>0) continue; // length field can't be filtered
+    if(n>=SECT_FILTER_SIZE) break;
+    filter[n]=Data[i]; mask[n]=Mask;
+    }
+}
+
+int cSectFilter::Depth(void) const
+{
+  int d=SECT_FILTER_SIZE;
+  while(d>0 && !mask[d-1]) d--;
+  return d;
+}
+
+bool cSectFilter::Matches(const unsigned char *data, int len) const
+{
+  bool neg=false, neq=false;
+  for(int i=0; i<SECT_FILTER_SIZE; i++) {
+    if(!mask[i]) continue;
+    int n=i ? i+2 : 0;
+    if(n>=len) return false;
+    int x=(data[n]^filter[i]);
+    if(x&mask[i]&~mode[i]) return false;
+    if(mask[i]&mode[i]) {
+      neg=true;
+      if(x&mask[i]&mode[i]) neq=true;
+      }
+    }
+  return !neg || neq;
+}
+
+bool cSectFilter::Covers(const cSectFilter &f) const
+{
+  // true if every section matching f is matched by this filter too
+  for(int i=0; i<SECT_FILTER_SIZE; i++) {
+    if(mode[i] || f.mode[i]) return *this==f;
+    if((mask[i]&f.mask[i])!=mask[i] || ((filter[i]^f.filter[i])&mask[i])) return false;
+    }
+  return true;
+}
+
+bool cSectFilter::operator==(const cSectFilter &f) const
+{
+  for(int i=0; i<SECT_FILTER_SIZE; i++)
+    if(mask[i]!=f.mask[i] || mode[i]!=f.mode[i] || ((filter[i]^f.filter[i])&mask[i])) return false;
+  return true;
+}
+
+// -- cSectAssembler -----------------------------------------------------------
+
+cSectAssembler::cSectAssembler(void)
+{
+  Reset(-1,cSectFilter());
+}
+
+void cSectAssembler::Reset(int Pid, const cSectFilter &Filter)
+{
+  pid=Pid; sf=Filter;
+  restLen=sectLen=outLen=outPos=0; lastCc=-1; active=false;
+  crcErrs=ccErrs=0;
+}
+
+void cSectAssembler::Put(const unsigned char *data, int len)
+{
+  outLen=outPos=0;
+  if(restLen>0) {
+    int n=min(TS_SIZE-restLen,len);
+    memcpy(&rest[restLen],data,n); restLen+=n;
+    data+=n; len-=n;
+    if(restLen<TS_SIZE) return;
+    Packet(rest);
+    restLen=0;
+    }
+  while(len>=TS_SIZE) {
+    if(data[0]!=0x47) { data++; len--; continue; } // resync
+    Packet(data);
+    data+=TS_SIZE; len-=TS_SIZE;
+    }
+  while(len>0 && data[0]!=0x47) { data++; len--; }
+  if(len>0) { memcpy(rest,data,len); restLen=len; }
+}
+
+void cSectAssembler::Packet(const unsigned char *p)
+{
+  if(p[1]&0x80) { active=false; sectLen=0; return; } // transport error
+  if((((p[1]&0x1F)<<8)|p[2])!=pid) return;
+  int afc=(p[3]>>4)&3, cc=p[3]&0x0F;
+  if(!(afc&1)) return;
+  if(lastCc>=0) {
+    if(cc==lastCc) return; // duplicate packet
+    if(cc!=((lastCc+1)&0x0F)) { ccErrs++; active=false; sectLen=0; }
+    }
+  lastCc=cc;
+  int off=4;
+  if(afc&2) off+=1+p[4];
+  if(off>=TS_SIZE) return;
+  const unsigned char *d=&p[off];
+  int n=TS_SIZE-off;
+  if(p[1]&0x40) {
+    int ptr=d[0];
+    d++; n--;
+    if(ptr>n) { active=false; sectLen=0; return; }
+    if(active) Append(d,ptr);
+    sectLen=0; active=true;
+    d+=ptr; n-=ptr;
+    }
+  if(active) Append(d,n);
+}
+
+void cSectAssembler::Append(const unsigned char *data, int len)
+{
+  if(sectLen+len>(int)sizeof(sect)) { active=false; sectLen=0; return; }
+  memcpy(&sect[sectLen],data,len); sectLen+=len;
+  int p=0;
+  while(sectLen-p>=3) {
+    int l=SCT_LEN(&sect[p]);
+    if(sect[p]==0xFF || l>MAX_SECT_SIZE) { // stuffing or garbage, wait for next PUSI
+      active=false; p=sectLen;
+      break;
+      }
+    if(sectLen-p<l) break;
+    Emit(&sect[p],l);
+    p+=l;
+    }
+  if(p>0) {
+    sectLen-=p;
+    memmove(sect,&sect[p],sectLen);
+    }
+}
+
+void cSectAssembler::Emit(const unsigned char *data, int len)
+{
+  if(!sf.Matches(data,len)) return;
+  if((data[1]&0x80) && !SI::CRC32::isValid((const char *)data,len)) { crcErrs++; return; }
+  if(outLen+len>(int)sizeof(out)) return;
+  memcpy(&out[outLen],data,len); outLen+=len;
+}
+
+unsigned char *cSectAssembler::Get(int &len)
+{
+  if(outPos>=outLen) return 0;
+  unsigned char *p=&out[outPos];
+  len=SCT_LEN(p); outPos+=len;
+  return p;
+}
+
 // -- cPidFilter ------------------------------------------------------------------
 
 cPidFilter::cPidFilter(const char *Id, int Num, cDevice *Device, unsigned int IdleTime)
 {
-  device=Device;
-  idleTime=IdleTime;
+  device=Device; owner=0;
+  idleTime=IdleTime; lastTime=cTimeMs::Now(); timerDue=wakeAt=0; timerIdx=-1;
   id=0; fd=-1; forceRun=false; userData=0;
+  tsAsm=0; tsMode=false; buffSize=0;
+  shared=0; shareNext=0;
   id=bprintf("%s/%d",Id,Num);
   PRINTF(L_CORE_ACTION,"new filter '%s' (%d ms)",id,idleTime);
 }
@@ -49,6 +218,8 @@ cPidFilter::~cPidFilter()
 {
   cMutexLock lock(this);
   Stop();
+  ClearQueue();
+  delete tsAsm;
   PRINTF(L_CORE_ACTION,"filter '%s' removed",id);
   free(id);
 }
@@ -56,23 +227,38 @@ cPidFilter::~cPidFilter()
 void cPidFilter::Flush(void)
 {
   cMutexLock lock(this);
-  if(fd>=0) {
+  ClearQueue();
+  if(fd>=0 && !shared) {
     unsigned char buff[MAX_SECT_SIZE];
     while(read(fd,buff,sizeof(buff))>0);
     }
 }
 
 void cPidFilter::Start(int Pid, int Section, int Mask)
+{
+  Start(Pid,cSectFilter(Section,Mask));
+}
+
+void cPidFilter::Start(int Pid, const cSectFilter &Filter)
 {
   cMutexLock lock(this);
   Stop();
-  fd=device->OpenFilter(Pid,Section,Mask);
+  sf=Filter;
+  if(tsAsm) {
+    fd=device->OpenTsFilter(Pid,max(buffSize,TS_BUFFSIZE));
+    tsMode=fd>=0;
+    if(tsMode) tsAsm->Reset(Pid,sf);
+    else PRINTF(L_CORE_ACTION,"filter '%s': TS mode failed, using section filter",id);
+    }
+  if(!tsMode) fd=filterBroker.Subscribe(this,device,Pid,sf);
+  else if(fd>=0 && owner) owner->Watch(this,true);
   if(fd>=0) {
     pid=Pid;
 
     LBSTART(L_CORE_ACTION);
+    int Section=sf.filter[0], Mask=sf.mask[0];
     LBPUT("filter '%s' -> pid=0x%04x sct=0x%02x/0x%02x matching",id,Pid,Section,Mask);
-    int Mode=0;
+    int Mode=sf.mode[0];
     int mam =Mask &  (~Mode);
     int manm=Mask & ~(~Mode);
     for(int i=0; i<256; i++) {
@@ -81,6 +267,11 @@ void cPidFilter::Start(int Pid, int Section, int Mask)
       else
         LBPUT(" 0x%02x",i);
       }
+    int depth=sf.Depth();
+    if(depth>1) {
+      LBPUT(" data");
+      for(int i=1; i<depth; i++) LBPUT(" %02x/%02x",sf.filter[i],sf.mask[i]);
+      }
     LBEND();
     }
 }
@@ -88,12 +279,24 @@ void cPidFilter::Start(int Pid, int Section, int Mask)
 void cPidFilter::Stop(void)
 {
   cMutexLock lock(this);
-  if(fd>=0) { device->CloseFilter(fd); fd=-1; }
+  if(fd>=0) {
+    if(shared) filterBroker.Unsubscribe(this);
+    else {
+      if(owner) owner->Watch(this,false);
+      device->CloseFilter(fd);
+      }
+    fd=-1;
+    ClearQueue();
+    if(tsMode && (tsAsm->CrcErrors() || tsAsm->CcErrors()))
+      PRINTF(L_CORE_ACTION,"filter '%s': %d CRC errors, %d continuity errors",id,tsAsm->CrcErrors(),tsAsm->CcErrors());
+    tsMode=false;
+    }
 }
 
 void cPidFilter::SetBuffSize(int BuffSize)
 {
   cMutexLock lock(this);
+  buffSize=BuffSize;
   if(fd>=0) {
     Stop();
     int s=max(BuffSize,8192);
@@ -101,17 +304,44 @@ void cPidFilter::SetBuffSize(int BuffSize)
     }
 }
 
+void cPidFilter::SetTsMode(bool On)
+{
+  // takes effect on the next Start()
+  cMutexLock lock(this);
+  if(On && !tsAsm) tsAsm=new cSectAssembler;
+  else if(!On && tsAsm && !tsMode) { delete tsAsm; tsAsm=0; }
+}
+
 int cPidFilter::SetIdleTime(unsigned int IdleTime)
 {
   int i=idleTime;
-  idleTime=IdleTime;
+  if(owner) {
+    owner->Lock();
+    idleTime=IdleTime;
+    owner->TimerSet(this);
+    owner->Unlock();
+    }
+  else idleTime=IdleTime;
   return i;
 }
 
+void cPidFilter::SetTimer(int Ms)
+{
+  // one-shot run of Process() in Ms milliseconds, independent of data
+  // arrival. Ms<=0 cancels the timer.
+  if(owner) {
+    owner->Lock();
+    wakeAt=Ms>0 ? cTimeMs::Now()+Ms : 0;
+    owner->TimerSet(this);
+    owner->Unlock();
+    }
+}
+
 void cPidFilter::Wakeup(void)
 {
   cMutexLock lock(this);
   forceRun=true;
+  if(owner) owner->Kick();
   PRINTF(L_CORE_ACTION,"filter '%s': wakeup",id);
 }
 
@@ -120,6 +350,302 @@ int cPidFilter::Pid(void)
   return Active() ? pid : -1;
 }
 
+void cPidFilter::Queue(const unsigned char *data, int len)
+{
+  cMutexLock lock(&queueMutex);
+  if(queue.Count()>=MAX_SECT_QUEUE) {
+    queue.Del(queue.First());
+    PRINTF(L_CORE_ACTION,"filter '%s': section queue overflow",id);
+    }
+  queue.Add(new cSectData(data,len));
+}
+
+cSectData *cPidFilter::Dequeue(void)
+{
+  cMutexLock lock(&queueMutex);
+  cSectData *sd=queue.First();
+  if(sd) queue.Del(sd,false);
+  return sd;
+}
+
+void cPidFilter::ClearQueue(void)
+{
+  cMutexLock lock(&queueMutex);
+  queue.Clear();
+}
+
+// -- cSectData ----------------------------------------------------------------
+
+cSectData::cSectData(const unsigned char *Data, int Len)
+{
+  len=Len; stamp=cTimeMs::Now();
+  data=MALLOC(unsigned char,len);
+  if(data) memcpy(data,Data,len); else len=0;
+}
+
+cSectData::~cSectData()
+{
+  free(data);
+}
+
+// -- cFilterBroker ------------------------------------------------------------
+
+class cSharedFilter : public cSimpleItem {
+public:
+  cDevice *device;
+  int pid, fd;
+  cSectFilter sf;
+  cPidFilter *subs;
+  };
+
+cFilterBroker filterBroker;
+
+int cFilterBroker::Subscribe(cPidFilter *filter, cDevice *device, int pid, const cSectFilter &sf)
+{
+  cMutexLock lock(&mutex);
+  cSharedFilter *sh;
+  for(sh=shared.First(); sh; sh=shared.Next(sh))
+    if(sh->device==device && sh->pid==pid && sh->sf==sf) break;
+  if(sh) {
+    cPidFilter *last=sh->subs;
+    while(last->shareNext) last=last->shareNext;
+    last->shareNext=filter;
+    PRINTF(L_CORE_ACTION,"filter '%s': sharing pid 0x%04x with '%s'",filter->id,pid,sh->subs->id);
+    }
+  else {
+    int fd=device->OpenFilter(pid,sf.filter,sf.mask,sf.mode);
+    if(fd<0) return -1;
+    sh=new cSharedFilter;
+    sh->device=device; sh->pid=pid; sh->fd=fd; sh->sf=sf;
+    sh->subs=filter;
+    shared.Add(sh);
+    }
+  filter->shared=sh; filter->shareNext=0;
+  filter->fd=sh->fd;
+  if(sh->subs==filter && filter->owner) filter->owner->Watch(filter,true);
+  return sh->fd;
+}
+
+void cFilterBroker::Unsubscribe(cPidFilter *filter)
+{
+  cMutexLock lock(&mutex);
+  cSharedFilter *sh=filter->shared;
+  if(sh->subs==filter) {
+    if(filter->owner) filter->owner->Watch(filter,false);
+    sh->subs=filter->shareNext;
+    // hand the demux handle over to the next subscriber
+    if(sh->subs && sh->subs->owner) sh->subs->owner->Watch(sh->subs,true);
+    }
+  else {
+    cPidFilter *f=sh->subs;
+    while(f->shareNext!=filter) f=f->shareNext;
+    f->shareNext=filter->shareNext;
+    }
+  filter->shared=0; filter->shareNext=0;
+  if(!sh->subs) {
+    sh->device->CloseFilter(sh->fd);
+    shared.Del(sh);
+    }
+}
+
+void cFilterBroker::Distribute(cPidFilter *filter, const unsigned char *data, int len)
+{
+  cMutexLock lock(&mutex);
+  cSharedFilter *sh=filter->shared;
+  if(sh && sh->subs==filter)
+    for(cPidFilter *f=filter->shareNext; f; f=f->shareNext) {
+      f->Queue(data,len);
+      if(f->owner) f->owner->Kick();
+      }
+}
+
+// -- cReactor -----------------------------------------------------------------
+
+#define MAX_EVENTS 16
+#define MAX_WAIT   500 // ms
+
+class cReactor : public cThread {
+private:
+  cMutex mutex;
+  cCondVar idle;
+  int epfd, pri;
+  tThreadId tid;
+  cAction **actions, *current;
+  int numActions, maxActions;
+  //
+  bool Has(cAction *action);
+protected:
+  virtual void Action(void);
+public:
+  cReactor(int Num, int Pri);
+  virtual ~cReactor();
+  void Add(cAction *action);
+  void Remove(cAction *action);
+  void Stop(void) { Cancel(3); }
+  int Count(void) const { return numActions; }
+  };
+
+cReactor::cReactor(int Num, int Pri)
+{
+  pri=Pri; tid=0;
+  actions=0; current=0; numActions=maxActions=0;
+  epfd=epoll_create(MAX_EVENTS);
+  if(epfd<0) PRINTF(L_GEN_ERROR,"reactor %d: epoll setup: %s",Num,strerror(errno));
+  SetDescription("reactor %d",Num);
+  Start();
+}
+
+cReactor::~cReactor()
+{
+  Cancel(3);
+  if(epfd>=0) close(epfd);
+  free(actions);
+}
+
+bool cReactor::Has(cAction *action)
+{
+  for(int i=0; i<numActions; i++)
+    if(actions[i]==action) return true;
+  return false;
+}
+
+void cReactor::Add(cAction *action)
+{
+  cMutexLock lock(&mutex);
+  if(numActions>=maxActions) {
+    int n=maxActions ? maxActions*2 : 8;
+    cAction **a=(cAction **)realloc(actions,n*sizeof(cAction *));
+    if(!a) {
+      PRINTF(L_GEN_ERROR,"reactor: actions: out of memory");
+      return;
+      }
+    actions=a; maxActions=n;
+    }
+  actions[numActions++]=action;
+  struct epoll_event ev;
+  memset(&ev,0,sizeof(ev));
+  ev.events=EPOLLIN; ev.data.ptr=action;
+  if(epfd<0 || epoll_ctl(epfd,EPOLL_CTL_ADD,action->epfd,&ev)<0)
+    PRINTF(L_GEN_ERROR,"reactor: epoll_ctl: %s",strerror(errno));
+}
+
+void cReactor::Remove(cAction *action)
+{
+  // after return the action is never polled again. If called from the
+  // action's own Process(), the rest of that Poll() still runs.
+  cMutexLock lock(&mutex);
+  for(int i=0; i<numActions; i++)
+    if(actions[i]==action) {
+      actions[i]=actions[--numActions];
+      if(epfd>=0) epoll_ctl(epfd,EPOLL_CTL_DEL,action->epfd,0);
+      break;
+      }
+  if(tid==cThread::ThreadId()) return;
+  while(current==action) idle.Wait(mutex);
+}
+
+void cReactor::Action(void)
+{
+  tid=cThread::ThreadId();
+  if(pri>0) SetPriority(pri);
+  if(epfd<0) return;
+  struct epoll_event ev[MAX_EVENTS];
+  while(Running()) {
+    int r=epoll_wait(epfd,ev,MAX_EVENTS,MAX_WAIT);
+    if(r<0 && errno!=EINTR) {
+      PRINTF(L_GEN_ERROR,"reactor epoll: %s",strerror(errno));
+      break;
+      }
+    for(int i=0; i<r; i++) {
+      cAction *action=(cAction *)ev[i].data.ptr;
+      mutex.Lock();
+      // action may have been removed since epoll_wait()
+      if(!Has(action)) { mutex.Unlock(); continue; }
+      current=action;
+      mutex.Unlock();
+      action->Poll();
+      mutex.Lock();
+      current=0;
+      idle.Broadcast();
+      mutex.Unlock();
+      }
+    }
+}
+
+// -- cReactors ----------------------------------------------------------------
+
+cReactors reactors;
+
+cReactors::cReactors(void)
+{
+  memset(reactors,0,sizeof(reactors));
+  busy=0; down=stopped=false;
+}
+
+cReactor *cReactors::Attach(cAction *action, int pri, int dev)
+{
+  cMutexLock lock(&mutex);
+  if(down) return 0;
+  cReactor *r=0;
+  if(pri>0) {
+    int i=MAX_REACTORS+(dev>=0 ? dev%MAX_BG_REACTORS : 0);
+    if(!reactors[i]) reactors[i]=new cReactor(i,pri);
+    r=reactors[i];
+    }
+  else {
+    int i, n=-1;
+    for(i=0; i<MAX_REACTORS && reactors[i]; i++)
+      if(n<0 || reactors[i]->Count()<reactors[n]->Count()) n=i;
+    if(n<0 || (reactors[n]->Count()>0 && i<MAX_REACTORS)) {
+      reactors[i]=new cReactor(i,0);
+      n=i;
+      }
+    r=reactors[n];
+    }
+  r->Add(action);
+  return r;
+}
+
+void cReactors::Detach(cAction *action, cReactor *r)
+{
+  // Remove() may wait for a running Process(), which in turn may attach
+  // other actions, so it's called without holding the mutex.
+  mutex.Lock();
+  busy++;
+  mutex.Unlock();
+  r->Remove(action);
+  cMutexLock lock(&mutex);
+  busy--;
+  Reap();
+}
+
+void cReactors::Reap(void)
+{
+  if(!stopped || busy) return;
+  for(int i=0; i<MAX_REACTORS+MAX_BG_REACTORS; i++)
+    if(reactors[i] && !reactors[i]->Count()) {
+      delete reactors[i];
+      reactors[i]=0;
+      }
+}
+
+void cReactors::Shutdown(void)
+{
+  // actions may outlive the reactors (devices are deleted after the plugin
+  // is stopped). A reactor which still has actions is stopped here and
+  // deleted when the last of them detaches.
+  cReactor *r[MAX_REACTORS+MAX_BG_REACTORS];
+  mutex.Lock();
+  down=true;
+  memcpy(r,reactors,sizeof(r));
+  mutex.Unlock();
+  for(int i=0; i<MAX_REACTORS+MAX_BG_REACTORS; i++)
+    if(r[i]) r[i]->Stop();
+  cMutexLock lock(&mutex);
+  stopped=true;
+  Reap();
+}
+
 // -- cAction ------------------------------------------------------------------
 
 cAction::cAction(const char *Id, cDevice *Device, const char *DevId)
@@ -127,17 +653,147 @@ cAction::cAction(const char *Id, cDevice *Device, const char *DevId)
   device=Device; devId=DevId;
   id=bprintf("%s %s",Id,DevId);
   unique=0; pri=-1;
-  SetDescription("%s filter",id);
+  reactor=0; armed=0;
+  timers=0; numTimers=maxTimers=0;
+  epfd=epoll_create(MAX_EVENTS);
+  wakefd=eventfd(0,EFD_NONBLOCK);
+  timerfd=timerfd_create(CLOCK_REALTIME,TFD_NONBLOCK); // same clock as cTimeMs
+  if(epfd<0 || wakefd<0 || timerfd<0)
+    PRINTF(L_GEN_ERROR,"action %s: epoll setup: %s",id,strerror(errno));
+  else {
+    struct epoll_event ev;
+    memset(&ev,0,sizeof(ev));
+    ev.events=EPOLLIN; ev.data.ptr=0;
+    CHECK(epoll_ctl(epfd,EPOLL_CTL_ADD,wakefd,&ev));
+    ev.data.ptr=&timerfd;
+    CHECK(epoll_ctl(epfd,EPOLL_CTL_ADD,timerfd,&ev));
+    }
 }
 
 cAction::~cAction()
 {
-  Cancel(2);
+  Detach();
   DelAllFilter();
+  dead.Clear();
+  if(epfd>=0) close(epfd);
+  if(wakefd>=0) close(wakefd);
+  if(timerfd>=0) close(timerfd);
+  free(timers);
   PRINTF(L_CORE_ACTION,"%s: stopped",id);
   free(id);
 }
 
+void cAction::Watch(cPidFilter *filter, bool on)
+{
+  if(epfd>=0) {
+    struct epoll_event ev;
+    memset(&ev,0,sizeof(ev));
+    ev.events=EPOLLIN; ev.data.ptr=filter;
+    if(epoll_ctl(epfd,on ? EPOLL_CTL_ADD:EPOLL_CTL_DEL,filter->fd,&ev)<0)
+      PRINTF(L_GEN_ERROR,"action %s: epoll_ctl: %s",id,strerror(errno));
+    }
+}
+
+void cAction::Kick(void)
+{
+  if(wakefd>=0) {
+    uint64_t one=1;
+    if(write(wakefd,&one,sizeof(one))<0 && errno!=EAGAIN)
+      PRINTF(L_GEN_ERROR,"action %s: wakeup: %s",id,strerror(errno));
+    }
+}
+
+// The timer queue is a binary min-heap on timerDue, the earlier of the idle
+// timeout and the SetTimer() deadline. Data arrival only bumps lastTime, so
+// timerDue is a lower bound which is re-checked when it expires.
+
+void cAction::TimerUp(int i)
+{
+  cPidFilter *f=timers[i];
+  while(i>0) {
+    int p=(i-1)/2;
+    if(timers[p]->timerDue<=f->timerDue) break;
+    timers[i]=timers[p]; timers[i]->timerIdx=i;
+    i=p;
+    }
+  timers[i]=f; f->timerIdx=i;
+}
+
+void cAction::TimerDown(int i)
+{
+  cPidFilter *f=timers[i];
+  while(1) {
+    int c=2*i+1;
+    if(c>=numTimers) break;
+    if(c+1<numTimers && timers[c+1]->timerDue<timers[c]->timerDue) c++;
+    if(f->timerDue<=timers[c]->timerDue) break;
+    timers[i]=timers[c]; timers[i]->timerIdx=i;
+    i=c;
+    }
+  timers[i]=f; f->timerIdx=i;
+}
+
+uint64_t cAction::TimerDue(cPidFilter *filter)
+{
+  uint64_t due=filter->idleTime ? filter->lastTime+filter->idleTime : 0;
+  if(filter->wakeAt && (!due || filter->wakeAt<due)) due=filter->wakeAt;
+  return due;
+}
+
+void cAction::TimerSet(cPidFilter *filter)
+{
+  uint64_t due=TimerDue(filter);
+  if(!due) { TimerDel(filter); return; }
+  if(filter->timerIdx<0) {
+    if(numTimers>=maxTimers) {
+      int n=maxTimers ? maxTimers*2 : 8;
+      cPidFilter **t=(cPidFilter **)realloc(timers,n*sizeof(cPidFilter *));
+      if(!t) {
+        PRINTF(L_GEN_ERROR,"action %s: timers: out of memory",id);
+        return;
+        }
+      timers=t; maxTimers=n;
+      }
+    filter->timerDue=due;
+    timers[numTimers]=filter;
+    TimerUp(numTimers++);
+    }
+  else {
+    bool up=due<filter->timerDue;
+    filter->timerDue=due;
+    if(up) TimerUp(filter->timerIdx); else TimerDown(filter->timerIdx);
+    }
+  ArmTimer();
+}
+
+void cAction::TimerDel(cPidFilter *filter)
+{
+  int i=filter->timerIdx;
+  if(i<0) return;
+  filter->timerIdx=-1;
+  if(i<--numTimers) {
+    cPidFilter *f=timers[numTimers];
+    timers[i]=f;
+    TimerUp(i);
+    TimerDown(f->timerIdx);
+    }
+  ArmTimer();
+}
+
+void cAction::ArmTimer(void)
+{
+  // the timerfd follows the top of the heap
+  uint64_t due=numTimers>0 ? timers[0]->timerDue : 0;
+  if(due==armed || timerfd<0) return;
+  struct itimerspec its;
+  memset(&its,0,sizeof(its));
+  its.it_value.tv_sec=due/1000;
+  its.it_value.tv_nsec=(due%1000)*1000000;
+  if(timerfd_settime(timerfd,TFD_TIMER_ABSTIME,&its,0)<0)
+    PRINTF(L_GEN_ERROR,"action %s: timerfd: %s",id,strerror(errno));
+  else armed=due;
+}
+
 cPidFilter *cAction::CreateFilter(int Num, int IdleTime)
 {
   return new cPidFilter(id,Num,device,IdleTime);
@@ -148,11 +804,10 @@ cPidFilter *cAction::NewFilter(int IdleTime)
   Lock();
   cPidFilter *filter=CreateFilter(unique++,IdleTime);
   if(filter) {
-    if(!Active()) {
-      Start();
-      PRINTF(L_CORE_ACTION,"%s: started",id);
-      }
+    Start();
+    filter->owner=this;
     filters.Add(filter);
+    TimerSet(filter);
     }
   else
     PRINTF(L_CORE_ACTION,"%s: failed to create filter",id);
@@ -160,6 +815,27 @@ cPidFilter *cAction::NewFilter(int IdleTime)
   return filter;
 }
 
+void cAction::Start(void)
+{
+  // called with Lock()
+  if(!reactor) {
+    __atomic_store_n(&reactor,reactors.Attach(this,pri,device ? device->CardIndex():0),__ATOMIC_RELEASE);
+    PRINTF(L_CORE_ACTION,"%s: started",id);
+    }
+}
+
+void cAction::Wakeup(void)
+{
+  // calls Woken() from the reactor. Lock() is only taken to start the
+  // action, which isn't polled before.
+  if(!__atomic_load_n(&reactor,__ATOMIC_ACQUIRE)) {
+    Lock();
+    Start();
+    Unlock();
+    }
+  Kick();
+}
+
 cPidFilter *cAction::IdleFilter(void)
 {
   Lock();
@@ -170,17 +846,27 @@ cPidFilter *cAction::IdleFilter(void)
   return filter;
 }
 
+void cAction::Remove(cPidFilter *filter)
+{
+  // the action thread may still hold pointers to the filter from the last
+  // epoll_wait(), so it is only deleted at the start of the next loop.
+  TimerDel(filter);
+  filter->Stop();
+  filters.Del(filter,false);
+  dead.Add(filter);
+}
+
 void cAction::DelFilter(cPidFilter *filter)
 {
   Lock();
-  filters.Del(filter);
+  Remove(filter);
   Unlock();
 }
 
 void cAction::DelAllFilter(void)
 {
   Lock();
-  filters.Clear();
+  while(cPidFilter *filter=filters.First()) Remove(filter);
   unique=0;
   Unlock();
 }
@@ -190,83 +876,126 @@ void cAction::Priority(int Pri)
   pri=Pri;
 }
 
-void cAction::Action(void)
+void cAction::Detach(void)
 {
-  if(pri>0) SetPriority(pri);
-  struct pollfd *pfd=0;
-  while(Running()) {
-    if(filters.Count()<=0) {
-      cCondWait::SleepMs(100);
+  // stop calling Process(). Derived classes should call this first in their
+  // destructor, and without holding Lock().
+  if(reactor) {
+    reactors.Detach(this,reactor);
+    reactor=0;
+    }
+}
+
+void cAction::RunPending(void)
+{
+  bool r;
+  do {
+    r=false;
+    for(cPidFilter *filter=filters.First(); filter; filter=filters.Next(filter)) {
+      cSectData *sd=0;
+      if(filter->forceRun || (sd=filter->Dequeue())) {
+        // stamp queued sections with their arrival time
+        filter->lastTime=sd ? sd->stamp : cTimeMs::Now(); filter->forceRun=false;
+        if(sd) Process(filter,sd->data,sd->len);
+        else Process(filter,0,0);
+        delete sd;
+        // don't make any assumption about data-structs here
+        // Process() may have changed them
+        r=true; break;
+        }
       }
-    else {
-      // first build pfd data
+    } while(r);
+}
+
+void cAction::RunTimers(void)
+{
+  uint64_t now=cTimeMs::Now();
+  while(numTimers>0 && timers[0]->timerDue<=now) {
+    cPidFilter *filter=timers[0];
+    uint64_t due=TimerDue(filter);
+    if(!due) { TimerDel(filter); continue; }
+    if(due>now) {
+      filter->timerDue=due;
+      TimerDown(0);
+      continue;
+      }
+    if(filter->wakeAt && filter->wakeAt<=now) filter->wakeAt=0;
+    filter->lastTime=now; filter->forceRun=false;
+    TimerSet(filter);
+    Process(filter,0,0);
+    }
+  // the timerfd was consumed in Poll() and re-keyed entries don't arm it
+  ArmTimer();
+}
+
+void cAction::Poll(void)
+{
+  // called by the reactor when any of our fds is ready
+  Lock();
+  dead.Clear();
+  Unlock();
+  struct epoll_event ev[MAX_EVENTS];
+  int r=epoll_wait(epfd,ev,MAX_EVENTS,0);
+  if(r<0) {
+    if(errno!=EINTR) PRINTF(L_GEN_ERROR,"action %s epoll: %s",id,strerror(errno));
+    return;
+    }
+  bool wake=false;
+  for(int i=0; i<r; i++) {
+    cPidFilter *filter=(cPidFilter *)ev[i].data.ptr;
+    uint64_t cnt;
+    if(!filter) {
+      if(read(wakefd,&cnt,sizeof(cnt))<0 && errno!=EAGAIN)
+        PRINTF(L_GEN_ERROR,"action %s wakeup: %s",id,strerror(errno));
+      wake=true;
+      continue;
+      }
+    if(ev[i].data.ptr==&timerfd) {
       Lock();
-      delete[] pfd; pfd=new struct pollfd[filters.Count()];
-      if(!pfd) {
-        PRINTF(L_GEN_ERROR,"action %s: pollfd: out of memory",id);
-        break;
+      if(read(timerfd,&cnt,sizeof(cnt))<0 && errno!=EAGAIN)
+        PRINTF(L_GEN_ERROR,"action %s timer: %s",id,strerror(errno));
+      armed=0;
+      Unlock();
+      continue;
+      }
+    Lock();
+    // filter may have been stopped or deleted since epoll_wait()
+    if(filter->Active()) {
+      cSectAssembler *ts=filter->tsMode ? filter->tsAsm : 0;
+      unsigned char buff[MAX_SECT_SIZE];
+      int n=ts ? read(filter->fd,ts->buff,sizeof(ts->buff)) : read(filter->fd,buff,sizeof(buff));
+      if(n<0 && errno!=EAGAIN) {
+        // in TS mode the continuity counter catches the lost data
+        if(errno==EOVERFLOW) {
+          if(!ts) filter->Flush();
+          //PRINTF(L_GEN_ERROR,"action %s read: Buffer overflow",filter->id);
+          }
+        else PRINTF(L_GEN_ERROR,"action %s read: %s",filter->id,strerror(errno));
         }
-      int num=0;
-      cPidFilter *filter;
-      for(filter=filters.First(); filter; filter=filters.Next(filter))
-        if(filter->Active()) {
-          memset(&pfd[num],0,sizeof(struct pollfd));
-          pfd[num].fd=filter->fd;
-          pfd[num].events=POLLIN;
-          num++;
+      if(n>0 && ts) {
+        ts->Put(ts->buff,n);
+        unsigned char *data;
+        int len;
+        while(filter->Active() && (data=ts->Get(len))) {
+          filter->lastTime=cTimeMs::Now(); filter->forceRun=false;
+          Process(filter,data,len);
           }
-      Unlock();
-
-      // now poll for data
-      int r=poll(pfd,num,60);
-      if(r<0 && errno!=EINTR) {
-        PRINTF(L_GEN_ERROR,"action %s poll: %s",id,strerror(errno));
-        break;
         }
-      if(r>0) {
-        for(r=0 ; r<num ; r++)
-          if(pfd[r].revents&POLLIN) {
-            Lock();
-            for(filter=filters.First(); filter; filter=filters.Next(filter)) {
-              if(filter->fd==pfd[r].fd) {
-                unsigned char buff[MAX_SECT_SIZE];
-                int n=read(filter->fd,buff,sizeof(buff));
-                if(n<0 && errno!=EAGAIN) {
-                  if(errno==EOVERFLOW) {
-                    filter->Flush();
-                    //PRINTF(L_GEN_ERROR,"action %s read: Buffer overflow",filter->id);
-                    }
-                  else PRINTF(L_GEN_ERROR,"action %s read: %s",filter->id,strerror(errno));
-                  }
-                if(n>0) {
-                  filter->lastTime.Set(); filter->forceRun=false;
-                  Process(filter,buff,n);
-                  // don't make any assumption about data-structs here
-                  // Process() may have changed them
-                  }
-                break;
-                }
-              }
-            Unlock();
-            }
+      else if(n>0 && (filter->sf.Depth()<=1 || filter->sf.Matches(buff,n))) {
+        // the device may have applied the table id only
+        filter->lastTime=cTimeMs::Now(); filter->forceRun=false;
+        if(filter->shared) filterBroker.Distribute(filter,buff,n);
+        Process(filter,buff,n);
+        // don't make any assumption about data-structs here
+        // Process() may have changed them
         }
-
-      // call filters which are idle too long
-      Lock();
-      do {
-        r=0;
-        for(filter=filters.First(); filter; filter=filters.Next(filter)) {
-          if(filter->forceRun || (filter->idleTime && filter->lastTime.Elapsed()>filter->idleTime)) {
-            filter->lastTime.Set(); filter->forceRun=false;
-            Process(filter,0,0);
-            // don't make any assumption about data-structs here
-            // Process() may have changed them
-            r=1; break;
-            }
-          }
-        } while(r);
-      Unlock();
       }
+    Unlock();
     }
-  delete[] pfd;
+
+  Lock();
+  if(wake) { RunPending(); Woken(); }
+  // call filters which are idle too long
+  RunTimers();
+  Unlock();
 }
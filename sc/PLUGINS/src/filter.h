@@ -20,27 +20,168 @@
 #ifndef ___FILTER_H
 #define ___FILTER_H
 
+#include <stdint.h>
 #include <ffdecsawrapper/thread.h>
 #include "misc.h"
 
 class cDevice;
 class cPidFilter;
+class cAction;
+class cSharedFilter;
 
 // ----------------------------------------------------------------
 
 #define MAX_SECT_SIZE 4096
+#define TS_SIZE       188
+#define TS_CHUNK      (TS_SIZE*64)
 
-class cAction : protected cThread {
+// ----------------------------------------------------------------
+
+#define SECT_FILTER_SIZE 16 // DMX_FILTER_SIZE
+
+// Layout as for the demux: byte 0 matches the table id, byte n>0 matches
+// section byte n+2 (the length field is skipped). A set mode bit requests
+// a negative match.
+
+class cSectFilter {
+public:
+  unsigned char filter[SECT_FILTER_SIZE], mask[SECT_FILTER_SIZE], mode[SECT_FILTER_SIZE];
+  //
+  cSectFilter(int Section=0, int Mask=0);
+  void Set(int Offset, const unsigned char *Data, int Len, int Mask=0xFF);
+  int Depth(void) const;
+  bool Matches(const unsigned char *data, int len) const;
+  bool Covers(const cSectFilter &f) const;
+  bool operator==(const cSectFilter &f) const;
+  };
+
+// ----------------------------------------------------------------
+
+class cSectAssembler {
+private:
+  int pid;
+  cSectFilter sf;
+  unsigned char rest[TS_SIZE];
+  int restLen;
+  unsigned char sect[MAX_SECT_SIZE+TS_SIZE];
+  int sectLen, lastCc;
+  bool active;
+  unsigned char out[MAX_SECT_SIZE+TS_CHUNK+TS_SIZE];
+  int outLen, outPos;
+  int crcErrs, ccErrs;
+  //
+  void Packet(const unsigned char *p);
+  void Append(const unsigned char *data, int len);
+  void Emit(const unsigned char *data, int len);
+public:
+  unsigned char buff[TS_CHUNK];
+  //
+  cSectAssembler(void);
+  void Reset(int Pid, const cSectFilter &Filter);
+  void Put(const unsigned char *data, int len);
+  unsigned char *Get(int &len);
+  int CrcErrors(void) const { return crcErrs; }
+  int CcErrors(void) const { return ccErrs; }
+  };
+
+
+class cSectData : public cSimpleItem {
+public:
+  unsigned char *data;
+  int len;
+  uint64_t stamp;
+  //
+  cSectData(const unsigned char *Data, int Len);
+  virtual ~cSectData();
+  };
+
+// ----------------------------------------------------------------
+
+// Section filters with identical device, pid and cSectFilter share one
+// demux handle. The first subscriber reads it and queues the sections for
+// the others.
+
+class cFilterBroker {
+private:
+  cMutex mutex;
+  cSimpleList<cSharedFilter> shared;
+public:
+  int Subscribe(cPidFilter *filter, cDevice *device, int pid, const cSectFilter &sf);
+  void Unsubscribe(cPidFilter *filter);
+  void Distribute(cPidFilter *filter, const unsigned char *data, int len);
+  };
+
+extern cFilterBroker filterBroker;
+
+// ----------------------------------------------------------------
+
+// cActions don't run a thread of their own. A small pool of reactor threads
+// waits on the epoll sets of all actions and calls Poll(). An action stays
+// on one reactor, so Process() calls of an action never overlap.
+// Background actions (EMM logger, hooks) run on a reactor per device, so a
+// slow card update neither delays ECM processing nor another device.
+
+#define MAX_REACTORS    4
+#define MAX_BG_REACTORS 16 // MAXDEVICES
+
+class cReactor;
+
+class cReactors {
+private:
+  cMutex mutex;
+  cReactor *reactors[MAX_REACTORS+MAX_BG_REACTORS];
+  int busy;
+  bool down, stopped;
+  //
+  void Reap(void);
+public:
+  cReactors(void);
+  cReactor *Attach(cAction *action, int pri, int dev);
+  void Detach(cAction *action, cReactor *r);
+  void Shutdown(void);
+  };
+
+extern cReactors reactors;
+
+// ----------------------------------------------------------------
+
+class cAction {
+friend class cPidFilter;
+friend class cFilterBroker;
+friend class cReactor;
 private:
   const char *devId;
   int unique, pri;
-  cSimpleList<cPidFilter> filters;
+  int epfd, wakefd, timerfd;
+  uint64_t armed;
+  cReactor *reactor;
+  cMutex mutex;
+  cSimpleList<cPidFilter> filters, dead;
+  cPidFilter **timers;
+  int numTimers, maxTimers;
+  //
+  void Poll(void);
+  void Watch(cPidFilter *filter, bool on);
+  void Kick(void);
+  void Remove(cPidFilter *filter);
+  void TimerUp(int i);
+  void TimerDown(int i);
+  uint64_t TimerDue(cPidFilter *filter);
+  void TimerSet(cPidFilter *filter);
+  void TimerDel(cPidFilter *filter);
+  void ArmTimer(void);
+  void RunPending(void);
+  void RunTimers(void);
+  void Start(void);
 protected:
   cDevice *device;
   char *id;
   //
+  void Lock(void) { mutex.Lock(); }
+  void Unlock(void) { mutex.Unlock(); }
   virtual void Process(cPidFilter *filter, unsigned char *data, int len)=0;
-  virtual void Action(void);
+  virtual void Woken(void) {} // called with Lock() after Wakeup()
+  void Wakeup(void);
   virtual cPidFilter *CreateFilter(int Num, int IdleTime);
   //
   cPidFilter *NewFilter(int IdleTime);
@@ -48,6 +189,7 @@ protected:
   void DelFilter(cPidFilter *filter);
   void DelAllFilter(void);
   void Priority(int Pri);
+  void Detach(void);
 public:
   cAction(const char *Id, cDevice *Device, const char *DevId);
   virtual ~cAction();
@@ -57,11 +199,26 @@ public:
 
 class cPidFilter : public cSimpleItem, private cMutex {
 friend class cAction;
+friend class cFilterBroker;
 private:
   cDevice *device;
+  cAction *owner;
   unsigned int idleTime;
-  cTimeMs lastTime;
+  uint64_t lastTime, timerDue, wakeAt;
+  int timerIdx;
   bool forceRun;
+  cSectAssembler *tsAsm;
+  bool tsMode;
+  int buffSize;
+  cSectFilter sf;
+  cSharedFilter *shared;
+  cPidFilter *shareNext;
+  cMutex queueMutex;
+  cSimpleList<cSectData> queue;
+  //
+  void Queue(const unsigned char *data, int len);
+  cSectData *Dequeue(void);
+  void ClearQueue(void);
 protected:
   char *id;
   int fd;
@@ -72,11 +229,15 @@ public:
   cPidFilter(const char *Id, int Num, cDevice *Device, unsigned int IdleTime);
   virtual ~cPidFilter();
   void Flush(void);
-  virtual void Start(int Pid, int Section, int Mask);
+  void Start(int Pid, int Section, int Mask);
+  virtual void Start(int Pid, const cSectFilter &Filter);
   void Stop(void);
   void SetBuffSize(int BuffSize);
+  void SetTsMode(bool On);
   void Wakeup(void);
   int SetIdleTime(unsigned int IdleTime);
+  void SetTimer(int Ms);
+  uint64_t DataTime(void) const { return lastTime; }
   int Pid(void);
   bool Active(void) { return fd>=0; }
   };
@@ -27,6 +27,7 @@ public:
   static bool Active(bool log);
   static void HouseKeeping(void);
   static char *CurrKeyStr(int cardindex, int num, const char **id);
+  static char *TimingStr(int cardindex, int num, const char **id);
   static void CaidsChanged(void);
   };
 
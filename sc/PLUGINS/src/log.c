@@ -21,6 +21,11 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include <ffdecsawrapper/tools.h>
@@ -35,7 +40,10 @@
 struct LogConfig logcfg = {
   1,0,0,0,0,
   0,
-  "/var/log/vdr-sc"
+  "/var/log/vdr-sc",
+  1,
+  0,4096,
+  "/var/log/vdr-sc.trace"
   };
 
 static const struct LogModule lm_general = {
@@ -57,6 +65,437 @@ static int lastC=0, lastCount=0;
 static cTimeMs lastTime;
 static cMutex lastMutex;
 
+static __thread bool logBatch=false;
+static __thread class cLogRing *logRing=0;
+
+// -- cLogRing -----------------------------------------------------------------
+
+// Single producer/single consumer ring of preformatted log records. Each
+// thread which logs owns one ring, the writer thread is the only consumer.
+// A record is written by Reserve() and becomes visible with Commit().
+// While the owner takes a sequence number, claim is set and pending holds a
+// lower bound of it. busy is set while the owner is inside Queue().
+
+#define LOG_RING_SIZE (64*1024)
+#define LOG_MAX_TEXT  (LOG_RING_SIZE/4)
+#define LOG_ALIGN(x)  (((x)+7)&~7)
+
+struct LogRecord {
+  unsigned int len; // 0 marks the unused end of the buffer
+  unsigned int seq;
+  bool doCrc;
+  struct LogHeader lh;
+  char txt[1];
+  };
+
+class cLogRing {
+private:
+  unsigned char buff[LOG_RING_SIZE];
+  unsigned int head, tail, reserved;
+public:
+  cLogRing *next;
+  unsigned int pending;
+  int dropped;
+  bool orphan, claim, busy;
+  //
+  cLogRing(void);
+  struct LogRecord *Reserve(const struct LogHeader *lh, const char *txt, bool doCrc, bool &wasEmpty);
+  void Commit(struct LogRecord *r, unsigned int seq);
+  struct LogRecord *Peek(void);
+  void Pop(struct LogRecord *r);
+  bool Empty(void) const;
+  };
+
+cLogRing::cLogRing(void)
+{
+  head=tail=reserved=0; next=0; pending=0; dropped=0;
+  orphan=claim=busy=false;
+}
+
+bool cLogRing::Empty(void) const
+{
+  return __atomic_load_n(&head,__ATOMIC_SEQ_CST)==__atomic_load_n(&tail,__ATOMIC_ACQUIRE);
+}
+
+struct LogRecord *cLogRing::Reserve(const struct LogHeader *lh, const char *txt, bool doCrc, bool &wasEmpty)
+{
+  int l=strlen(txt);
+  if(l>LOG_MAX_TEXT) l=LOG_MAX_TEXT;
+  unsigned int need=LOG_ALIGN(sizeof(struct LogRecord)+l);
+  unsigned int h=head, t=__atomic_load_n(&tail,__ATOMIC_ACQUIRE);
+  unsigned int avail=LOG_RING_SIZE-(h-t), off=h%LOG_RING_SIZE;
+  wasEmpty=(h==t);
+  if(off+need>LOG_RING_SIZE) {
+    unsigned int skip=LOG_RING_SIZE-off;
+    if(avail<skip+need) return 0;
+    ((struct LogRecord *)&buff[off])->len=0;
+    h+=skip; off=0;
+    }
+  else if(avail<need) return 0;
+  struct LogRecord *r=(struct LogRecord *)&buff[off];
+  r->len=need; r->doCrc=doCrc;
+  r->lh=*lh;
+  memcpy(r->txt,txt,l); r->txt[l]=0;
+  reserved=h+need;
+  return r;
+}
+
+void cLogRing::Commit(struct LogRecord *r, unsigned int seq)
+{
+  r->seq=seq;
+  __atomic_store_n(&head,reserved,__ATOMIC_SEQ_CST);
+}
+
+struct LogRecord *cLogRing::Peek(void)
+{
+  unsigned int t=tail, h=__atomic_load_n(&head,__ATOMIC_ACQUIRE);
+  if(t==h) return 0;
+  unsigned int off=t%LOG_RING_SIZE;
+  struct LogRecord *r=(struct LogRecord *)&buff[off];
+  if(r->len==0) {
+    t+=LOG_RING_SIZE-off;
+    __atomic_store_n(&tail,t,__ATOMIC_RELEASE);
+    if(t==h) return 0;
+    r=(struct LogRecord *)&buff[0];
+    }
+  return r;
+}
+
+void cLogRing::Pop(struct LogRecord *r)
+{
+  __atomic_store_n(&tail,tail+r->len,__ATOMIC_RELEASE);
+}
+
+// -- cLogWriter ---------------------------------------------------------------
+
+// Drains the rings of all threads in order of the record sequence numbers
+// and does the actual output, so callers never wait for file or console I/O.
+// Sequence numbers are taken with an atomic increment and committed right
+// after. A record with a lower number may still be uncommitted, so the writer
+// only takes records below the seq it read and below the pending lower bound
+// of any ring which is claiming one.
+
+#define LOG_BATCH     256
+#define LOG_IDLE_WAIT 200 // ms
+
+class cLogWriter : public cThread {
+private:
+  cMutex mutex, ringMutex, stopMutex;
+  cCondVar cond;
+  cLogRing *rings;
+  pthread_key_t key;
+  unsigned int seq;
+  bool idle, active;
+  //
+  static void ThreadGone(void *ring);
+  cLogRing *Ring(void);
+  bool Pending(void);
+  bool Busy(void);
+  int Drain(void);
+protected:
+  virtual void Action(void);
+public:
+  cLogWriter(void);
+  bool Queue(const struct LogHeader *lh, const char *txt, bool doCrc, bool mayDrop);
+  void Activate(void);
+  void Stop(void);
+  };
+
+static cLogWriter *logWriter=0;
+
+cLogWriter::cLogWriter(void)
+:cThread("SC log writer")
+{
+  rings=0; seq=0; idle=active=false;
+  pthread_key_create(&key,ThreadGone);
+}
+
+void cLogWriter::ThreadGone(void *ring)
+{
+  // runs in the exiting thread. The writer frees the ring once it's drained.
+  logRing=0;
+  __atomic_store_n(&((cLogRing *)ring)->orphan,true,__ATOMIC_RELEASE);
+}
+
+cLogRing *cLogWriter::Ring(void)
+{
+  if(!logRing) {
+    cLogRing *ring=new cLogRing;
+    if(ring) {
+      ringMutex.Lock();
+      ring->next=rings; rings=ring;
+      ringMutex.Unlock();
+      pthread_setspecific(key,ring);
+      logRing=ring;
+      }
+    }
+  return logRing;
+}
+
+// Returns false if the caller should output the line itself. If the ring is
+// full, the line is either dropped (and counted) or waits for the writer.
+bool cLogWriter::Queue(const struct LogHeader *lh, const char *txt, bool doCrc, bool mayDrop)
+{
+  if(logBatch) return false;
+  cLogRing *ring=0;
+  if(__atomic_load_n(&active,__ATOMIC_ACQUIRE)) ring=Ring();
+  if(ring) {
+    // pairs with Stop(): either we see active cleared or Stop() sees busy
+    __atomic_store_n(&ring->busy,true,__ATOMIC_SEQ_CST);
+    bool wasEmpty;
+    struct LogRecord *r=0;
+    while(__atomic_load_n(&active,__ATOMIC_SEQ_CST) && !(r=ring->Reserve(lh,txt,doCrc,wasEmpty))) {
+      if(mayDrop) {
+        __atomic_add_fetch(&ring->dropped,1,__ATOMIC_RELAXED);
+        __atomic_store_n(&ring->busy,false,__ATOMIC_RELEASE);
+        return true;
+        }
+      // passing it back would put it ahead of the queued lines
+      cCondWait::SleepMs(1);
+      }
+    if(r) {
+      __atomic_store_n(&ring->pending,__atomic_load_n(&seq,__ATOMIC_RELAXED),__ATOMIC_RELEASE);
+      __atomic_store_n(&ring->claim,true,__ATOMIC_SEQ_CST);
+      ring->Commit(r,__atomic_fetch_add(&seq,1,__ATOMIC_SEQ_CST));
+      __atomic_store_n(&ring->claim,false,__ATOMIC_RELEASE);
+      __atomic_store_n(&ring->busy,false,__ATOMIC_RELEASE);
+      if(wasEmpty && __atomic_load_n(&idle,__ATOMIC_SEQ_CST)) {
+        mutex.Lock();
+        cond.Broadcast();
+        mutex.Unlock();
+        }
+      return true;
+      }
+    __atomic_store_n(&ring->busy,false,__ATOMIC_RELEASE);
+    }
+  // wait for a running Stop() to finish its final drain, so the line
+  // doesn't overtake older ones of this thread which are still queued
+  stopMutex.Lock();
+  stopMutex.Unlock();
+  return false;
+}
+
+bool cLogWriter::Pending(void)
+{
+  cMutexLock lock(&ringMutex);
+  for(cLogRing *r=rings; r; r=r->next)
+    if(!r->Empty() || r->dropped) return true;
+  return false;
+}
+
+bool cLogWriter::Busy(void)
+{
+  cMutexLock lock(&ringMutex);
+  for(cLogRing *r=rings; r; r=r->next)
+    if(__atomic_load_n(&r->busy,__ATOMIC_SEQ_CST)) return true;
+  return false;
+}
+
+int cLogWriter::Drain(void)
+{
+  int n;
+  for(n=0; n<LOG_BATCH; n++) {
+    cLogRing *best=0;
+    struct LogRecord *rec=0;
+    unsigned int limit=__atomic_load_n(&seq,__ATOMIC_SEQ_CST);
+    ringMutex.Lock();
+    for(cLogRing *r=rings; r; r=r->next)
+      if(__atomic_load_n(&r->claim,__ATOMIC_SEQ_CST)) {
+        unsigned int p=__atomic_load_n(&r->pending,__ATOMIC_ACQUIRE);
+        if((int)(p-limit)<0) limit=p;
+        }
+    for(cLogRing *r=rings, *prev=0; r;) {
+      struct LogRecord *p=r->Peek();
+      if(p) {
+        if((int)(p->seq-limit)<0 && (!rec || (int)(p->seq-rec->seq)<0)) { rec=p; best=r; }
+        }
+      else if(__atomic_load_n(&r->orphan,__ATOMIC_ACQUIRE) && !r->dropped && r->Empty()) {
+        cLogRing *d=r;
+        r=r->next;
+        if(prev) prev->next=r; else rings=r;
+        delete d;
+        continue;
+        }
+      prev=r; r=r->next;
+      }
+    int lost=0;
+    for(cLogRing *r=rings; r; r=r->next)
+      if(r->dropped) lost+=__atomic_exchange_n(&r->dropped,0,__ATOMIC_RELAXED);
+    ringMutex.Unlock();
+    if(lost) {
+      struct LogHeader lh;
+      if(cLogging::GetHeader(L_GEN_WARN,&lh))
+        cLogging::OutLine(&lh,*cString::sprintf("%d log messages lost (queue full)",lost),false);
+      }
+    if(!rec) break;
+    cLogging::OutLine(&rec->lh,rec->txt,rec->doCrc);
+    best->Pop(rec);
+    }
+  if(n>0) {
+    logfileMutex.Lock();
+    if(logfile) fflush(logfile);
+    logfileMutex.Unlock();
+    }
+  return n;
+}
+
+void cLogWriter::Action(void)
+{
+  logBatch=true;
+  while(Running()) {
+    if(Drain()>0) continue;
+    mutex.Lock();
+    __atomic_store_n(&idle,true,__ATOMIC_SEQ_CST);
+    if(!Pending()) cond.TimedWait(mutex,LOG_IDLE_WAIT);
+    __atomic_store_n(&idle,false,__ATOMIC_SEQ_CST);
+    mutex.Unlock();
+    }
+  while(Drain()>0);
+}
+
+void cLogWriter::Activate(void)
+{
+  if(!Active()) {
+    __atomic_store_n(&active,true,__ATOMIC_RELEASE);
+    Start();
+    }
+}
+
+void cLogWriter::Stop(void)
+{
+  // held until the final drain is done, lines logged meanwhile wait in Queue()
+  cMutexLock lock(&stopMutex);
+  __atomic_store_n(&active,false,__ATOMIC_SEQ_CST);
+  // let lines which saw active finish their commit
+  while(Busy()) cCondWait::SleepMs(1);
+  mutex.Lock();
+  cond.Broadcast();
+  mutex.Unlock();
+  Cancel(3);
+  logBatch=true;
+  while(Drain()>0);
+  logBatch=false;
+}
+
+// -- cLogTrace ----------------------------------------------------------------
+
+#define TRACE_HDRSIZE 64
+#define TRACE_ALIGN(x) (((x)+7)&~7)
+
+class cLogTrace {
+private:
+  cMutex mutex;
+  int fd;
+  unsigned char *map;
+  struct TraceHeader *hdr;
+  uint64_t mapLen;
+  char name[sizeof(logcfg.traceFilename)];
+  int kb;
+  bool failed;
+  //
+  bool Check(void);
+  bool Open(void);
+  void Close(void);
+  struct TraceRecord *Rec(uint64_t pos) { return (struct TraceRecord *)(map+hdr->hdrSize+pos%hdr->size); }
+public:
+  cLogTrace(void);
+  bool Put(int c, const char *tag, const char *text, const void *data, int n, int flags);
+  };
+
+static cLogTrace logTrace;
+
+cLogTrace::cLogTrace(void)
+{
+  fd=-1; map=0; hdr=0; mapLen=0; name[0]=0; kb=0; failed=false;
+}
+
+void cLogTrace::Close(void)
+{
+  if(map) { munmap(map,mapLen); map=0; hdr=0; }
+  if(fd>=0) { close(fd); fd=-1; }
+}
+
+bool cLogTrace::Open(void)
+{
+  Close();
+  strn0cpy(name,logcfg.traceFilename,sizeof(name));
+  kb=logcfg.maxTracesize;
+  uint64_t size=(uint64_t)(kb>64 ? kb : 64)*1024;
+  mapLen=TRACE_HDRSIZE+size;
+  fd=open(name,O_RDWR|O_CREAT,0644);
+  if(fd>=0) {
+    struct stat64 st;
+    bool keep=(fstat64(fd,&st)==0 && (uint64_t)st.st_size==mapLen);
+    if(keep || ftruncate(fd,mapLen)==0) {
+      map=(unsigned char *)mmap(0,mapLen,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+      if(map!=MAP_FAILED) {
+        hdr=(struct TraceHeader *)map;
+        // continue an existing trace of the same size
+        if(!keep || memcmp(hdr->magic,TRACE_MAGIC,sizeof(hdr->magic)) || hdr->version!=TRACE_VERSION
+           || hdr->hdrSize!=TRACE_HDRSIZE || hdr->size!=size || hdr->head-hdr->tail>size) {
+          memset(hdr,0,TRACE_HDRSIZE);
+          memcpy(hdr->magic,TRACE_MAGIC,sizeof(hdr->magic));
+          hdr->version=TRACE_VERSION;
+          hdr->hdrSize=TRACE_HDRSIZE;
+          hdr->size=size;
+          }
+        return true;
+        }
+      map=0;
+      }
+    }
+  // not through PRINTF, logfile output might end up here again
+  syslog(LOG_ERR,"[sc] failed to open trace file '%s': %s",name,strerror(errno));
+  Close();
+  return false;
+}
+
+bool cLogTrace::Check(void)
+{
+  if(map && kb==logcfg.maxTracesize && !strcmp(name,logcfg.traceFilename)) return true;
+  if(failed && kb==logcfg.maxTracesize && !strcmp(name,logcfg.traceFilename)) return false;
+  failed=!Open();
+  return !failed;
+}
+
+bool cLogTrace::Put(int c, const char *tag, const char *text, const void *data, int n, int flags)
+{
+  int tagl=strlen(tag), textl=strlen(text);
+  if(tagl>255) tagl=255;
+  if(textl>65535) textl=65535;
+  uint64_t need=TRACE_ALIGN(sizeof(struct TraceRecord)+tagl+textl+n);
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  cMutexLock lock(&mutex);
+  if(!Check() || need>hdr->size/2) return false;
+  uint64_t size=hdr->size, off=hdr->head%size;
+  uint64_t skip=off+need>size ? size-off : 0;
+  // drop the oldest records until the new one fits
+  while(hdr->head+skip+need-hdr->tail>size) {
+    uint32_t l=Rec(hdr->tail)->len;
+    if(l<8 || l>size-hdr->tail%size) { hdr->tail=hdr->head; break; }
+    hdr->tail+=l;
+    }
+  if(skip) {
+    struct TraceRecord *r=Rec(hdr->head);
+    r->len=skip; r->c=0;
+    hdr->head+=skip;
+    }
+  struct TraceRecord *r=Rec(hdr->head);
+  r->c=c;
+  r->stamp=(uint64_t)tv.tv_sec*1000000+tv.tv_usec;
+  r->tid=cThread::ThreadId();
+  r->dataLen=n; r->textLen=textl; r->tagLen=tagl; r->flags=flags;
+  r->reserved=0;
+  unsigned char *p=(unsigned char *)(r+1);
+  memcpy(p,tag,tagl); p+=tagl;
+  memcpy(p,text,textl); p+=textl;
+  memcpy(p,data,n);
+  r->len=need;
+  hdr->head+=need;
+  return true;
+}
+
 // -- cLogging -----------------------------------------------------------------
 
 void (*cLogging::LogPrint)(const struct LogHeader *lh, const char *txt)=cLogging::PrivateLogPrint;
@@ -85,11 +524,11 @@ const struct LogModule *cLogging::GetModule(int c)
   return m<LMOD_SUP ? mods[m] : 0;
 }
 
-bool cLogging::GetHeader(int c, struct LogHeader *lh)
+bool cLogging::GetHeader(int c, struct LogHeader *lh, bool stamp)
 {
   const struct LogModule *lm=GetModule(c);
   if(lm) {
-    if(!logcfg.noTimestamp) {
+    if(stamp && !logcfg.noTimestamp) {
       struct timeval t;
       gettimeofday(&t,NULL);
       struct tm tm_r;
@@ -106,7 +545,40 @@ bool cLogging::GetHeader(int c, struct LogHeader *lh)
   return false;  
 }
 
+void cLogging::StartWriter(void)
+{
+  if(!logWriter) logWriter=new cLogWriter;
+  if(logWriter) logWriter->Activate();
+}
+
+void cLogging::StopWriter(void)
+{
+  // the writer object stays around, late callers just log synchronously
+  if(logWriter) logWriter->Stop();
+}
+
+// Queues a line which was already filtered and formatted elsewhere. It ends
+// up at LogPrint() with class L_GEN_RAW. Returns false if the caller has to
+// output it itself. Callers are on the TS data path, so if the ring is full
+// the line is dropped and counted like other non-general classes.
+bool cLogging::PutRaw(const char *stamp, const char *tag, const char *txt)
+{
+  if(!logcfg.logAsync || !logWriter) return false;
+  struct LogHeader lh;
+  lh.c=L_GEN_RAW;
+  strn0cpy(lh.stamp,stamp,sizeof(lh.stamp));
+  strn0cpy(lh.tag,tag,sizeof(lh.tag));
+  return logWriter->Queue(&lh,txt,false,true);
+}
+
 void cLogging::LogLine(const struct LogHeader *lh, const char *txt, bool doCrc)
+{
+  // general messages (errors, warnings) are never dropped
+  if(logcfg.logAsync && logWriter && logWriter->Queue(lh,txt,doCrc,LMOD(lh->c)!=L_GEN)) return;
+  OutLine(lh,txt,doCrc);
+}
+
+void cLogging::OutLine(const struct LogHeader *lh, const char *txt, bool doCrc)
 {
   if(doCrc) {
     unsigned int crc=crc32_le(0,(const unsigned char *)txt,strlen(txt)+1);
@@ -126,7 +598,7 @@ void cLogging::LogLine(const struct LogHeader *lh, const char *txt, bool doCrc)
         if(GetHeader(saveC,&lh2)) {
           char buff[128];
           snprintf(buff,sizeof(buff),"last message repeated %d times",saveCount);
-          LogLine(&lh2,buff,false);
+          OutLine(&lh2,buff,false);
           }
         if(saveCrc==crc && saveC==lh->c) return;
         }
@@ -151,7 +623,6 @@ void cLogging::PrivateLogPrint(const struct LogHeader *lh, const char *txt)
     if(!logfile && !logfileShutup) {
       logfile=fopen(logcfg.logFilename,"a");
       if(logfile) {
-        setlinebuf(logfile);
         logfileSize=ftell(logfile);
         if(logfileSize<0) {
           logfileSize=0;
@@ -165,8 +636,10 @@ void cLogging::PrivateLogPrint(const struct LogHeader *lh, const char *txt)
         }
       }
     if(logfile) {
+      // the writer thread flushes once per batch
       int q=fprintf(logfile,"%s [%s] %s\n",lh->stamp,lh->tag,txt);
       if(q>0) logfileSize+=q;
+      if(!logBatch) fflush(logfile);
 
       if(logcfg.maxFilesize>0 && logfileSize>((long long)logcfg.maxFilesize*1024)) {
         fprintf(logfile,"%s [%s] %s\n",lh->stamp,lh->tag,"logfile closed, filesize limit reached");
@@ -242,21 +715,36 @@ void cLogging::PutLB(int c, cLineBuff *lb)
     }
 }
 
+static int HexBytes(char *buff, const unsigned char *d, int n)
+{
+  static const char hex[] = "0123456789abcdef";
+  char *p=buff;
+  for(int i=0; i<n; i++) {
+    *p++=' ';
+    *p++=hex[d[i]>>4];
+    *p++=hex[d[i]&15];
+    }
+  *p=0;
+  return p-buff;
+}
+
 void cLogging::Dump(int c, const void *data, int n, const char *format, ...)
 {
   if(Enabled(c)) {
     struct LogHeader lh;
-    if(GetHeader(c,&lh)) {
+    if(GetHeader(c,&lh,!logcfg.logTrace)) {
       char buff[1024];
       va_list ap;
       va_start(ap,format);
       vsnprintf(buff,sizeof(buff),format,ap);
       va_end(ap);
+      if(logcfg.logTrace && logTrace.Put(c,lh.tag,buff,data,n,0)) return;
+      if(logcfg.logTrace) GetHeader(c,&lh);
       LogLine(&lh,buff);
       const unsigned char *d=(const unsigned char *)data;
-      for(int i=0; i<n;) {
+      for(int i=0; i<n; i+=16) {
         int q=sprintf(buff,"%04x:",i);
-        for(int l=0 ; l<16 && i<n ; l++) q+=sprintf(&buff[q]," %02x",d[i++]);
+        HexBytes(&buff[q],&d[i],n-i<16 ? n-i : 16);
         LogLine(&lh,buff);
         }
       }
@@ -267,20 +755,21 @@ void cLogging::LineDump(int c, const void *data, int n, const char *format, ...)
 {
   if(Enabled(c)) {
     struct LogHeader lh;
-    if(GetHeader(c,&lh)) {
+    if(GetHeader(c,&lh,!logcfg.logTrace)) {
       char buff[4096];
       va_list ap;
       va_start(ap,format);
       unsigned int q=vsnprintf(buff,sizeof(buff),format,ap);
       va_end(ap);
-      const unsigned char *d=(const unsigned char *)data;
-      for(int i=0; i<n; i++) {
-        if(q>=sizeof(buff)-8) {
-          q+=snprintf(&buff[q],sizeof(buff)-q,"....");
-          break;
-          }
-        q+=snprintf(&buff[q],sizeof(buff)-q," %02x",d[i]);
+      if(q>sizeof(buff)-8) q=sizeof(buff)-8;
+      if(logcfg.logTrace && logTrace.Put(c,lh.tag,buff,data,n,TRACE_LINEDUMP)) return;
+      if(logcfg.logTrace) GetHeader(c,&lh);
+      int max=(sizeof(buff)-8-q)/3;
+      if(n>max) {
+        q+=HexBytes(&buff[q],(const unsigned char *)data,max);
+        strcpy(&buff[q],"....");
         }
+      else HexBytes(&buff[q],(const unsigned char *)data,n);
       LogLine(&lh,buff);
       }
     }
@@ -20,6 +20,7 @@
 #ifndef ___LOG_H
 #define ___LOG_H
 
+#include <stdint.h>
 #include "misc.h"
 
 class cMutex;
@@ -64,6 +65,7 @@ class cMutex;
 #define L_GEN_INFO  LCLASS(L_GEN,0x8)
 #define L_GEN_DEBUG LCLASS(L_GEN,0x10)
 #define L_GEN_MISC  LCLASS(L_GEN,0x20)
+#define L_GEN_RAW   LCLASS(L_GEN,0x0)  // preformatted lines from PutRaw()
 
 #define L_GEN_ALL   LALL(L_GEN_MISC)
 
@@ -73,10 +75,39 @@ struct LogConfig {
   int logCon, logFile, logSys, logUser, noTimestamp;
   int maxFilesize;
   char logFilename[128];
+  int logAsync;
+  int logTrace, maxTracesize;
+  char traceFilename[128];
   };
 
 extern struct LogConfig logcfg;
 
+// Binary trace file for HEXDUMP/LDUMP payloads (render with testing/tracedump).
+// The data area is a ring. head/tail are running byte positions, the record
+// at pos is found at hdrSize+pos%size. A record with c==0 pads up to the end
+// of the data area.
+
+#define TRACE_MAGIC   "SCTRACE1"
+#define TRACE_VERSION 1
+
+#define TRACE_LINEDUMP 1 // record flag: render data on the text line
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t version, hdrSize;
+  uint64_t size, head, tail;
+  };
+
+struct TraceRecord {
+  uint32_t len, c;      // total length (8 byte aligned) & log class
+  uint64_t stamp;       // usec since epoch
+  uint32_t tid, dataLen;
+  uint16_t textLen;
+  uint8_t tagLen, flags;
+  uint32_t reserved;
+  // followed by tag, text and data
+  };
+
 struct LogModule {
   int OptSupported, OptDefault;
   const char *Name, *OptName[LOPT_NUM];
@@ -88,13 +119,17 @@ struct LogHeader {
   char tag[64];
   };
 
+class cLogWriter;
+
 class cLogging {
+friend class cLogWriter;
 private:
   static void (*LogPrint)(const struct LogHeader *lh, const char *txt);
   //
   static void PrivateLogPrint(const struct LogHeader *lh, const char *txt);
-  static bool GetHeader(int c, struct LogHeader *lh);
+  static bool GetHeader(int c, struct LogHeader *lh, bool stamp=true);
   static void LogLine(const struct LogHeader *lh, const char *txt, bool doCrc=true);
+  static void OutLine(const struct LogHeader *lh, const char *txt, bool doCrc);
   static const struct LogModule *GetModule(int c);
   static void UpgradeOptions(int m);
 public:
@@ -117,6 +152,9 @@ public:
   static void ParseConfig(const char *txt);
   static bool GetConfig(cLineBuff *lb);
   static void ReopenLogfile(void);
+  static void StartWriter(void);
+  static void StopWriter(void);
+  static bool PutRaw(const char *stamp, const char *tag, const char *txt);
   static int GetClassByName(const char *name);
   };
 
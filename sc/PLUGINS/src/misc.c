@@ -155,6 +155,73 @@ unsigned int crc32_le(unsigned int crc, unsigned char const *p, int len)
   return crc;
 }
 
+/*
+ * Hash128 - fast non-cryptographic 128-bit hash (MurmurHash3 x64_128,
+ * public domain by Austin Appleby). Used where MD5 was only needed as a
+ * message fingerprint. Result is stored little-endian in hash[16].
+ */
+static inline unsigned long long rotl64(unsigned long long x, int r)
+{
+  return (x<<r) | (x>>(64-r));
+}
+
+static inline unsigned long long fmix64(unsigned long long k)
+{
+  k^=k>>33; k*=0xff51afd7ed558ccdULL;
+  k^=k>>33; k*=0xc4ceb9fe1a85ec53ULL;
+  k^=k>>33;
+  return k;
+}
+
+static inline unsigned long long getblock64(const unsigned char *p)
+{
+  unsigned long long k=0;
+  for(int i=7; i>=0; i--) k=(k<<8) | p[i];
+  return k;
+}
+
+void Hash128(const unsigned char *data, int len, unsigned char *hash)
+{
+  const unsigned long long c1=0x87c37b91114253d5ULL, c2=0x4cf5ad432745937fULL;
+  unsigned long long h1=0, h2=0, k1, k2;
+  const int nblocks=len/16;
+  for(int i=0; i<nblocks; i++, data+=16) {
+    k1=getblock64(data); k2=getblock64(data+8);
+    k1*=c1; k1=rotl64(k1,31); k1*=c2; h1^=k1;
+    h1=rotl64(h1,27); h1+=h2; h1=h1*5+0x52dce729;
+    k2*=c2; k2=rotl64(k2,33); k2*=c1; h2^=k2;
+    h2=rotl64(h2,31); h2+=h1; h2=h2*5+0x38495ab5;
+    }
+  k1=k2=0;
+  switch(len&15) {
+    case 15: k2^=(unsigned long long)data[14]<<48;
+    case 14: k2^=(unsigned long long)data[13]<<40;
+    case 13: k2^=(unsigned long long)data[12]<<32;
+    case 12: k2^=(unsigned long long)data[11]<<24;
+    case 11: k2^=(unsigned long long)data[10]<<16;
+    case 10: k2^=(unsigned long long)data[ 9]<<8;
+    case  9: k2^=(unsigned long long)data[ 8];
+             k2*=c2; k2=rotl64(k2,33); k2*=c1; h2^=k2;
+    case  8: k1^=(unsigned long long)data[ 7]<<56;
+    case  7: k1^=(unsigned long long)data[ 6]<<48;
+    case  6: k1^=(unsigned long long)data[ 5]<<40;
+    case  5: k1^=(unsigned long long)data[ 4]<<32;
+    case  4: k1^=(unsigned long long)data[ 3]<<24;
+    case  3: k1^=(unsigned long long)data[ 2]<<16;
+    case  2: k1^=(unsigned long long)data[ 1]<<8;
+    case  1: k1^=(unsigned long long)data[ 0];
+             k1*=c1; k1=rotl64(k1,31); k1*=c2; h1^=k1;
+    }
+  h1^=len; h2^=len;
+  h1+=h2; h2+=h1;
+  h1=fmix64(h1); h2=fmix64(h2);
+  h1+=h2; h2+=h1;
+  for(int i=0; i<8; i++) {
+    hash[i]  =(h1>>(i*8))&0xFF;
+    hash[i+8]=(h2>>(i*8))&0xFF;
+    }
+}
+
 // -- cLineBuff -----------------------------------------------------------------
 
 cLineBuff::cLineBuff(int blocksize)
@@ -224,6 +291,41 @@ void cLineBuff::Back(int n)
   if(work) work[blen]=0;
 }
 
+// -- cItemPool ----------------------------------------------------------------
+
+cItemPool::cItemPool(size_t Size, int MaxFree)
+{
+  pthread_mutex_init(&mutex,0);
+  size=Size;
+  maxFree=MaxFree;
+  freeList=0; numFree=numAlloc=0;
+}
+
+void *cItemPool::Alloc(size_t Size)
+{
+  if(Size!=size || Size<sizeof(void *)) return ::operator new(Size);
+  pthread_mutex_lock(&mutex);
+  void *p=freeList;
+  if(p) { freeList=*(void **)p; numFree--; }
+  else numAlloc++;
+  pthread_mutex_unlock(&mutex);
+  return p ? p : ::operator new(size);
+}
+
+void cItemPool::Free(void *p, size_t Size)
+{
+  if(!p) return;
+  if(Size!=size || Size<sizeof(void *)) { ::operator delete(p); return; }
+  pthread_mutex_lock(&mutex);
+  if(numFree<maxFree) {
+    *(void **)p=freeList; freeList=p; numFree++;
+    p=0;
+    }
+  else numAlloc--;
+  pthread_mutex_unlock(&mutex);
+  if(p) ::operator delete(p);
+}
+
 // -- cSimpleListBase --------------------------------------------------------------
 
 cSimpleListBase::cSimpleListBase(void)
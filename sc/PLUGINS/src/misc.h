@@ -21,6 +21,8 @@
 #define ___MISC_H
 
 #include <alloca.h>
+#include <stddef.h>
+#include <pthread.h>
 
 // ----------------------------------------------------------------
 
@@ -55,6 +57,7 @@ bool CheckNull(const unsigned char *data, int len);
 bool CheckFF(const unsigned char *data, int len);
 unsigned char XorSum(const unsigned char *mem, int len);
 unsigned int crc32_le(unsigned int crc, unsigned char const *p, int len);
+void Hash128(const unsigned char *data, int len, unsigned char *hash);
 
 char *bprintf(const char *fmt, ...) __attribute__ ((format (printf,1,2)));
 
@@ -82,6 +85,27 @@ public:
 
 // ----------------------------------------------------------------
 
+// Free list for objects of one size, used from class operator new/delete of
+// items which come and go with each channel switch. Requests of a different
+// size (derived classes) are passed to the heap. The pool is never destroyed,
+// so it's safe to use from static destructors.
+
+class cItemPool {
+private:
+  pthread_mutex_t mutex;
+  size_t size;
+  void *freeList;
+  int numFree, maxFree, numAlloc;
+public:
+  cItemPool(size_t Size, int MaxFree);
+  void *Alloc(size_t Size);
+  void Free(void *p, size_t Size);
+  int Allocated(void) const { return numAlloc; }
+  int Idle(void) const { return numFree; }
+  };
+
+// ----------------------------------------------------------------
+
 class cSimpleListBase;
 
 class cSimpleItem {
@@ -26,6 +26,9 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <ffdecsawrapper/thread.h>
 #include <ffdecsawrapper/tools.h>
@@ -38,63 +41,174 @@
 #define DEFAULT_READWRITE_TIMEOUT 3*1000    // ms
 #define DEFAULT_IDLE_TIMEOUT      120*1000  // ms
 
-// -- cNetWatcher ---------------------------------------------------------------
+// -- cNetReactor ---------------------------------------------------------------
 
-class cNetWatcher : protected cThread {
+// All connected sockets are registered in one epoll set. Readers and writers
+// try the I/O first and only on EAGAIN arm their socket (EPOLLONESHOT) and
+// sleep on its condition, so a waiting thread doesn't hold the socket lock.
+// The socket is armed for every direction somebody waits on, all waiters
+// wake up on any event and re-arm if their I/O still can't proceed.
+// The reactor thread wakes them up and disconnects sockets at their idle
+// deadline.
+
+class cNetReactor : protected cThread {
 private:
+  int epfd, evfd;
+  uint64_t serial;
   cSimpleList<cNetSocket> socks;
+  //
+  void Wake(void);
+  cNetSocket *Find(uint64_t id);
 protected:
   virtual void Action(void);
 public:
-  cNetWatcher(void);
-  ~cNetWatcher();
+  cNetReactor(void);
+  ~cNetReactor();
   void Up(cNetSocket *so);
   void Down(cNetSocket *so);
+  bool Arm(cNetSocket *so);
   };
 
-static cNetWatcher nw;
+static cNetReactor nw;
 
-cNetWatcher::cNetWatcher(void)
-:cThread("Netwatcher")
-{}
+cNetReactor::cNetReactor(void)
+:cThread("Netreactor")
+{
+  epfd=evfd=-1; serial=0;
+}
 
-cNetWatcher::~cNetWatcher()
+cNetReactor::~cNetReactor()
 {
+  Cancel(-1); Wake();
   Cancel(2);
   Lock();
   cNetSocket *so;
   while((so=socks.First())) socks.Del(so,false);
+  if(evfd>=0) close(evfd);
+  if(epfd>=0) close(epfd);
   Unlock();
 }
 
-void cNetWatcher::Up(cNetSocket *so)
+void cNetReactor::Wake(void)
+{
+  if(evfd>=0) {
+    uint64_t one=1;
+    if(write(evfd,&one,sizeof(one))<0 && errno!=EAGAIN)
+      PRINTF(L_GEN_ERROR,"netreactor: wakeup failed: %s",strerror(errno));
+    }
+}
+
+cNetSocket *cNetReactor::Find(uint64_t id)
+{
+  for(cNetSocket *so=socks.First(); so; so=socks.Next(so))
+    if(so->regId==id) return so;
+  return 0;
+}
+
+void cNetReactor::Up(cNetSocket *so)
 {
   Lock();
-  socks.Add(so);
+  if(epfd<0) {
+    if((epfd=epoll_create1(EPOLL_CLOEXEC))<0 || (evfd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC))<0) {
+      PRINTF(L_GEN_ERROR,"netreactor: setup failed: %s",strerror(errno));
+      if(epfd>=0) { close(epfd); epfd=-1; }
+      Unlock();
+      return;
+      }
+    else {
+      struct epoll_event ev;
+      ev.events=EPOLLIN; ev.data.u64=0;
+      epoll_ctl(epfd,EPOLL_CTL_ADD,evfd,&ev);
+      }
+    }
+  so->Lock();
+  if(so->sd>=0 && !so->regId) {
+    struct epoll_event ev;
+    ev.events=EPOLLONESHOT; ev.data.u64=++serial;
+    if(epoll_ctl(epfd,EPOLL_CTL_ADD,so->sd,&ev)==0) {
+      so->regId=serial;
+      socks.Add(so);
+      }
+    else PRINTF(L_GEN_ERROR,"netreactor: register failed: %s",strerror(errno));
+    }
+  so->Unlock();
+  Wake();
   if(!Active()) Start();
   Unlock();
 }
 
-void cNetWatcher::Down(cNetSocket *so)
+void cNetReactor::Down(cNetSocket *so)
 {
   Lock();
-  socks.Del(so,false);
+  so->Lock();
+  if(so->regId) {
+    if(so->sd>=0) epoll_ctl(epfd,EPOLL_CTL_DEL,so->sd,0);
+    socks.Del(so,false);
+    so->regId=0;
+    }
+  so->Unlock();
   Unlock();
 }
 
-void cNetWatcher::Action(void)
+// called with the socket locked
+bool cNetReactor::Arm(cNetSocket *so)
 {
+  if(!so->regId) return false;
+  struct epoll_event ev;
+  ev.events=EPOLLONESHOT;
+  if(so->rdWaiters) ev.events|=EPOLLIN|EPOLLRDHUP;
+  if(so->wrWaiters) ev.events|=EPOLLOUT;
+  ev.data.u64=so->regId;
+  return epoll_ctl(epfd,EPOLL_CTL_MOD,so->sd,&ev)==0;
+}
+
+void cNetReactor::Action(void)
+{
+  struct epoll_event ev[16];
   while(Running()) {
-    sleep(1);
     Lock();
+    uint64_t now=cTimeMs::Now(), next=0;
+    for(cNetSocket *so=socks.First(); so; so=socks.Next(so)) {
+      uint64_t t=__atomic_load_n(&so->idleAt,__ATOMIC_RELAXED);
+      if(t && (!next || t<next)) next=t;
+      }
+    Unlock();
+    int to=-1;
+    if(next) to=next>now ? min(next-now,(uint64_t)60*60*1000):0;
+    int n=epoll_wait(epfd,ev,sizeof(ev)/sizeof(ev[0]),to);
+    if(n<0 && errno!=EINTR) {
+      PRINTF(L_GEN_ERROR,"netreactor: epoll_wait failed: %s",strerror(errno));
+      cCondWait::SleepMs(100);
+      }
+    Lock();
+    for(int i=0; i<n; i++) {
+      if(ev[i].data.u64==0) {
+        uint64_t cnt;
+        while(read(evfd,&cnt,sizeof(cnt))>0);
+        continue;
+        }
+      cNetSocket *so=Find(ev[i].data.u64);
+      if(so) {
+        so->Lock();
+        so->ready.Broadcast();
+        so->Unlock();
+        }
+      }
+    now=cTimeMs::Now();
     for(cNetSocket *so=socks.First(); so;) {
       cNetSocket *next=socks.Next(so);
-      so->Lock();
-      if(so->connected && so->activity.TimedOut()) {
-        PRINTF(L_CORE_NET,"idle timeout, disconnected %s:%d",so->hostname,so->port);
-        so->Disconnect();
+      uint64_t t=__atomic_load_n(&so->idleAt,__ATOMIC_RELAXED);
+      if(t && t<=now) {
+        so->Lock();
+        const bool busy=so->rdWaiters || so->wrWaiters;
+        if(so->connected && !busy && so->idleAt<=now) {
+          PRINTF(L_CORE_NET,"idle timeout, disconnected %s:%d",so->hostname,so->port);
+          so->Disconnect();
+          }
+        else if(busy) // recheck after the next activity
+          __atomic_store_n(&so->idleAt,now+1000,__ATOMIC_RELAXED);
+        so->Unlock();
         }
-      so->Unlock();
       so=next;
       }
     Unlock();
@@ -106,6 +220,7 @@ void cNetWatcher::Action(void)
 cNetSocket::cNetSocket(void)
 {
   hostname=0; sd=-1; udp=connected=quietlog=false;
+  idleAt=regId=0; rdWaiters=wrWaiters=0;
   conTimeout=DEFAULT_CONNECT_TIMEOUT; rwTimeout=DEFAULT_READWRITE_TIMEOUT;
   idleTimeout=DEFAULT_IDLE_TIMEOUT;
 }
@@ -118,7 +233,7 @@ cNetSocket::~cNetSocket()
 
 void cNetSocket::Activity(void)
 {
-  activity.Set(idleTimeout);
+  __atomic_store_n(&idleAt,idleTimeout>0 ? cTimeMs::Now()+idleTimeout:0,__ATOMIC_RELAXED);
 }
 
 bool cNetSocket::GetAddr(struct sockaddr_in *saddr, const char *Hostname, int Port)
@@ -162,8 +277,8 @@ int cNetSocket::GetSocket(bool Udp)
 
 bool cNetSocket::Connect(const char *Hostname, int Port, int timeout)
 {
-  Lock();
   Disconnect();
+  Lock();
   if(Hostname) {
     free(hostname);
     hostname=strdup(Hostname); port=Port;
@@ -178,7 +293,7 @@ bool cNetSocket::Connect(const char *Hostname, int Port, int timeout)
     do { r=connect(sd,(struct sockaddr *)&socketAddr,sizeof(socketAddr)); } while(r<0 && errno==EINTR);
     if(r==0) connected=true;
     else if(errno==EINPROGRESS) {
-      if(Select(false,timeout)>0) {
+      if(Wait(false,timeout)>0) {
         int r=-1;
         unsigned int l=sizeof(r);
         if(getsockopt(sd,SOL_SOCKET,SO_ERROR,&r,&l)==0) {
@@ -201,8 +316,8 @@ bool cNetSocket::Connect(const char *Hostname, int Port, int timeout)
 
 bool cNetSocket::Bind(const char *Hostname, int Port)
 {
-  Lock();
   Disconnect();
+  Lock();
   if(Hostname) {
     free(hostname);
     hostname=strdup(Hostname); port=Port;
@@ -232,6 +347,8 @@ void cNetSocket::Disconnect(void)
   cMutexLock lock(this);
   if(sd>=0) { close(sd); sd=-1; }
   quietlog=connected=false;
+  idleAt=0;
+  ready.Broadcast();
 }
 
 void cNetSocket::Flush(void)
@@ -258,20 +375,23 @@ int cNetSocket::Read(unsigned char *data, int len, int timeout)
     }
   int cnt=0, r;
   cTimeMs tim;
-  do {
-    r=timeout;
-    if(r>0 && blockmode) { r-=tim.Elapsed(); if(r<10) r=10; }
-    r=Select(true,r);
+  while(sd>=0) {
+    do { r=read(sd,data+cnt,len-cnt); } while(r<0 && errno==EINTR);
     if(r>0) {
-      do { r=read(sd,data+cnt,len-cnt); } while(r<0 && errno==EINTR);
-      if(r<0) PRINTF(L_GEN_ERROR,"socket: read failed: %s",*StrError(errno));
-      else if(r>0) cnt+=r;
-      else {
-        PRINTF(L_GEN_ERROR,"socket: EOF on read");
-        errno=ECONNRESET;
-        }
+      cnt+=r;
+      if(cnt>=len || !blockmode) break;
+      }
+    else if(r==0) {
+      PRINTF(L_GEN_ERROR,"socket: EOF on read");
+      errno=ECONNRESET;
+      break;
       }
-    } while(r>0 && cnt<len && blockmode);
+    else if(errno!=EAGAIN && errno!=EWOULDBLOCK) {
+      PRINTF(L_GEN_ERROR,"socket: read failed: %s",*StrError(errno));
+      break;
+      }
+    else if(Wait(true,timeout>0 ? max(timeout-(int)tim.Elapsed(),1):timeout)<=0) break;
+    }
   Activity();
   if((!blockmode && cnt>0) || cnt>=len) {
     HEXDUMP(L_CORE_NETDATA,data,cnt,"network read");
@@ -286,16 +406,15 @@ int cNetSocket::Write(const unsigned char *data, int len, int timeout)
   if(timeout<0) timeout=rwTimeout;
   int cnt=0, r;
   cTimeMs tim;
-  do {
-    r=timeout;
-    if(r>0) { r-=tim.Elapsed(); if(r<10) r=10; }
-    r=Select(false,r);
-    if(r>0) {
-      do { r=write(sd,data+cnt,len-cnt); } while(r<0 && errno==EINTR);
-      if(r<0) PRINTF(L_GEN_ERROR,"socket: write failed: %s",*StrError(errno));
-      else if(r>0) cnt+=r;
+  while(sd>=0 && cnt<len) {
+    do { r=write(sd,data+cnt,len-cnt); } while(r<0 && errno==EINTR);
+    if(r>0) cnt+=r;
+    else if(r<0 && errno!=EAGAIN && errno!=EWOULDBLOCK) {
+      PRINTF(L_GEN_ERROR,"socket: write failed: %s",*StrError(errno));
+      break;
       }
-    } while(r>0 && cnt<len);
+    else if(Wait(false,timeout>0 ? max(timeout-(int)tim.Elapsed(),1):timeout)<=0) break;
+    }
   Activity();
   if(cnt>=len) {
     HEXDUMP(L_CORE_NETDATA,data,cnt,"network write");
@@ -308,20 +427,19 @@ int cNetSocket::SendTo(const char *Host, int Port, const unsigned char *data, in
 {
   cMutexLock lock(this);
   if(timeout<0) timeout=rwTimeout;
-  int cnt=0, r=-1;
+  int cnt=0, r;
   struct sockaddr_in saddr;
   if(GetAddr(&saddr,Host,Port)) {
     cTimeMs tim;
-    do {
-      r=timeout;
-      if(r>0) { r-=tim.Elapsed(); if(r<10) r=10; }
-      r=Select(false,r);
-      if(r>0) {
-        do { r=sendto(sd,data+cnt,len-cnt,0,(struct sockaddr *)&saddr,sizeof(saddr)); } while(r<0 && errno==EINTR);
-        if(r<0) PRINTF(L_GEN_ERROR,"socket: sendto %d.%d.%d.%d:%d failed: %s",(saddr.sin_addr.s_addr>> 0)&0xff,(saddr.sin_addr.s_addr>> 8)&0xff,(saddr.sin_addr.s_addr>>16)&0xff,(saddr.sin_addr.s_addr>>24)&0xff,Port,*StrError(errno));
-        else if(r>0) cnt+=r;
+    while(sd>=0 && cnt<len) {
+      do { r=sendto(sd,data+cnt,len-cnt,0,(struct sockaddr *)&saddr,sizeof(saddr)); } while(r<0 && errno==EINTR);
+      if(r>0) cnt+=r;
+      else if(r<0 && errno!=EAGAIN && errno!=EWOULDBLOCK) {
+        PRINTF(L_GEN_ERROR,"socket: sendto %d.%d.%d.%d:%d failed: %s",(saddr.sin_addr.s_addr>> 0)&0xff,(saddr.sin_addr.s_addr>> 8)&0xff,(saddr.sin_addr.s_addr>>16)&0xff,(saddr.sin_addr.s_addr>>24)&0xff,Port,*StrError(errno));
+        break;
         }
-      } while(r>0 && cnt<len);
+      else if(Wait(false,timeout>0 ? max(timeout-(int)tim.Elapsed(),1):timeout)<=0) break;
+      }
     }
   Activity();
   if(cnt>=len) {
@@ -331,41 +449,37 @@ int cNetSocket::SendTo(const char *Host, int Port, const unsigned char *data, in
   return -1;
 }
 
-int cNetSocket::Select(bool forRead, int timeout)
+// Waits until the socket gets ready or the timeout (ms) expires. Must be
+// called with the socket locked, after the I/O returned EAGAIN. The lock is
+// released while waiting on the reactor, so other threads may use the socket
+// meanwhile. Sockets not (yet) registered with the reactor are polled.
+int cNetSocket::Wait(bool forRead, int timeout)
 {
-  if(sd>=0) {
-    fd_set fds;
-    struct timeval tv;
-
-    if(timeout>0 && timeout<60)
-      PRINTF(L_GEN_DEBUG,"socket: internal: small timeout value %d",timeout);
-
-    int r;
-
-    while(true) {
-	FD_ZERO(&fds); 
-	FD_SET(sd,&fds);
-	tv.tv_sec=timeout/1000; 
-	tv.tv_usec=0;
-
-	r=select(sd+1,forRead ? &fds:0,forRead ? 0:&fds,0,&tv);
-	
-	if (( r>=0) || (errno !=EINTR))
-		break;
-    }
-
-    if(r>0) 
-    	return 1;
-    else if(r<0) {
-      PRINTF(L_GEN_ERROR,"socket: select failed: %s",*StrError(errno));
-      return -1;
-    }
+  if(sd<0) { errno=ECONNRESET; return -1; }
+  if(timeout>0 && timeout<60)
+    PRINTF(L_GEN_DEBUG,"socket: internal: small timeout value %d",timeout);
+  int r=0;
+  if(timeout>0) {
+    int &w=forRead ? rdWaiters:wrWaiters;
+    w++;
+    if(nw.Arm(this)) {
+      r=ready.TimedWait(*this,timeout) ? 1:0;
+      w--;
+      if(sd<0) { errno=ECONNRESET; return -1; }
+      }
     else {
-      if(timeout>0 && !quietlog) PRINTF(L_CORE_NET,"socket: select timed out (%d ms)",timeout);
-      errno=ETIMEDOUT;
-      return 0;
+      w--;
+      struct pollfd pfd;
+      pfd.fd=sd; pfd.events=forRead ? POLLIN:POLLOUT;
+      do { r=poll(&pfd,1,timeout); } while(r<0 && errno==EINTR);
+      if(r<0) {
+        PRINTF(L_GEN_ERROR,"socket: poll failed: %s",*StrError(errno));
+        return -1;
+        }
+      }
     }
-  }
-  return -1;
+  if(r>0) return 1;
+  if(timeout>0 && !quietlog) PRINTF(L_CORE_NET,"socket: wait timed out (%d ms)",timeout);
+  errno=ETIMEDOUT;
+  return 0;
 }
-
@@ -31,18 +31,20 @@ extern int netTimeout;
 
 // ----------------------------------------------------------------
 
-class cNetWatcher;
+class cNetReactor;
 
 class cNetSocket : public cSimpleItem, private cMutex {
-friend class cNetWatcher;
+friend class cNetReactor;
 private:
   int sd;
   char *hostname;
   int port, dummy, conTimeout, rwTimeout, idleTimeout;
   bool udp, connected, quietlog;
-  cTimeMs activity;
+  uint64_t idleAt, regId;
+  int rdWaiters, wrWaiters;
+  cCondVar ready;
   //
-  int Select(bool forRead, int timeout);
+  int Wait(bool forRead, int timeout);
   void Activity(void);
   bool GetAddr(struct sockaddr_in *saddr, const char *Hostname, int Port);
   int GetSocket(bool Udp);
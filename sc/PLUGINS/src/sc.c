@@ -547,6 +547,7 @@ bool cSoftCAM::Load(const char *cfgdir)
 
 void cSoftCAM::Shutdown(void)
 {
+  reactors.Shutdown();
   cStructLoaders::Save(true);
   cSystems::Clean();
   smartcards.Shutdown();
@@ -1238,13 +1239,17 @@ cScPlugin::cScPlugin(void)
   ScOpts->Add(new cOptSel  ("EcmCache"     ,trNOOP("ECM cache")            ,&ScSetup.EcmCache,3,ecache));
   ScOpts->Add(new cOptInt  ("DeCsaTsBuffSize",trNOOP("TS buffer size MB")  ,&ScSetup.DeCsaTsBuffSize,4,15));
   ScOpts->Add(new cOptMInt ("ScCaps"       ,trNOOP("Active on DVB card")   , ScSetup.ScCaps,MAXSCCAPS,0));
-  LogOpts=new cOpts(0,6);
+  LogOpts=new cOpts(0,10);
   LogOpts->Add(new cOptBool ("LogConsole"  ,trNOOP("Log to console")      ,&logcfg.logCon));
   LogOpts->Add(new cOptBool ("LogFile"     ,trNOOP("Log to file")         ,&logcfg.logFile));
   LogOpts->Add(new cOptStr  ("LogFileName" ,trNOOP("Filename")            ,logcfg.logFilename,sizeof(logcfg.logFilename),FileNameChars));
   LogOpts->Add(new cOptInt  ("LogFileLimit",trNOOP("Filesize limit (KB)") ,&logcfg.maxFilesize,0,2000000));
   LogOpts->Add(new cOptBool ("LogSyslog"   ,trNOOP("Log to syslog")       ,&logcfg.logSys));
   LogOpts->Add(new cOptBool ("LogUserMsg"  ,trNOOP("Show user messages")  ,&logcfg.logUser));
+  LogOpts->Add(new cOptBool ("LogAsync"    ,trNOOP("Log in background")   ,&logcfg.logAsync));
+  LogOpts->Add(new cOptBool ("LogTrace"    ,trNOOP("Binary trace of dumps"),&logcfg.logTrace));
+  LogOpts->Add(new cOptStr  ("LogTraceName",trNOOP("Trace filename")      ,logcfg.traceFilename,sizeof(logcfg.traceFilename),FileNameChars));
+  LogOpts->Add(new cOptInt  ("LogTraceSize",trNOOP("Trace size (KB)")     ,&logcfg.maxTracesize,64,2000000));
 #ifndef STATICBUILD
   dllSuccess=dlls.Load();
 #else
@@ -1283,6 +1288,7 @@ bool cScPlugin::Start(void)
     }
     
   ScPlugin=this;
+  cLogging::StartWriter();
   const char *cfgdir=ConfigDirectory(cfgsub);
   filemaps.SetCfgDir(cfgdir);
   cStructLoaders::SetCfgDir(cfgdir);
@@ -1300,6 +1306,7 @@ void cScPlugin::Stop(void)
   LogStatsDown();
   cSoftCAM::Shutdown();
   PRINTF(L_GEN_INFO,"SC cleanup done, ready to go down");
+  cLogging::StopWriter();
 }
 
 const char *cScPlugin::Version(void)
@@ -1384,6 +1391,10 @@ const char **cScPlugin::SVDRPHelpPages(void)
     "    Display available message classes and their status.",
     "LOGFILE <on|off> [<filename>]\n"
     "    Enables/disables logging to file and optionaly sets the filename.",
+    "TIMING\n"
+    "    Display crypto period and CW margin statistics of the ECM handlers.",
+    "CARDQUEUE\n"
+    "    Display request and wait time statistics of the cardslots.",
     NULL
     };
   return HelpPages;
@@ -1460,6 +1471,31 @@ cString cScPlugin::SVDRPCommand(const char *Command, const char *Option, int &Re
     if(lb.Length()>0) return lb.Line();
     ReplyCode=901; return "No config available";
     }
+  else if(!strcasecmp(Command,"TIMING")) {
+    cLineBuff lb(256);
+    int d=0, n;
+    do {
+      n=0;
+      char *str;
+      const char *id;
+      while((str=cGlobal::TimingStr(d,n,&id))) {
+        lb.Printf("%s.%d: %s\n",id,n,str);
+        free(str);
+        n++;
+        }
+      d++;
+      } while(n>0);
+    if(lb.Length()>0) return lb.Line();
+    ReplyCode=901; return "No active ECM handler";
+    }
+  else if(!strcasecmp(Command,"CARDQUEUE")) {
+    cLineBuff lb(256);
+    char str[256];
+    for(int i=0; smartcards.QueueInfo(i,str,sizeof(str)); i++)
+      lb.Printf("%d: %s\n",i,str);
+    if(lb.Length()>0) return lb.Line();
+    ReplyCode=901; return "No cardslots";
+    }
   else if(!strcasecmp(Command,"LOGFILE")){
     if(Option && *Option) {
       char tmp[1024];
@@ -44,13 +44,28 @@
 
 // -- cSmartCardSlot -----------------------------------------------------------
 
+struct CardWaiter {
+  struct CardWaiter *next;
+  int pri;
+  uint64_t deadline, seq;
+  };
+
+struct CardQueueStat {
+  int count, depth, maxDepth, late;
+  int waitMax;
+  uint64_t waitSum;
+  };
+
 class cSmartCardSlot : private cThread, public cStructItem {
 private:
   cSmartCard *card;
   int usecount, cardid;
-  bool firstRun, needsReset, dead;
+  bool firstRun, needsReset, dead, owned;
   cMutex mutex;
   cCondVar cond;
+  struct CardWaiter *waiters;
+  uint64_t waitSeq;
+  struct CardQueueStat qstat[SC_PRI_MAX];
   //
   void SetCard(cSmartCard *c, int cid=0);
   bool CardReset(void);
@@ -60,6 +75,7 @@ protected:
   virtual bool DeviceSetMode(int mode, int baud)=0;
   virtual int DeviceRead(unsigned char *mem, int len, int timeout, int initialTimeout=0)=0;
   virtual int DeviceWrite(const unsigned char *mem, int len, int delay=0)=0;
+  virtual int DeviceWriteEcho(const unsigned char *mem, int len, int delay, int timeout);
   virtual void DeviceToggleReset(void)=0;
   virtual bool DevicePTS(void)=0;
   virtual bool DeviceIsInserted(void)=0;
@@ -90,10 +106,11 @@ public:
   void SetCardConfig(const struct CardConfig *Cfg) { cfg=Cfg; }
   void TriggerReset(void) { needsReset=true; }
   bool HaveCard(int id);
-  cSmartCard *LockCard(int id);
+  cSmartCard *LockCard(int id, int pri, uint64_t deadline);
   void ReleaseCard(cSmartCard *sc);
   void GetCardIdStr(char *str, int len);
   bool GetCardInfoStr(char *str, int len);
+  void GetQueueStr(char *str, int len);
   int SlotNum(void) { return slotnum; }
   //
   virtual bool IsoRead(const unsigned char *cmd, unsigned char *data);
@@ -107,8 +124,10 @@ static const char *serModes[] = { 0,"8e2","8o2","8n2" };
 cSmartCardSlot::cSmartCardSlot(void)
 {
   card=0; cfg=0; usecount=0; slotnum=-1; currMode=SM_NONE; clock=ISO_FREQ;
-  firstRun=true; needsReset=false; dead=false;
+  firstRun=true; needsReset=false; dead=false; owned=false;
   localecho=true; singlereset=false;
+  waiters=0; waitSeq=0;
+  memset(qstat,0,sizeof(qstat));
 }
 
 cSmartCardSlot::~cSmartCardSlot()
@@ -137,18 +156,44 @@ bool cSmartCardSlot::HaveCard(int id)
   return card && cardid==id;
 }
 
-cSmartCard *cSmartCardSlot::LockCard(int id)
+// Users are served by priority (ECM before EMM before anything else), ECMs
+// among themselves by deadline, everything else in arrival order.
+cSmartCard *cSmartCardSlot::LockCard(int id, int pri, uint64_t deadline)
 {
   mutex.Lock();
   while(Running() && firstRun) cond.Wait(mutex);
   if(card && cardid==id) {
     usecount++;
+    if(pri<0 || pri>=SC_PRI_MAX) pri=SC_PRI_INFO;
+    struct CardQueueStat *st=&qstat[pri];
+    int wait=0;
+    if(owned || waiters) {
+      struct CardWaiter w;
+      w.pri=pri; w.deadline=deadline ? deadline : ~(uint64_t)0; w.seq=waitSeq++;
+      struct CardWaiter **pw=&waiters;
+      while(*pw && ((*pw)->pri<w.pri || ((*pw)->pri==w.pri && ((*pw)->deadline<w.deadline
+                    || ((*pw)->deadline==w.deadline && (*pw)->seq<w.seq)))))
+        pw=&(*pw)->next;
+      w.next=*pw; *pw=&w;
+      if(++st->depth>st->maxDepth) st->maxDepth=st->depth;
+      cTimeMs start;
+      while(owned || waiters!=&w) cond.Wait(mutex);
+      waiters=w.next;
+      st->depth--;
+      wait=start.Elapsed();
+      }
+    owned=true;
+    st->count++; st->waitSum+=wait;
+    if(wait>st->waitMax) st->waitMax=wait;
+    if(deadline && cTimeMs::Now()>deadline) st->late++;
+    if(wait>=100) PRINTF(L_CORE_SC,"%d: %s waited %d ms for the card",slotnum,pri==SC_PRI_ECM?"ECM":pri==SC_PRI_EMM?"EMM":"request",wait);
     mutex.Unlock();
     card->Lock();
     if(DeviceIsInserted() && card->CardUp() && !needsReset) return card;
     // if failed, unlock the card and decrement UseCount
     card->Unlock();
     mutex.Lock();
+    owned=false;
     usecount--;
     cond.Broadcast();
     }
@@ -161,12 +206,29 @@ void cSmartCardSlot::ReleaseCard(cSmartCard *sc)
   if(card==sc) {
     card->Unlock();
     mutex.Lock();
+    owned=false;
     usecount--;
     cond.Broadcast();
     mutex.Unlock();
     }
 }
 
+void cSmartCardSlot::GetQueueStr(char *str, int len)
+{
+  static const char *names[SC_PRI_MAX] = { "ecm","emm","info" };
+  cMutexLock lock(&mutex);
+  int q=0;
+  str[0]=0;
+  for(int i=0; i<SC_PRI_MAX && q<len; i++) {
+    const struct CardQueueStat *st=&qstat[i];
+    q+=snprintf(str+q,len-q,"%s%s %d (wait avg %d max %d ms, queued %d max %d",
+                q?", ":"",names[i],st->count,st->count ? (int)(st->waitSum/st->count):0,
+                st->waitMax,st->depth,st->maxDepth);
+    if(q<len && i==SC_PRI_ECM) q+=snprintf(str+q,len-q,", %d late",st->late);
+    if(q<len) q+=snprintf(str+q,len-q,")");
+    }
+}
+
 void cSmartCardSlot::GetCardIdStr(char *str, int len)
 {
   mutex.Lock();
@@ -308,10 +370,16 @@ int cSmartCardSlot::Write(const unsigned char *data, int len)
     Invert(tmp,len);
     data=tmp;
     }
-  int r=DeviceWrite(data,len,cfg->serDL);
-  if(r>0 && localecho) {
+  if(localecho) return DeviceWriteEcho(data,len,cfg->serDL,cfg->serTO);
+  return DeviceWrite(data,len,cfg->serDL);
+}
+
+int cSmartCardSlot::DeviceWriteEcho(const unsigned char *mem, int len, int delay, int timeout)
+{
+  int r=DeviceWrite(mem,len,delay);
+  if(r>0) {
     unsigned char *buff=AUTOMEM(r);
-    int rr=DeviceRead(buff,r,cfg->serTO);
+    int rr=DeviceRead(buff,r,timeout);
     if(rr<0) r=rr;
     }
   return r;
@@ -653,12 +721,15 @@ class cSmartCardSlotSerial : public cSmartCardSlot {
 private:
   int statInv, invRST;
   bool custombaud;
+  int etuNs, charNs;
   //
   speed_t FindBaud(int baud);
+  int Transfer(const unsigned char *mem, int len, int delay, int echoTimeout);
 protected:
   int fd;
   //
-  void Flush(void);
+  void Flush(int queue=TCIOFLUSH);
+  void SetTiming(int mode, int baud);
   void SetDtrRts(void);
   //
   virtual bool DeviceOpen(const char *cfg);
@@ -666,6 +737,7 @@ protected:
   virtual bool DeviceSetMode(int mode, int baud);
   virtual int DeviceRead(unsigned char *mem, int len, int timeout, int initialTimeout=0);
   virtual int DeviceWrite(const unsigned char *mem, int len, int delay=0);
+  virtual int DeviceWriteEcho(const unsigned char *mem, int len, int delay, int timeout);
   virtual void DeviceToggleReset(void);
   virtual bool DevicePTS(void);
   virtual bool DeviceIsInserted(void);
@@ -678,6 +750,7 @@ static cSmartCardSlotLinkReg<cSmartCardSlotSerial> __scs_serial("serial");
 cSmartCardSlotSerial::cSmartCardSlotSerial(void)
 {
   fd=-1; statInv=0; invRST=false; custombaud=false;
+  etuNs=1000000000/ISO_BAUD; charNs=12*etuNs;
 }
 
 bool cSmartCardSlotSerial::DeviceOpen(const char *cfg)
@@ -721,9 +794,21 @@ void cSmartCardSlotSerial::DeviceClose(void)
     }
 }
 
-void cSmartCardSlotSerial::Flush(void)
+void cSmartCardSlotSerial::Flush(int queue)
+{
+  if(fd>=0) CHECK(tcflush(fd,queue));
+}
+
+// time for one character on the line: start bit, 8 data, parity, stop bits
+static int CharNs(int mode, int baud)
 {
-  if(fd>=0) CHECK(tcflush(fd,TCIOFLUSH));
+  return (1000000000/baud)*(1+8+((mode&SM_MASK)!=SM_8N2 ? 1:0)+((mode&SM_1SB) ? 1:2));
+}
+
+void cSmartCardSlotSerial::SetTiming(int mode, int baud)
+{
+  etuNs=1000000000/baud;
+  charNs=CharNs(mode,baud);
 }
 
 speed_t cSmartCardSlotSerial::FindBaud(int baud)
@@ -787,14 +872,24 @@ bool cSmartCardSlotSerial::DeviceSetMode(int mode, int baud)
       PRINTF(L_CORE_SERIAL,"%s: get serial failed: %s",devName,strerror(errno));
       PRINTF(L_CORE_SERIAL,"%s: custombaud not used, try to continue...",devName);
       }
-    else if(!custom && ((s.flags&ASYNC_SPD_MASK)==ASYNC_SPD_CUST || s.custom_divisor!=0)) {
-      s.custom_divisor=0;
-      s.flags &= ~ASYNC_SPD_MASK;
-      if(ioctl(fd,TIOCSSERIAL,&s)<0) {
-        PRINTF(L_GEN_ERROR,"%s: set serial failed: %s",devName,strerror(errno));
-        return false;
+    else {
+      if(!custom && ((s.flags&ASYNC_SPD_MASK)==ASYNC_SPD_CUST || s.custom_divisor!=0)) {
+        s.custom_divisor=0;
+        s.flags &= ~ASYNC_SPD_MASK;
+        if(ioctl(fd,TIOCSSERIAL,&s)<0) {
+          PRINTF(L_GEN_ERROR,"%s: set serial failed: %s",devName,strerror(errno));
+          return false;
+          }
+        custombaud=false;
+        }
+      // push received bytes to us at once instead of on the next tty tick
+      if(!(s.flags&ASYNC_LOW_LATENCY)) {
+        s.flags |= ASYNC_LOW_LATENCY;
+        if(ioctl(fd,TIOCSSERIAL,&s)<0) {
+          PRINTF(L_CORE_SERIAL,"%s: low latency mode not available: %s",devName,strerror(errno));
+          s.flags &= ~ASYNC_LOW_LATENCY;
+          }
         }
-      custombaud=false;
       }
     if(!tcsetattr(fd,TCSANOW,&tio)) {
       if(custom) {
@@ -807,6 +902,7 @@ bool cSmartCardSlotSerial::DeviceSetMode(int mode, int baud)
           }
         custombaud=true;
         }
+      SetTiming(mode,baud);
       currMode=mode; Flush();
       return true;
       }
@@ -854,33 +950,85 @@ int cSmartCardSlotSerial::DeviceRead(unsigned char *mem, int len, int timeout, i
 
 int cSmartCardSlotSerial::DeviceWrite(const unsigned char *mem, int len, int delay)
 {
-  PRINTF(L_CORE_SERIAL,"%s: write len=%d delay=%d",devName,len,delay);
+  return Transfer(mem,len,delay,-1);
+}
+
+int cSmartCardSlotSerial::DeviceWriteEcho(const unsigned char *mem, int len, int delay, int timeout)
+{
+  return Transfer(mem,len,delay,timeout);
+}
+
+static inline uint64_t MonoNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+// Writes mem and, if echoTimeout>=0, reads back the local echo while
+// writing. Bytes are paced on a fixed schedule if the card needs a delay or
+// an extra guard time (N from the ATR), otherwise written in one go.
+int cSmartCardSlotSerial::Transfer(const unsigned char *mem, int len, int delay, int echoTimeout)
+{
+  PRINTF(L_CORE_SERIAL,"%s: write len=%d delay=%d echo=%d",devName,len,delay,echoTimeout);
   HEXDUMP(L_CORE_SERIAL,mem,len,"%s: write data",devName);
-  Flush();
+  // only stale input matters, the output queue is drained after each write
+  Flush(TCIFLUSH);
+  uint64_t spacing=0;
+  if(delay>0) spacing=(uint64_t)delay*1000000;
+  else if(atr.N>0 && atr.N<255) spacing=charNs+(uint64_t)atr.N*etuNs;
+  int echoLeft=echoTimeout>=0 ? len:0;
   int n=0;
-  while(n<len) {
+  uint64_t now=MonoNs(), start=now, idle=now;
+  while(n<len || echoLeft>0) {
     struct pollfd u;
-    u.fd=fd; u.events=POLLOUT;
-    int r;
-    do {
-      r=poll(&u,1,500);
-      if(r<0) {
-        PRINTF(L_GEN_ERROR,"%s: write poll failed: %s",devName,strerror(errno));
+    u.fd=fd; u.events=echoLeft>0 ? POLLIN:0;
+    uint64_t due=0;
+    if(n<len) {
+      due=start+n*spacing;
+      if(now>=due) u.events|=POLLOUT;
+      }
+    uint64_t limit=idle+(uint64_t)(n<len ? max(echoTimeout,500):echoTimeout)*1000000+(n<len ? spacing:0);
+    uint64_t wake=(n<len && !(u.events&POLLOUT) && due<limit) ? due:limit;
+    struct timespec ts;
+    ts.tv_sec=0; ts.tv_nsec=0;
+    if(wake>now) { ts.tv_sec=(wake-now)/1000000000; ts.tv_nsec=(wake-now)%1000000000; }
+    int r=ppoll(&u,1,&ts,0);
+    if(r<0) {
+      if(errno==EINTR) { now=MonoNs(); continue; }
+      PRINTF(L_GEN_ERROR,"%s: write poll failed: %s",devName,strerror(errno));
+      return -1;
+      }
+    now=MonoNs();
+    if(r==0) {
+      if(now<limit) continue; // pacing wakeup
+      if(n<len) PRINTF(L_CORE_SERIAL,"%s: write timeout",devName);
+      else PRINTF(L_CORE_SERIAL,"%s: echo timeout (%d ms, %d missing)",devName,echoTimeout,echoLeft);
+      return -2;
+      }
+    if(u.revents&POLLOUT) {
+      r=write(fd,mem+n,spacing ? 1:len-n);
+      if(r<0 && errno!=EAGAIN) {
+        PRINTF(L_GEN_ERROR,"%s: write failed: %s",devName,strerror(errno));
         return -1;
         }
-      else if(r==0) { // timeout
-        PRINTF(L_CORE_SERIAL,"%s: write timeout",devName);
-        return -2;
-        }
-      } while(r<1);
-    r=write(fd,mem+n,delay>0?1:len-n);
-    if(r<0 && errno!=EAGAIN) {
-      PRINTF(L_GEN_ERROR,"%s: write failed: %s",devName,strerror(errno));
+      if(r>0) { n+=r; idle=now; }
+      }
+    if((u.revents&(POLLERR|POLLHUP|POLLNVAL)) && !(u.revents&POLLIN)) {
+      PRINTF(L_GEN_ERROR,"%s: write poll failed: revents 0x%x",devName,u.revents);
       return -1;
       }
-    if(r>0) n+=r;
-    if(delay>0) cCondWait::SleepMs(delay);
+    if(u.revents&POLLIN) {
+      unsigned char buff[64];
+      r=read(fd,buff,min(echoLeft,(int)sizeof(buff)));
+      if(r<0 && errno!=EAGAIN) {
+        PRINTF(L_GEN_ERROR,"%s: echo read failed: %s",devName,strerror(errno));
+        return -1;
+        }
+      if(r>0) { echoLeft-=r; idle=now; }
+      }
     }
+  if(echoTimeout>=0) PRINTF(L_CORE_SERIAL,"%s: echo complete after %d us",devName,(int)((now-start)/1000));
   return n;
 }
 
@@ -1066,6 +1214,353 @@ bool cSmartCardSlotSRPlus::SRConfig(int F, float D, int fs, int N, int T, int in
   return true;
 }
 
+// -- cCardSim -----------------------------------------------------------------
+
+// Scripted card behind a pty, to benchmark and test the card path without
+// hardware. The host side is a normal serial slot, so the complete
+// read/write/echo/PTS code is used. Script directives, one per line:
+//
+//   atr <hex>                 answer to reset
+//   delay <us>                extra time per response byte
+//   jitter <us>               random extra time per response byte (0..jitter)
+//   wait <us>                 card processing time before a response, for
+//                             all following rules
+//   read <hdr> = <data> <sw>  T0 command, data from card
+//   write <hdr> = <sw>        T0 command, data to card
+//   block <blk> = <blk>       T1 block, both without EDC (LRC is appended)
+//
+// Patterns match as prefix and may contain ?? as wildcard. Unknown T0
+// commands are answered with 6D 00. Response bytes are paced at the line
+// speed set by the host.
+
+#define SIM_MAX 300
+
+#define SR_READ  0
+#define SR_WRITE 1
+#define SR_BLOCK 2
+
+class cSimRule : public cSimpleItem {
+public:
+  int type, wait, plen, rlen;
+  unsigned char pat[SIM_MAX], mask[SIM_MAX], resp[SIM_MAX];
+  };
+
+class cCardSim : public cThread {
+private:
+  int fd, delay, jitter, charNs, atrLen;
+  unsigned int seed;
+  unsigned char atr[MAX_ATR_LEN];
+  bool t1;
+  cSimpleList<cSimRule> rules;
+  cMutex mutex;
+  unsigned char in[SIM_MAX];
+  int inLen, need;
+  cSimRule *pending;
+  //
+  static int Hex(const char *s, unsigned char *data, unsigned char *mask, int max);
+  cSimRule *Match(int type, const unsigned char *data, int len);
+  void Send(const unsigned char *data, int len, int wait=0);
+  void Consume(int n);
+  void Process(void);
+protected:
+  virtual void Action(void);
+public:
+  cCardSim(int Fd, int Delay, int Jitter);
+  ~cCardSim();
+  bool Load(const char *script);
+  void SetMode(int mode, int baud);
+  void Reset(void);
+  bool HasAtr(void) const { return atrLen>0; }
+  };
+
+cCardSim::cCardSim(int Fd, int Delay, int Jitter)
+:cThread("card simulator")
+{
+  fd=Fd; delay=max(Delay,0); jitter=max(Jitter,0); seed=1;
+  charNs=CharNs(SM_8E2,ISO_BAUD);
+  atrLen=0; t1=false;
+  inLen=need=0; pending=0;
+}
+
+cCardSim::~cCardSim()
+{
+  Cancel(2);
+  close(fd);
+}
+
+int cCardSim::Hex(const char *s, unsigned char *data, unsigned char *mask, int max)
+{
+  int n=0;
+  while(*(s=skipspace(s))) {
+    if(n>=max) return -1;
+    if(s[0]=='?' && s[1]=='?' && mask) { data[n]=0; mask[n]=0; }
+    else if(isxdigit(s[0]) && isxdigit(s[1])) {
+      char h[3]={ s[0],s[1],0 };
+      data[n]=strtol(h,0,16);
+      if(mask) mask[n]=0xFF;
+      }
+    else return -1;
+    n++; s+=2;
+    }
+  return n;
+}
+
+bool cCardSim::Load(const char *script)
+{
+  FILE *f=fopen(script,"r");
+  if(!f) {
+    PRINTF(L_GEN_ERROR,"sim: can't open script %s: %s",script,strerror(errno));
+    return false;
+    }
+  char line[1024];
+  int lnum=0, wait=0;
+  bool ok=true;
+  while(ok && fgets(line,sizeof(line),f)) {
+    lnum++;
+    char *p=skipspace(stripspace(line)), key[16];
+    int n;
+    if(!*p || *p=='#' || *p==';') continue;
+    if(sscanf(p,"%15s %n",key,&n)!=1) continue;
+    p+=n;
+    if(!strcasecmp(key,"atr")) ok=(atrLen=Hex(p,atr,0,sizeof(atr)))>=2;
+    else if(!strcasecmp(key,"delay")) delay=atoi(p);
+    else if(!strcasecmp(key,"jitter")) jitter=atoi(p);
+    else if(!strcasecmp(key,"wait")) wait=atoi(p);
+    else {
+      cSimRule *r=new cSimRule;
+      char *e=strchr(p,'=');
+      if(!strcasecmp(key,"read")) r->type=SR_READ;
+      else if(!strcasecmp(key,"write")) r->type=SR_WRITE;
+      else if(!strcasecmp(key,"block")) { r->type=SR_BLOCK; t1=true; }
+      else e=0;
+      if(e) {
+        *e=0;
+        r->wait=wait;
+        r->plen=Hex(p,r->pat,r->mask,SIM_MAX);
+        r->rlen=Hex(e+1,r->resp,0,SIM_MAX-1);
+        }
+      if(e && r->plen>0 && r->rlen>=0) rules.Add(r);
+      else { delete r; ok=false; }
+      }
+    if(!ok) PRINTF(L_GEN_ERROR,"sim: %s:%d: bad line",script,lnum);
+    }
+  fclose(f);
+  if(ok && atrLen<=0) {
+    PRINTF(L_GEN_ERROR,"sim: %s: no ATR given",script);
+    ok=false;
+    }
+  if(ok) PRINTF(L_CORE_SC,"sim: loaded %d rules from %s (T=%d)",rules.Count(),script,t1?1:0);
+  return ok;
+}
+
+cSimRule *cCardSim::Match(int type, const unsigned char *data, int len)
+{
+  for(cSimRule *r=rules.First(); r; r=rules.Next(r)) {
+    if(r->type!=type || r->plen>len) continue;
+    int i;
+    for(i=0; i<r->plen; i++)
+      if((data[i]&r->mask[i])!=r->pat[i]) break;
+    if(i==r->plen) return r;
+    }
+  return 0;
+}
+
+void cCardSim::Send(const unsigned char *data, int len, int wait)
+{
+  uint64_t t=MonoNs()+(uint64_t)wait*1000;
+  for(int i=0; i<len; i++) {
+    t+=charNs+(uint64_t)delay*1000;
+    if(jitter>0) t+=(uint64_t)(rand_r(&seed)%jitter)*1000;
+    struct timespec ts;
+    ts.tv_sec=t/1000000000; ts.tv_nsec=t%1000000000;
+    while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,0)==EINTR);
+    if(write(fd,data+i,1)!=1) {
+      PRINTF(L_GEN_ERROR,"sim: write failed: %s",strerror(errno));
+      return;
+      }
+    }
+}
+
+void cCardSim::Consume(int n)
+{
+  inLen-=n;
+  memmove(in,in+n,inLen);
+}
+
+void cCardSim::Process(void)
+{
+  unsigned char buff[SIM_MAX+1];
+  while(inLen>0) {
+    if(pending) { // T0 data phase
+      if(inLen<need) return;
+      Consume(need);
+      Send(pending->resp,pending->rlen,pending->wait);
+      pending=0; need=0;
+      }
+    else if(t1) {
+      if(inLen<3 || inLen<3+in[2]+1) return;
+      int blen=3+in[2];
+      cSimRule *r=Match(SR_BLOCK,in,blen);
+      if(r) {
+        memcpy(buff,r->resp,r->rlen);
+        buff[r->rlen]=XorSum(buff,r->rlen);
+        Send(buff,r->rlen+1,r->wait);
+        }
+      else LDUMP(L_CORE_SC,in,blen+1,"sim: no rule for block:");
+      Consume(blen+1);
+      }
+    else if(in[0]==0xFF) { // PTS, confirm as requested
+      if(inLen<4) return;
+      memcpy(buff,in,4);
+      Consume(4);
+      Send(buff,4);
+      }
+    else {
+      if(inLen<CMD_LEN) return;
+      unsigned char ins=in[INS_IDX];
+      cSimRule *r;
+      if((r=Match(SR_READ,in,CMD_LEN))) {
+        buff[0]=ins;
+        memcpy(buff+1,r->resp,r->rlen);
+        Send(buff,r->rlen+1,r->wait);
+        }
+      else if((r=Match(SR_WRITE,in,CMD_LEN))) {
+        Send(&ins,1);
+        if((need=in[LEN_IDX])>0) pending=r;
+        else Send(r->resp,r->rlen,r->wait);
+        }
+      else {
+        LDUMP(L_CORE_SC,in,CMD_LEN,"sim: no rule for command:");
+        static const unsigned char sw[] = { 0x6D,0x00 };
+        Send(sw,sizeof(sw));
+        }
+      Consume(CMD_LEN);
+      }
+    }
+}
+
+void cCardSim::SetMode(int mode, int baud)
+{
+  cMutexLock lock(&mutex);
+  charNs=CharNs(mode,baud);
+}
+
+void cCardSim::Reset(void)
+{
+  cMutexLock lock(&mutex);
+  inLen=need=0; pending=0;
+  tcflush(fd,TCIOFLUSH);
+  Send(atr,atrLen);
+}
+
+void cCardSim::Action(void)
+{
+  while(Running()) {
+    struct pollfd u;
+    u.fd=fd; u.events=POLLIN;
+    if(poll(&u,1,100)<=0) continue;
+    unsigned char buff[SIM_MAX];
+    int r=read(fd,buff,sizeof(buff));
+    if(r<=0) {
+      if(r<0 && errno!=EAGAIN && errno!=EINTR) cCondWait::SleepMs(100); // slave not open
+      continue;
+      }
+    // local echo of the reader
+    if(write(fd,buff,r)!=r) PRINTF(L_GEN_ERROR,"sim: echo failed: %s",strerror(errno));
+    cMutexLock lock(&mutex);
+    if(inLen+r>(int)sizeof(in)) {
+      PRINTF(L_GEN_ERROR,"sim: input overflow");
+      inLen=need=0; pending=0;
+      continue;
+      }
+    memcpy(in+inLen,buff,r); inLen+=r;
+    Process();
+    }
+}
+
+// -- cSmartCardSlotSim --------------------------------------------------------
+
+class cSmartCardSlotSim : public cSmartCardSlotSerial {
+private:
+  cCardSim *sim;
+  bool rst;
+protected:
+  virtual bool DeviceOpen(const char *cfg);
+  virtual void DeviceClose(void);
+  virtual bool DeviceSetMode(int mode, int baud);
+  virtual void DeviceToggleReset(void);
+  virtual bool DeviceIsInserted(void);
+public:
+  cSmartCardSlotSim(void);
+  };
+
+static cSmartCardSlotLinkReg<cSmartCardSlotSim> __scs_sim("sim");
+
+cSmartCardSlotSim::cSmartCardSlotSim(void)
+{
+  sim=0; rst=false;
+}
+
+bool cSmartCardSlotSim::DeviceOpen(const char *cfg)
+{
+  char script[256];
+  int delay=0, jitter=0;
+  if(sscanf(cfg,"%255[^:]:%d:%d",script,&delay,&jitter)>=1) {
+    int master=posix_openpt(O_RDWR|O_NOCTTY);
+    if(master<0 || grantpt(master)<0 || unlockpt(master)<0 || ptsname_r(master,devName,sizeof(devName))) {
+      PRINTF(L_GEN_ERROR,"sim: can't create pty: %s",strerror(errno));
+      if(master>=0) close(master);
+      return false;
+      }
+    sim=new cCardSim(master,delay,jitter);
+    fd=open(devName,O_RDWR|O_NONBLOCK|O_NOCTTY);
+    if(fd<0) {
+      PRINTF(L_GEN_ERROR,"%s: open failed: %s",devName,strerror(errno));
+      DeviceClose();
+      return false;
+      }
+    struct termios tio;
+    if(!tcgetattr(fd,&tio)) { cfmakeraw(&tio); tcsetattr(fd,TCSANOW,&tio); }
+    if(!sim->Load(script)) {
+      DeviceClose();
+      return false;
+      }
+    sim->Start();
+    PRINTF(L_CORE_LOAD,"cardslot: added simulated card %s on %s as port %d (delay %d us, jitter %d us)",
+              script,devName,slotnum,delay,jitter);
+    return true;
+    }
+  PRINTF(L_GEN_ERROR,"bad parameter for cardslot type 'sim'");
+  return false;
+}
+
+void cSmartCardSlotSim::DeviceClose(void)
+{
+  delete sim; sim=0;
+  if(fd>=0) { close(fd); fd=-1; }
+}
+
+bool cSmartCardSlotSim::DeviceSetMode(int mode, int baud)
+{
+  // a pty has no line speed, the simulator does the timing
+  if(!cSmartCardSlotSerial::DeviceSetMode(mode,ISO_BAUD)) return false;
+  SetTiming(mode,baud);
+  sim->SetMode(mode,baud);
+  return true;
+}
+
+void cSmartCardSlotSim::DeviceToggleReset(void)
+{
+  rst=!rst;
+  PRINTF(L_CORE_SERIAL,"%s: toggle reset, now %s",devName,rst?"on":"off");
+  if(!rst) sim->Reset();
+}
+
+bool cSmartCardSlotSim::DeviceIsInserted(void)
+{
+  return sim && sim->HasAtr();
+}
+
 // -- cSmartCardSlotCCID -------------------------------------------------------
 
 #ifdef WITH_PCSC
@@ -2051,11 +2546,11 @@ bool cSmartCards::HaveCard(int id)
   return res;
 }
 
-cSmartCard *cSmartCards::LockCard(int id)
+cSmartCard *cSmartCards::LockCard(int id, int pri, uint64_t deadline)
 {
   cSmartCard *sc=0;
   for(cSmartCardSlot *slot=cardslots.FirstSlot(); slot; slot=cardslots.Next(slot))
-    if((sc=slot->LockCard(id))) break;
+    if((sc=slot->LockCard(id,pri,deadline))) break;
   cardslots.Release();
   return sc;
 }
@@ -2087,6 +2582,16 @@ bool cSmartCards::CardInfo(int num, char *str, int len)
   return res;
 }
 
+bool cSmartCards::QueueInfo(int num, char *str, int len)
+{
+  cSmartCardSlot *slot=cardslots.GetSlot(num);
+  str[0]=0;
+  bool res=false;
+  if(slot) { slot->GetQueueStr(str,len); res=true; }
+  cardslots.Release();
+  return res;
+}
+
 void cSmartCards::CardReset(int num)
 {
   cSmartCardSlot *slot=cardslots.GetSlot(num);
@@ -38,6 +38,12 @@
 
 #define MAKE_SC_ID(a,b,c,d) (((a)<<24)+((b)<<16)+((c)<<8)+(d))
 
+// LockCard() priorities, lower value is served first
+#define SC_PRI_ECM  0
+#define SC_PRI_EMM  1
+#define SC_PRI_INFO 2
+#define SC_PRI_MAX  3
+
 // ----------------------------------------------------------------
 
 class cSmartCards;
@@ -135,6 +141,7 @@ public:
   virtual bool Decode(const cEcmInfo *ecm, const unsigned char *data, unsigned char *cw)=0;
   virtual bool Update(int pid, int caid, const unsigned char *data) { return false; }
   virtual bool CanHandle(unsigned short CaId) { return true; }
+  virtual bool AddEmmPid(cPids *pids, int caid, int pid, int sct, int mask) { return false; }
   //
   bool Setup(cSmartCardSlot *Slot, int sermode, const struct Atr *Atr, unsigned char *Sb);
   bool CardUp(void) { return cardUp; }
@@ -175,11 +182,12 @@ public:
   // to be called ONLY from a system class!
   cSmartCardData *FindCardData(cSmartCardData *param);
   bool HaveCard(int id);
-  cSmartCard *LockCard(int id);
+  cSmartCard *LockCard(int id, int pri=SC_PRI_INFO, uint64_t deadline=0);
   void ReleaseCard(cSmartCard *sc);
   // to be called ONLY from frontend thread!
   bool ListCard(int num, char *str, int len);
   bool CardInfo(int num, char *str, int len);
+  bool QueueInfo(int num, char *str, int len);
   void CardReset(int num);
   };
 
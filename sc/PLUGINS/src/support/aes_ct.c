@@ -0,0 +1,154 @@
+/*
+ * Constant time AES-128 for systems where openssl lacks AES.
+ *
+ * No table lookups and no branches depend on key or data. The S-box is
+ * computed as inversion in GF(2^8) (x^254) followed by the affine transform,
+ * on 8 bytes at once packed into 64 bit words. This is a lot slower than
+ * a T-table implementation but doesn't leak through the cache.
+ *
+ * rk must hold 176 bytes (11 round keys).
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define AESCT_M01 0x0101010101010101ULL
+#define AESCT_M7F 0x7f7f7f7f7f7f7f7fULL
+
+static inline uint64_t AesCtXtime(uint64_t a)
+{
+  return ((a&AESCT_M7F)<<1) ^ (((a>>7)&AESCT_M01)*0x1b);
+}
+
+static uint64_t AesCtMul(uint64_t a, uint64_t b)
+{
+  uint64_t r=0;
+  for(int i=0; i<8; i++) {
+    r^=a & (((b>>i)&AESCT_M01)*0xff);
+    a=AesCtXtime(a);
+    }
+  return r;
+}
+
+static uint64_t AesCtInv(uint64_t x)
+{
+  uint64_t x2=AesCtMul(x,x), x3=AesCtMul(x2,x), x6=AesCtMul(x3,x3);
+  uint64_t x12=AesCtMul(x6,x6), x15=AesCtMul(x12,x3), x30=AesCtMul(x15,x15);
+  uint64_t x60=AesCtMul(x30,x30), x120=AesCtMul(x60,x60), x126=AesCtMul(x120,x6);
+  uint64_t x127=AesCtMul(x126,x);
+  return AesCtMul(x127,x127);
+}
+
+// rotate every byte left by n
+static inline uint64_t AesCtRol(uint64_t b, int n)
+{
+  const uint64_t hi=((0xffULL<<n)&0xff)*AESCT_M01, lo=(0xffULL>>(8-n))*AESCT_M01;
+  return ((b<<n)&hi) | ((b>>(8-n))&lo);
+}
+
+static uint64_t AesCtSub(uint64_t x)
+{
+  const uint64_t b=AesCtInv(x);
+  return b^AesCtRol(b,1)^AesCtRol(b,2)^AesCtRol(b,3)^AesCtRol(b,4)^(0x63*AESCT_M01);
+}
+
+static uint64_t AesCtInvSub(uint64_t s)
+{
+  return AesCtInv(AesCtRol(s,1)^AesCtRol(s,3)^AesCtRol(s,6)^(0x05*AESCT_M01));
+}
+
+static inline uint64_t AesCtPack(const unsigned char *b, int n)
+{
+  uint64_t w=0;
+  for(int i=n-1; i>=0; i--) w=(w<<8)|b[i];
+  return w;
+}
+
+static inline void AesCtUnpack(unsigned char *b, uint64_t w, int n)
+{
+  for(int i=0; i<n; i++, w>>=8) b[i]=w;
+}
+
+static void AesCtSubBytes(unsigned char *s, bool inv)
+{
+  for(int i=0; i<16; i+=8) {
+    const uint64_t w=AesCtPack(s+i,8);
+    AesCtUnpack(s+i,inv ? AesCtInvSub(w) : AesCtSub(w),8);
+    }
+}
+
+// state is column major, s[r+4*c]
+static void AesCtShiftRows(unsigned char *s, bool inv)
+{
+  unsigned char t[16];
+  for(int c=0; c<4; c++)
+    for(int r=0; r<4; r++) {
+      if(!inv) t[r+4*c]=s[r+4*((c+r)&3)];
+      else     t[r+4*((c+r)&3)]=s[r+4*c];
+      }
+  memcpy(s,t,16);
+}
+
+static inline unsigned char AesCtX(unsigned char a)
+{
+  return (a<<1) ^ (((a>>7)&1)*0x1b);
+}
+
+static void AesCtMixColumns(unsigned char *s, bool inv)
+{
+  for(int c=0; c<4; c++) {
+    unsigned char *p=s+4*c;
+    if(inv) {
+      // pre-multiply by (04 x^2 + 05), then the forward mix gives the inverse
+      const unsigned char u=AesCtX(AesCtX(p[0]^p[2])), v=AesCtX(AesCtX(p[1]^p[3]));
+      p[0]^=u; p[1]^=v; p[2]^=u; p[3]^=v;
+      }
+    const unsigned char a0=p[0], a1=p[1], a2=p[2], a3=p[3], t=a0^a1^a2^a3;
+    p[0]^=t^AesCtX(a0^a1);
+    p[1]^=t^AesCtX(a1^a2);
+    p[2]^=t^AesCtX(a2^a3);
+    p[3]^=t^AesCtX(a3^a0);
+    }
+}
+
+static void AesCtSetKey(unsigned char *rk, const unsigned char *key)
+{
+  memcpy(rk,key,16);
+  unsigned char rcon=1;
+  for(int i=16; i<176; i+=4) {
+    unsigned char t[4];
+    memcpy(t,rk+i-4,4);
+    if(i%16==0) {
+      const unsigned char r[4]={ t[1],t[2],t[3],t[0] };
+      AesCtUnpack(t,AesCtSub(AesCtPack(r,4)),4);
+      t[0]^=rcon; rcon=AesCtX(rcon);
+      }
+    for(int j=0; j<4; j++) rk[i+j]=rk[i+j-16]^t[j];
+    }
+}
+
+static void AesCtEncrypt(const unsigned char *rk, const unsigned char *in, unsigned char *out)
+{
+  unsigned char s[16];
+  for(int i=0; i<16; i++) s[i]=in[i]^rk[i];
+  for(int r=1; r<=10; r++) {
+    AesCtSubBytes(s,false);
+    AesCtShiftRows(s,false);
+    if(r<10) AesCtMixColumns(s,false);
+    for(int i=0; i<16; i++) s[i]^=rk[16*r+i];
+    }
+  memcpy(out,s,16);
+}
+
+static void AesCtDecrypt(const unsigned char *rk, const unsigned char *in, unsigned char *out)
+{
+  unsigned char s[16];
+  for(int i=0; i<16; i++) s[i]=in[i]^rk[160+i];
+  for(int r=9; r>=0; r--) {
+    AesCtShiftRows(s,true);
+    AesCtSubBytes(s,true);
+    for(int i=0; i<16; i++) s[i]^=rk[16*r+i];
+    if(r>0) AesCtMixColumns(s,true);
+    }
+  memcpy(out,s,16);
+}
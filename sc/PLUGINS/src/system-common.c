@@ -159,12 +159,13 @@ cSystemScCore::cSystemScCore(const char *Name, int Pri, int ScId, const char *Sc
 :cSystem(Name,Pri)
 {
   scId=ScId; scName=ScName;
+  async=true;
 }
 
 bool cSystemScCore::ProcessECM(const cEcmInfo *ecm, unsigned char *source)
 {
   bool res=false;
-  cSmartCard *card=smartcards.LockCard(scId);
+  cSmartCard *card=smartcards.LockCard(scId,SC_PRI_ECM,ecm->deadline);
   if(card) {
     res=card->Decode(ecm,source,cw);
     smartcards.ReleaseCard(card);
@@ -175,9 +176,20 @@ bool cSystemScCore::ProcessECM(const cEcmInfo *ecm, unsigned char *source)
 
 void cSystemScCore::ProcessEMM(int pid, int caid, const unsigned char *buffer)
 {
-  cSmartCard *card=smartcards.LockCard(scId);
+  cSmartCard *card=smartcards.LockCard(scId,SC_PRI_EMM);
   if(card) {
     card->Update(pid,caid,buffer);
     smartcards.ReleaseCard(card);
     }
 }
+
+void cSystemScCore::AddEmmPid(cPids *pids, int caid, int pid, int sct, int mask)
+{
+  bool done=false;
+  cSmartCard *card=smartcards.LockCard(scId);
+  if(card) {
+    done=card->AddEmmPid(pids,caid,pid,sct,mask);
+    smartcards.ReleaseCard(card);
+    }
+  if(!done) cSystem::AddEmmPid(pids,caid,pid,sct,mask);
+}
@@ -103,6 +103,8 @@ class cSystemScCore : public cSystem {
 private:
   int scId;
   const char *scName;
+protected:
+  virtual void AddEmmPid(cPids *pids, int caid, int pid, int sct, int mask);
 public:
   cSystemScCore(const char *Name, int Pri, int ScId, const char *ScName);
   virtual bool ProcessECM(const cEcmInfo *ecm, unsigned char *data);
@@ -80,6 +80,196 @@ cLogHook::cLogHook(int Id, const char *Name)
   bailOut=false;
 }
 
+// -- cEcmWorkers --------------------------------------------------------------
+
+#define MAX_ECM_WORKERS 4
+
+class cEcmWorkers;
+
+class cEcmWorker : public cThread {
+private:
+  cEcmWorkers *pool;
+protected:
+  virtual void Action(void);
+public:
+  cEcmWorker(cEcmWorkers *Pool, int Num);
+  virtual ~cEcmWorker();
+  };
+
+class cEcmWorkers {
+friend class cEcmWorker;
+friend class cEcmJob;
+private:
+  cMutex mutex;
+  cCondVar work, finished;
+  cSimpleList<cEcmJob> queue;
+  cEcmWorker *workers[MAX_ECM_WORKERS];
+  int numWorkers, idle, numAbandoned;
+  bool stop;
+  //
+  void Run(void);
+  bool Finish(cEcmJob *job, bool result, int duration);
+  void Reap(cEcmJob *job);
+public:
+  cEcmWorkers(void);
+  void Add(cEcmJob *job);
+  void Shutdown(void);
+  };
+
+static cEcmWorkers ecmWorkers;
+
+cEcmWorker::cEcmWorker(cEcmWorkers *Pool, int Num)
+{
+  pool=Pool;
+  SetDescription("ECM worker %d",Num);
+  Start();
+}
+
+cEcmWorker::~cEcmWorker()
+{
+  Cancel(3);
+}
+
+void cEcmWorker::Action(void)
+{
+  pool->Run();
+}
+
+cEcmWorkers::cEcmWorkers(void)
+{
+  numWorkers=idle=numAbandoned=0; stop=false;
+}
+
+bool cEcmWorkers::Finish(cEcmJob *job, bool result, int duration)
+{
+  // returns true if the job was abandoned and has to be reaped
+  job->result=result; job->duration=duration; job->done=true;
+  if(job->cb) job->cb->EcmDone(job);
+  finished.Broadcast();
+  return job->abandoned;
+}
+
+void cEcmWorkers::Reap(cEcmJob *job)
+{
+  // called unlocked, deleting the system may take a while
+  delete job;
+  cMutexLock lock(&mutex);
+  numAbandoned--;
+  finished.Broadcast();
+}
+
+void cEcmWorkers::Add(cEcmJob *job)
+{
+  cMutexLock lock(&mutex);
+  if(stop || !job->data) { Finish(job,false,0); return; }
+  queue.Add(job);
+  // spawn workers on demand
+  if(idle<queue.Count() && numWorkers<MAX_ECM_WORKERS) {
+    workers[numWorkers]=new cEcmWorker(this,numWorkers);
+    numWorkers++;
+    }
+  work.Broadcast();
+}
+
+void cEcmWorkers::Run(void)
+{
+  mutex.Lock();
+  while(!stop) {
+    cEcmJob *job=queue.First();
+    if(!job) {
+      idle++;
+      work.Wait(mutex);
+      idle--;
+      continue;
+      }
+    queue.Del(job,false);
+    mutex.Unlock();
+    cTimeMs start;
+    bool res=job->sys->ProcessECM(job->ecm,job->data);
+    mutex.Lock();
+    if(Finish(job,res,start.Elapsed())) {
+      mutex.Unlock();
+      Reap(job);
+      mutex.Lock();
+      }
+    }
+  mutex.Unlock();
+}
+
+void cEcmWorkers::Shutdown(void)
+{
+  mutex.Lock();
+  stop=true;
+  work.Broadcast();
+  // jobs which didn't start yet fail
+  cSimpleList<cEcmJob> dead;
+  cEcmJob *job;
+  while((job=queue.First())) {
+    queue.Del(job,false);
+    if(Finish(job,false,0)) dead.Add(job);
+    }
+  mutex.Unlock();
+  while((job=dead.First())) {
+    dead.Del(job,false);
+    Reap(job);
+    }
+  for(int i=0; i<numWorkers; i++) delete workers[i];
+  mutex.Lock();
+  // jobs of killed workers are lost
+  numWorkers=idle=numAbandoned=0; stop=false;
+  finished.Broadcast();
+  mutex.Unlock();
+}
+
+// -- cEcmJob ------------------------------------------------------------------
+
+cEcmJob::cEcmJob(cSystem *Sys, const cEcmInfo *Ecm, const unsigned char *Data, cEcmCallback *Cb)
+{
+  // the handler's cEcmInfo may change or go away while the job runs
+  sys=Sys; cb=Cb;
+  ecm=new cEcmInfo(Ecm);
+  ecm->deadline=Ecm->deadline;
+  len=SCT_LEN(Data);
+  data=MALLOC(unsigned char,len);
+  if(data) memcpy(data,Data,len); else len=0;
+  duration=0; done=result=abandoned=ownSys=false;
+}
+
+cEcmJob::~cEcmJob()
+{
+  if(ownSys) delete sys;
+  delete ecm;
+  free(data);
+}
+
+bool cEcmJob::Done(void)
+{
+  cMutexLock lock(&ecmWorkers.mutex);
+  return done;
+}
+
+void cEcmJob::Wait(void)
+{
+  cMutexLock lock(&ecmWorkers.mutex);
+  while(!done) ecmWorkers.finished.Wait(ecmWorkers.mutex);
+}
+
+void cEcmJob::Abandon(bool DeleteSys)
+{
+  ecmWorkers.mutex.Lock();
+  cb=0; ownSys=DeleteSys;
+  bool d=done;
+  if(!d) { abandoned=true; ecmWorkers.numAbandoned++; }
+  ecmWorkers.mutex.Unlock();
+  if(d) delete this;
+}
+
+void cEcmJob::WaitAbandoned(void)
+{
+  cMutexLock lock(&ecmWorkers.mutex);
+  while(ecmWorkers.numAbandoned>0) ecmWorkers.finished.Wait(ecmWorkers.mutex);
+}
+
 // -- cSystem ------------------------------------------------------------------
 
 #define MAX_CHID 10
@@ -110,6 +300,7 @@ cSystem::cSystem(const char *Name, int Pri)
   local=true;
   needsDescrData=false;
   constant=false;
+  async=false;
 }
 
 cSystem::~cSystem()
@@ -145,6 +336,15 @@ void cSystem::CaidsChanged(void)
   cGlobal::CaidsChanged();
 }
 
+cEcmJob *cSystem::ProcessECMAsync(const cEcmInfo *ecm, const unsigned char *buffer, cEcmCallback *cb)
+{
+  // default: run the blocking ProcessECM() on the worker pool. The system
+  // instance must not be used by the caller until the job is done.
+  cEcmJob *job=new cEcmJob(this,ecm,buffer,cb);
+  ecmWorkers.Add(job);
+  return job;
+}
+
 void cSystem::ParseCADescriptor(cSimpleList<cEcmInfo> *ecms, unsigned short sysId, int source, const unsigned char *data, int len)
 {
   const int pid=WORD(data,2,0x1FFF);
@@ -176,29 +376,34 @@ void cSystem::ParseCAT(cPids *pids, const unsigned char *buffer, int source, int
     switch(caid>>8) {
       case 0x01: // Seca style (82/83/84)
         if(buffer[1]>4) {
-          pids->AddPid(pid,0x82,0xFE); // Unique/global updates
+          AddEmmPid(pids,caid,pid,0x82,0xFE); // Unique/global updates
           for(int i=7, nn=buffer[6] ; nn ; nn--,i+=4)
-            pids->AddPid(WORD(buffer,i,0x1FFF),0x84,0xFF); // Shared updates
+            AddEmmPid(pids,caid,WORD(buffer,i,0x1FFF),0x84,0xFF); // Shared updates
           }
         break;
       case 0x05: // Viaccess style (88/8c/8d/8e)
-        pids->AddPid(pid,0x88,0xF9); // mismatching 8a
-        pids->AddPid(pid,0x8D,0xFF);
+        AddEmmPid(pids,caid,pid,0x88,0xF9); // mismatching 8a
+        AddEmmPid(pids,caid,pid,0x8D,0xFF);
         break;
       case 0x0d: // Cryptoworks style (82/84/86/88/89)
-        pids->AddPid(pid,0x82,0xF9); // mismatching 80
-        pids->AddPid(pid,0x88,0xFE);
+        AddEmmPid(pids,caid,pid,0x82,0xF9); // mismatching 80
+        AddEmmPid(pids,caid,pid,0x88,0xFE);
         break;
       case 0x18: // Nagra style (82/83)
-        pids->AddPid(pid,0x82,0xFE);
+        AddEmmPid(pids,caid,pid,0x82,0xFE);
         break;
       default:   // default style (82)
-        pids->AddPid(pid,0x82,0xFF);
+        AddEmmPid(pids,caid,pid,0x82,0xFF);
         break;
       }
     }
 }
 
+void cSystem::AddEmmPid(cPids *pids, int caid, int pid, int sct, int mask)
+{
+  pids->AddPid(pid,sct,mask);
+}
+
 int cSystem::CheckECM(const cEcmInfo *ecm, const unsigned char *data, bool sync)
 {
   switch(ecm->caId>>8) {
@@ -398,6 +603,7 @@ bool cSystems::Init(const char *cfgdir)
 
 void cSystems::Clean(void)
 {
+  ecmWorkers.Shutdown();
   for(cSystemLink *sl=first; sl; sl=sl->next) sl->Clean();
 }
 
@@ -445,16 +651,53 @@ cOpts *cSystems::GetSystemOpts(bool start)
 
 #define HASHLEN 16
 
+#define SHARDMIN 8 // min. number of entries per shard
+
 struct Cache {
   unsigned char hash[HASHLEN];
   int mode;
   };
 
-cMsgCache::cMsgCache(int NumCache, int StoreSize)
+struct CacheShard {
+  cMutex mutex;
+  int first, num, ptr; // slots first..first+num-1, ptr is relative
+  int *index, indexMask;
+  };
+
+// The cache is split into shards by message hash. Each shard is a ring of
+// its own with its own lock, so handlers working on different messages
+// don't serialize on a single mutex. Every slot has its own wait channel
+// and Cache() only wakes the threads waiting for that slot.
+//
+// The optional index is an open-addressing table (linear probing) per shard
+// holding slot+1 of every used cache entry, 0 marks an empty position. It's
+// kept at least twice the shard size. When the ring overwrites a slot, the
+// old hash is removed with backward-shift deletion, so no tombstones build up.
+
+cMsgCache::cMsgCache(int NumCache, int StoreSize, int Flags)
 {
   numCache=NumCache;
   storeSize=StoreSize;
-  ptr=0; stores=0; maxFail=2;
+  flags=Flags;
+  stores=0; maxFail=2;
+  numShards=max(1,min(MSGCACHE_SHARDS,numCache/SHARDMIN));
+  shards=new struct CacheShard[numShards];
+  waits=new cCondVar[numCache];
+  int per=numCache/numShards;
+  for(int i=0; i<numShards; i++) {
+    struct CacheShard *sh=&shards[i];
+    sh->first=i*per;
+    sh->num=(i==numShards-1) ? numCache-sh->first : per;
+    sh->ptr=0;
+    sh->index=0; sh->indexMask=0;
+    if(flags&MSGCACHE_INDEX) {
+      int n=16;
+      while(n<sh->num*2) n<<=1;
+      sh->index=MALLOC(int,n);
+      if(sh->index) sh->indexMask=n-1;
+      else PRINTF(L_GEN_ERROR,"msgcache: no memory for index");
+      }
+    }
   caches=MALLOC(struct Cache,numCache);
   if(caches) {
     Clear();
@@ -468,6 +711,9 @@ cMsgCache::cMsgCache(int NumCache, int StoreSize)
 
 cMsgCache::~cMsgCache()
 {
+  for(int i=0; i<numShards; i++) free(shards[i].index);
+  delete[] shards;
+  delete[] waits;
   free(caches);
   free(stores);
 }
@@ -480,21 +726,80 @@ void cMsgCache::SetMaxFail(int maxfail)
 
 void cMsgCache::Clear(void)
 {
-  cMutexLock lock(&mutex);
-  memset(caches,0,sizeof(struct Cache)*numCache);
-  ptr=0;
+  for(int i=0; i<numShards; i++) {
+    struct CacheShard *sh=&shards[i];
+    cMutexLock lock(&sh->mutex);
+    memset(&caches[sh->first],0,sizeof(struct Cache)*sh->num);
+    if(sh->index) memset(sh->index,0,sizeof(int)*(sh->indexMask+1));
+    sh->ptr=0;
+    for(int j=sh->first; j<sh->first+sh->num; j++) waits[j].Broadcast();
+    }
   PRINTF(L_CORE_MSGCACHE,"%d/%p: clear",getpid(),this);
 }
 
-struct Cache *cMsgCache::FindMsg(const unsigned char *hash) const
+struct CacheShard *cMsgCache::Shard(const unsigned char *hash) const
 {
-  int i=ptr;
+  return &shards[(hash[4] | (hash[5]<<8)) % numShards];
+}
+
+struct CacheShard *cMsgCache::ShardById(int id) const
+{
+  return &shards[min((id-1)/(numCache/numShards),numShards-1)];
+}
+
+int cMsgCache::IndexPos(const struct CacheShard *sh, const unsigned char *hash) const
+{
+  return (hash[0] | (hash[1]<<8) | (hash[2]<<16) | (hash[3]<<24)) & sh->indexMask;
+}
+
+void cMsgCache::IndexAdd(struct CacheShard *sh, int slot)
+{
+  int *index=sh->index;
+  int i=IndexPos(sh,caches[slot].hash);
+  while(index[i]) i=(i+1)&sh->indexMask;
+  index[i]=slot+1;
+}
+
+void cMsgCache::IndexDel(struct CacheShard *sh, int slot)
+{
+  int *index=sh->index;
+  int i=IndexPos(sh,caches[slot].hash);
+  while(index[i]!=slot+1) {
+    if(!index[i]) return; // not indexed
+    i=(i+1)&sh->indexMask;
+    }
+  // backward-shift following entries which probed past the hole
+  int j=i;
   while(1) {
-    if(--i<0) i=numCache-1;
-    struct Cache * const s=&caches[i];
+    index[i]=0;
+    while(1) {
+      j=(j+1)&sh->indexMask;
+      if(!index[j]) return;
+      int k=IndexPos(sh,caches[index[j]-1].hash);
+      if(i<=j ? (i<k && k<=j) : (i<k || k<=j)) continue;
+      break;
+      }
+    index[i]=index[j]; i=j;
+    }
+}
+
+struct Cache *cMsgCache::FindMsg(const struct CacheShard *sh, const unsigned char *hash) const
+{
+  if(sh->index) {
+    const int *index=sh->index;
+    for(int i=IndexPos(sh,hash); index[i]; i=(i+1)&sh->indexMask) {
+      struct Cache * const s=&caches[index[i]-1];
+      if(!memcmp(s->hash,hash,HASHLEN)) return s;
+      }
+    return 0;
+    }
+  int i=sh->ptr;
+  while(1) {
+    if(--i<0) i=sh->num-1;
+    struct Cache * const s=&caches[sh->first+i];
     if(!s->mode) break;
     if(!memcmp(s->hash,hash,HASHLEN)) return s;
-    if(i==ptr) break;
+    if(i==sh->ptr) break;
     }
   return 0;
 }
@@ -506,30 +811,36 @@ struct Cache *cMsgCache::FindMsg(const unsigned char *hash) const
 int cMsgCache::Get(const unsigned char *msg, int len, unsigned char *store)
 {
   unsigned char hash[HASHLEN];
-  MD5(msg,len,hash);
-  cMutexLock lock(&mutex);
+  if(flags&MSGCACHE_MD5) MD5(msg,len,hash);
+  else Hash128(msg,len,hash);
   if(!caches || (storeSize>0 && !stores)) return -1; // sanity
+  struct CacheShard *sh=Shard(hash);
+  cMutexLock lock(&sh->mutex);
   struct Cache *s;
-  while((s=FindMsg(hash))) {
+  while((s=FindMsg(sh,hash))) {
     if(!(s->mode&QUEUED)) break;
     s->mode|=WAIT;
     PRINTF(L_CORE_MSGCACHE,"%d/%p: msg already queued. waiting to complete",getpid(),this);
-    wait.Wait(mutex);
+    waits[s-&caches[0]].Wait(sh->mutex);
     }
   int id;
   if(!s) {
+    int slot;
     while(1) {
-      s=&caches[ptr];
+      slot=sh->first+sh->ptr;
+      s=&caches[slot];
       if(!(s->mode&QUEUED)) break;
       s->mode|=WAIT;
-      PRINTF(L_CORE_MSGCACHE,"%d/%p: queue overwrite protection id=%d",getpid(),this,ptr+1);
-      wait.Wait(mutex); // don't overwrite queued msg's
+      PRINTF(L_CORE_MSGCACHE,"%d/%p: queue overwrite protection id=%d",getpid(),this,slot+1);
+      waits[slot].Wait(sh->mutex); // don't overwrite queued msg's
       }
-    id=ptr+1;
+    id=slot+1;
+    if(sh->index && s->mode) IndexDel(sh,slot);
     memcpy(s->hash,hash,HASHLEN);
     s->mode=QUEUED;
+    if(sh->index) IndexAdd(sh,slot);
     PRINTF(L_CORE_MSGCACHE,"%d/%p: queued msg with id=%d",getpid(),this,id);
-    ptr++; if(ptr>=numCache) { ptr=0; PRINTF(L_CORE_MSGCACHE,"msgcache: roll-over (%d)",numCache); }
+    sh->ptr++; if(sh->ptr>=sh->num) { sh->ptr=0; PRINTF(L_CORE_MSGCACHE,"msgcache: roll-over (%d)",sh->num); }
     return id;
     }
   else {
@@ -554,12 +865,12 @@ int cMsgCache::Get(const unsigned char *msg, int len, unsigned char *store)
 
 int cMsgCache::Cache(int id, bool result, const unsigned char *store)
 {
-  cMutexLock lock(&mutex);
-  if(id<1 || !caches || (storeSize>0 && !stores)) return 0; // sanity
+  if(id<1 || id>numCache || !caches || (storeSize>0 && !stores)) return 0; // sanity
+  cMutexLock lock(&ShardById(id)->mutex);
   struct Cache *s=&caches[id-1];
   LBSTARTF(L_CORE_MSGCACHE);
   LBPUT("%d/%p: de-queued msg with id=%d ",getpid(),this,id);
-  if(s->mode&WAIT) wait.Broadcast();
+  if(s->mode&WAIT) waits[id-1].Broadcast();
   if(result) {
     if(store && storeSize>0)
       memcpy(&stores[(id-1)*storeSize],store,storeSize);
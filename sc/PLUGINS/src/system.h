@@ -88,6 +88,43 @@ public:
 
 // ----------------------------------------------------------------
 
+class cEcmJob;
+
+class cEcmCallback {
+public:
+  virtual ~cEcmCallback() {}
+  // called from a worker thread with the pool locked. Keep it short.
+  virtual void EcmDone(cEcmJob *job)=0;
+  };
+
+class cEcmJob : public cSimpleItem {
+friend class cEcmWorkers;
+private:
+  cSystem *sys;
+  cEcmInfo *ecm;
+  unsigned char *data;
+  int len, duration;
+  cEcmCallback *cb;
+  bool done, result, abandoned, ownSys;
+public:
+  cEcmJob(cSystem *Sys, const cEcmInfo *Ecm, const unsigned char *Data, cEcmCallback *Cb);
+  virtual ~cEcmJob();
+  bool Done(void);
+  void Wait(void);
+  // give up on the result without waiting. The job deletes itself (and Sys,
+  // if DeleteSys is set) once it has completed, so it must not be touched
+  // after this call.
+  void Abandon(bool DeleteSys);
+  // wait until all abandoned jobs are gone, e.g. before their cCam goes
+  static void WaitAbandoned(void);
+  bool Result(void) const { return result; }
+  int Duration(void) const { return duration; }
+  const unsigned char *Data(void) const { return data; }
+  int Len(void) const { return len; }
+  };
+
+// ----------------------------------------------------------------
+
 struct EcmCheck;
 
 class cSystem : public cSimpleItem {
@@ -107,12 +144,13 @@ protected:
   bool doLog;
   // config details
   int maxEcmTry;
-  bool local, hasLogger, needsLogger, needsDescrData, constant;
+  bool local, hasLogger, needsLogger, needsDescrData, constant, async;
   //
   void KeyOK(cPlainKey *pk);
   void KeyOK(const char *txt);
   void KeyFail(int type, int id, int keynr);
   void StartLog(const cEcmInfo *ecm, int caid);
+  virtual void AddEmmPid(cPids *pids, int caid, int pid, int sct, int mask);
 public:
   cSystem(const char *Name, int Pri);
   virtual ~cSystem();
@@ -122,6 +160,7 @@ public:
   virtual int CheckECM(const cEcmInfo *ecm, const unsigned char *data, bool sync);
   virtual void CheckECMResult(const cEcmInfo *ecm, const unsigned char *data, bool result);
   virtual bool ProcessECM(const cEcmInfo *ecm, unsigned char *buffer)=0;
+  virtual cEcmJob *ProcessECMAsync(const cEcmInfo *ecm, const unsigned char *buffer, cEcmCallback *cb);
   virtual void ProcessEMM(int pid, int caid, const unsigned char *buffer) {};
   virtual void ParseCADescriptor(cSimpleList<cEcmInfo> *ecms, unsigned short sysId, int source, const unsigned char *data, int len);
   virtual void ParseCAT(cPids *pids, const unsigned char *buffer, int source, int transponder);
@@ -140,6 +179,7 @@ public:
   bool Local(void) { return local; }
   bool NeedsData(void) { return needsDescrData; }
   bool Constant(void) { return constant; }
+  bool Async(void) { return async; }
   //
   static void FoundKey(void) { foundKeys++; }
   static void NewKey(void) { newKeys++; }
@@ -197,18 +237,33 @@ public:
 // ----------------------------------------------------------------
 
 struct Cache;
+struct CacheShard;
+
+#define MSGCACHE_INDEX 1 // lookup by hash index instead of linear scan
+#define MSGCACHE_MD5   2 // fingerprint messages with MD5 instead of Hash128
+#ifndef MSGCACHE_DEFAULT
+#define MSGCACHE_DEFAULT MSGCACHE_INDEX
+#endif
+#ifndef MSGCACHE_SHARDS
+#define MSGCACHE_SHARDS 4 // max. number of independently locked shards
+#endif
 
 class cMsgCache {
 private:
   struct Cache *caches;
+  struct CacheShard *shards;
+  cCondVar *waits;
   unsigned char *stores;
-  int numCache, ptr, storeSize, maxFail;
-  cMutex mutex;
-  cCondVar wait;
+  int numCache, numShards, storeSize, maxFail, flags;
   //
-  struct Cache *FindMsg(const unsigned char *hash) const;
+  struct CacheShard *Shard(const unsigned char *hash) const;
+  struct CacheShard *ShardById(int id) const;
+  struct Cache *FindMsg(const struct CacheShard *sh, const unsigned char *hash) const;
+  int IndexPos(const struct CacheShard *sh, const unsigned char *hash) const;
+  void IndexAdd(struct CacheShard *sh, int slot);
+  void IndexDel(struct CacheShard *sh, int slot);
 public:
-  cMsgCache(int NumCache, int StoreSize);
+  cMsgCache(int NumCache, int StoreSize, int Flags=MSGCACHE_DEFAULT);
   ~cMsgCache();
   int Cache(int id, bool result, const unsigned char *store);
   int Get(const unsigned char *msg, int len, unsigned char *store);
@@ -202,7 +202,7 @@ cSystemCardClient::cSystemCardClient(void)
 :cSystem(SYSTEM_NAME,SYSTEM_PRI)
 {
   cc=0;
-  local=false; hasLogger=true;
+  local=false; hasLogger=true; async=true;
 }
 
 bool cSystemCardClient::ProcessECM(const cEcmInfo *ecm, unsigned char *data)
@@ -32,6 +32,8 @@
 #include <openssl/des.h>
 
 #define CWS_NETMSGSIZE 540
+#define CWS_TIMEOUT    20*1000 // ms
+#define MAX_PENDING    16
 
 // -- cTripleDes ---------------------------------------------------------------
 
@@ -165,6 +167,12 @@ struct CustomData {
     };
   };
 
+struct NcdPending {
+  unsigned short msgId;
+  unsigned char *buff;
+  int len; // -1 while waiting
+  };
+
 class cCardClientNewCamd : public cCardClient, private cTripleDes, private cIdSet {
 private:
   unsigned char configKey[14];
@@ -172,6 +180,10 @@ private:
   int caId, protoVers, cdLen;
   bool emmProcessing, loginOK;
   char username[USERLEN], password[PASSWDLEN];
+  struct NcdPending *pending[MAX_PENDING];
+  int numPending;
+  bool reading;
+  cCondVar pendCond;
   //
   void InitVars(void);
   void InitProtoVers(int vers);
@@ -180,7 +192,9 @@ private:
   void PrepareLoginKey(unsigned char *deskey, const unsigned char *rkey, const unsigned char *ckey);
   // Client Helper functions
   bool SendMessage(const unsigned char *data, int len, bool UseMsgId, const struct CustomData *cd=0, comm_type_t commType=COMMTYPE_CLIENT);
-  int ReceiveMessage(unsigned char *data, bool UseMsgId, struct CustomData *cd=0, comm_type_t commType=COMMTYPE_CLIENT);
+  int ReceiveMessage(unsigned char *data, bool UseMsgId, struct CustomData *cd=0, comm_type_t commType=COMMTYPE_CLIENT, int *MsgId=0);
+  bool CheckLogin(void);
+  int Exchange(const unsigned char *data, int len, const struct CustomData *cd, unsigned char *buffer);
   bool CmdSend(net_msg_type_t cmd,  comm_type_t commType=COMMTYPE_CLIENT);
   int CmdReceive(comm_type_t commType=COMMTYPE_CLIENT);
 public:
@@ -202,7 +216,8 @@ cCardClientNewCamd::cCardClientNewCamd(const char *Name)
   memset(password,0,sizeof(password));
   InitVars();
   InitProtoVers(525);
-  so.SetRWTimeout(20*1000);
+  numPending=0; reading=false;
+  so.SetRWTimeout(CWS_TIMEOUT);
 }
 
 void cCardClientNewCamd::InitVars(void)
@@ -284,14 +299,22 @@ bool cCardClientNewCamd::SendMessage(const unsigned char *data, int len, bool Us
   len+=sizeof(DES_cblock);
   netbuf[0]=(len-2)>>8;
   netbuf[1]=(len-2)&0xff;
-  return cCardClient::SendMsg(netbuf,len);
+  // no implicit login here either, another thread may be reading
+  if(so.Write(netbuf,len)<0) {
+    PRINTF(L_CC_NEWCAMD,"send error");
+    Logout();
+    return false;
+    }
+  return true;
 }
 
-int cCardClientNewCamd::ReceiveMessage(unsigned char *data, bool UseMsgId, struct CustomData *cd, comm_type_t commType)
+int cCardClientNewCamd::ReceiveMessage(unsigned char *data, bool UseMsgId, struct CustomData *cd, comm_type_t commType, int *MsgId)
 {
+  // no implicit login here, see Exchange()
   unsigned char netbuf[CWS_NETMSGSIZE];
-  if(cCardClient::RecvMsg(netbuf,2)<0) {
+  if(so.Read(netbuf,2)<0) {
     PRINTF(L_CC_NEWCAMD,"failed to read message length");
+    Logout();
     return 0;
     }
   int mlen=WORD(netbuf,0,0xFFFF);
@@ -299,8 +322,9 @@ int cCardClientNewCamd::ReceiveMessage(unsigned char *data, bool UseMsgId, struc
    PRINTF(L_CC_NEWCAMD,"receive message buffer overflow");
    return 0;
    }
-  if(cCardClient::RecvMsg(netbuf+2,mlen,200)<0) {
+  if(so.Read(netbuf+2,mlen,200)<0) {
     PRINTF(L_CC_NEWCAMD,"failed to read message");
+    Logout();
     return 0;
     }
   mlen+=2;
@@ -312,6 +336,7 @@ int cCardClientNewCamd::ReceiveMessage(unsigned char *data, bool UseMsgId, struc
 
   int returnLen=WORD(netbuf,5+cdLen,0x0FFF)+3;
   if(cd) memcpy(cd,&netbuf[4],cdLen);
+  if(MsgId) *MsgId=WORD(netbuf,2,0xFFFF);
   if(UseMsgId) {
     switch(commType) {
       case COMMTYPE_SERVER:
@@ -332,6 +357,66 @@ int cCardClientNewCamd::ReceiveMessage(unsigned char *data, bool UseMsgId, struc
   return returnLen;
 }
 
+// Never log in again while another thread is reading from the old connection.
+bool cCardClientNewCamd::CheckLogin(void)
+{
+  if(!so.Connected()) {
+    while(reading) pendCond.Wait(*this);
+    if(!so.Connected()) return Login();
+    }
+  return true;
+}
+
+// Sends a request and waits for the response with the same message id.
+// Called locked. The lock is released while waiting, so other threads can
+// send their requests meanwhile. The first waiting thread reads from the
+// socket for all of them and hands the responses out by message id.
+int cCardClientNewCamd::Exchange(const unsigned char *data, int len, const struct CustomData *cd, unsigned char *buffer)
+{
+  if(!CheckLogin()) return 0;
+  if(numPending>=MAX_PENDING) {
+    PRINTF(L_CC_NEWCAMD,"too many pending requests");
+    return 0;
+    }
+  if(!numPending && !reading) so.Flush();
+  if(!SendMessage(data,len,true,cd)) return 0;
+  struct NcdPending p;
+  p.msgId=netMsgId; p.buff=buffer; p.len=-1;
+  pending[numPending++]=&p;
+  cTimeMs tim(CWS_TIMEOUT);
+  while(p.len<0) {
+    if(!reading) {
+      reading=true;
+      Unlock();
+      unsigned char msg[CWS_NETMSGSIZE];
+      int id=0, n=ReceiveMessage(msg,false,0,COMMTYPE_CLIENT,&id);
+      Lock();
+      reading=false;
+      if(n>0) {
+        int i;
+        for(i=0; i<numPending; i++)
+          if(pending[i]->msgId==id && pending[i]->len<0) {
+            memcpy(pending[i]->buff,msg,n);
+            pending[i]->len=n;
+            break;
+            }
+        if(i>=numPending) PRINTF(L_CC_NEWCAMD,"discarding response for msgid %04x",id);
+        }
+      else // connection is gone, fail everything outstanding
+        for(int i=0; i<numPending; i++)
+          if(pending[i]->len<0) pending[i]->len=0;
+      pendCond.Broadcast();
+      }
+    else if(!pendCond.TimedWait(*this,100) && tim.TimedOut()) {
+      PRINTF(L_CC_NEWCAMD,"no response for msgid %04x",p.msgId);
+      p.len=0;
+      }
+    }
+  for(int i=0; i<numPending; i++)
+    if(pending[i]==&p) { pending[i]=pending[--numPending]; break; }
+  return p.len;
+}
+
 bool cCardClientNewCamd::CmdSend(net_msg_type_t cmd, comm_type_t commType)
 {
   unsigned char buffer[3];
@@ -473,16 +558,12 @@ bool cCardClientNewCamd::Login(void)
 bool cCardClientNewCamd::ProcessECM(const cEcmInfo *ecm, const unsigned char *data, unsigned char *cw)
 {
   cMutexLock lock(this);
-  if((!so.Connected() && !Login()) || !CanHandle(ecm->caId)) return false;
-  so.Flush();
+  if(!CheckLogin() || !CanHandle(ecm->caId)) return false;
 
   struct CustomData cd;
   InitCustomData(&cd,(unsigned short)ecm->prgId,0);
-  if(!SendMessage(data,SCT_LEN(data),true,&cd)) return false;
   unsigned char buffer[CWS_NETMSGSIZE];
-  int n;
-  while((n=ReceiveMessage(buffer,true))==-2)
-    PRINTF(L_CC_NEWCAMD,"msg ID sync error. Retrying...");
+  int n=Exchange(data,SCT_LEN(data),&cd,buffer);
   switch(n) {
     case 19: // ecm was decoded
       // check for zero cw, as newcs doesn't send both cw's every time
@@ -509,16 +590,14 @@ bool cCardClientNewCamd::ProcessEMM(int caSys, const unsigned char *data)
         int len=SCT_LEN(data);
         int id=msEMM.Get(data,len,0);
         if(id>0 || emmAllowed>1) {
-          if(SendMessage(data,len,true,0)) {
-            unsigned char buffer[CWS_NETMSGSIZE];
-            len=ReceiveMessage(buffer,true);
-            if(len>=3) {
-              if(!(buffer[1]&0x10))
-                PRINTF(L_CC_EMM,"EMM rejected by card");
-              }
-            else
-              PRINTF(L_CC_NEWCAMD,"unexpected server response (code %d)",len);
+          unsigned char buffer[CWS_NETMSGSIZE];
+          len=Exchange(data,len,0,buffer);
+          if(len>=3) {
+            if(!(buffer[1]&0x10))
+              PRINTF(L_CC_EMM,"EMM rejected by card");
             }
+          else
+            PRINTF(L_CC_NEWCAMD,"unexpected server response (code %d)",len);
           msEMM.Cache(id,true,0);
           }
         }
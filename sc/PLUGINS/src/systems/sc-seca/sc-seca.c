@@ -150,6 +150,10 @@ public:
   virtual bool Init(void);
   virtual bool Decode(const cEcmInfo *ecm, const unsigned char *data, unsigned char *cw);
   virtual bool Update(int pid, int caid, const unsigned char *data);
+  virtual bool AddEmmPid(cPids *pids, int caid, int pid, int sct, int mask);
+#ifdef TESTER
+  void TestSetup(const unsigned char *ua, const unsigned char *pi, const unsigned char *sa);
+#endif
   };
 
 static const struct StatusMsg msgs[] = {
@@ -334,6 +338,41 @@ bool cSmartCardSeca::Update(int pid, int caid, const unsigned char *data)
   return false;
 }
 
+bool cSmartCardSeca::AddEmmPid(cPids *pids, int caid, int pid, int sct, int mask)
+{
+  // with all updates blocked there is nothing to filter for
+  if(blocker==3) return true;
+  // 0x83 global updates aren't handled, so only unique updates for our UA
+  // and shared updates for our providers are needed
+  if(sct==0x82 && mask==0xFE && card) {
+    if(blocker!=1) {
+      cSectFilter f(0x82,0xFF);
+      f.Set(3,((cCardSeca *)card)->ua,sizeof(((cCardSeca *)card)->ua));
+      pids->AddPid(pid,f);
+      }
+    return true;
+    }
+  if(sct==0x84 && mask==0xFF && Count()>0) {
+    if(blocker!=2)
+      for(cProviderScSeca *p=(cProviderScSeca *)First(); p; p=(cProviderScSeca *)Next(p)) {
+        cSectFilter f(0x84,0xFF);
+        f.Set(3,p->provId,sizeof(p->provId));
+        f.Set(5,p->sa,sizeof(p->sa));
+        pids->AddPid(pid,f);
+        }
+    return true;
+    }
+  return false;
+}
+
+#ifdef TESTER
+void cSmartCardSeca::TestSetup(const unsigned char *ua, const unsigned char *pi, const unsigned char *sa)
+{
+  SetCard(new cCardSeca(ua));
+  if(pi) AddProv(new cProviderScSeca(pi,sa));
+}
+#endif
+
 // -- cSmartCardLinkSeca -------------------------------------------------------
 
 class cSmartCardLinkSeca : public cSmartCardLink {
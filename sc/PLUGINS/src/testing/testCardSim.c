@@ -0,0 +1,206 @@
+/*
+ * Smartcard path benchmark on simulated cardslots (cardslot type "sim").
+ * Writes a T0 and a T1 card script plus a cardslot.conf to a temporary
+ * directory, waits for both cards to come up and times ECM like exchanges
+ * through cSmartCards::LockCard(), the ISO T0 code and raw T1 blocks.
+ * The returned CWs are checked against the script.
+ *
+ * usage: testCardSim [-n count] [-d delay] [-j jitter] [-w wait] [-v]
+ *   -n count   exchanges per card (default 50)
+ *   -d delay   extra time per response byte in us (default 0)
+ *   -j jitter  random extra time per response byte in us (default 0)
+ *   -w wait    card processing time in us (default 20000)
+ *   -v         log everything
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "smartcard.h"
+#include "system.h"
+#include "misc.h"
+#include "log.h"
+#include "compat.h"
+
+#define ECM_LEN 64
+#define CW_LEN  16
+
+static const unsigned char cwData[CW_LEN] = {
+  0x11,0x22,0x33,0x66,0x44,0x55,0x66,0xFF,0x77,0x88,0x99,0x98,0xAA,0xBB,0xCC,0x31
+  };
+
+static const struct StatusMsg msgs[] = {
+  { { 0x90,0x00 }, "Instruction executed without errors", true },
+  { { 0xFF,0xFF }, 0, false }
+  };
+
+static const struct CardConfig cardCfg = {
+  SM_8E2,1000,100
+  };
+
+// -- cBenchCard ---------------------------------------------------------------
+
+template<int T> class cBenchCard : public cSmartCard {
+public:
+  cBenchCard(void):cSmartCard(&cardCfg,msgs) {}
+  virtual bool Init(void);
+  virtual bool Decode(const cEcmInfo *ecm, const unsigned char *data, unsigned char *cw);
+  };
+
+template<int T> bool cBenchCard<T>::Init(void)
+{
+  if(atr->T!=T) return false;
+  if(T==0) {
+    static const unsigned char ins10[] = { 0x80,0x10,0x00,0x00,0x04 };
+    unsigned char buff[4];
+    return IsoRead(ins10,buff) && Status();
+    }
+  return true;
+}
+
+template<int T> bool cBenchCard<T>::Decode(const cEcmInfo *ecm, const unsigned char *data, unsigned char *cw)
+{
+  if(T==0) {
+    static const unsigned char ins40[] = { 0x80,0x40,0x00,0x00,ECM_LEN };
+    static const unsigned char ins42[] = { 0x80,0x42,0x00,0x00,CW_LEN };
+    if(!IsoWrite(ins40,data) || !Status()) return false;
+    return IsoRead(ins42,cw) && Status();
+    }
+  unsigned char buff[3+ECM_LEN+1];
+  buff[0]=0x00; buff[1]=0x00; buff[2]=ECM_LEN;
+  memcpy(buff+3,data,ECM_LEN);
+  buff[3+ECM_LEN]=XorSum(buff,3+ECM_LEN);
+  if(SerWrite(buff,sizeof(buff))!=(int)sizeof(buff)) return false;
+  if(SerRead(buff,3,cardCfg.workTO)!=3 || buff[2]!=CW_LEN+2) return false;
+  if(SerRead(buff+3,CW_LEN+3)!=CW_LEN+3 || XorSum(buff,3+CW_LEN+3)) return false;
+  memcpy(cw,buff+3,CW_LEN);
+  return buff[3+CW_LEN]==0x90 && buff[3+CW_LEN+1]==0x00;
+}
+
+// -- cBenchCardLink -----------------------------------------------------------
+
+template<int T> class cBenchCardLink : public cSmartCardLink {
+public:
+  cBenchCardLink(void):cSmartCardLink(T ? "bench-t1":"bench-t0",MAKE_SC_ID('B','N','C','0'+T)) {}
+  virtual cSmartCard *Create(void) { return new cBenchCard<T>; }
+  };
+
+static cBenchCardLink<0> benchT0;
+static cBenchCardLink<1> benchT1;
+
+// ----------------------------------------------------------------
+
+static void PutHex(FILE *f, const unsigned char *data, int len)
+{
+  for(int i=0; i<len; i++) fprintf(f," %02X",data[i]);
+}
+
+static bool WriteScripts(const char *dir, int delay, int jitter, int wait)
+{
+  char name[128];
+  snprintf(name,sizeof(name),"%s/t0.sim",dir);
+  FILE *f=fopen(name,"w");
+  if(!f) { perror(name); return false; }
+  fprintf(f,"atr 3B 24 00 30 42 30 30\n");
+  fprintf(f,"read 80 10 00 00 04 = 01 02 03 04 90 00\n");
+  fprintf(f,"wait %d\n",wait);
+  fprintf(f,"write 80 40 00 00 ?? = 90 00\n");
+  fprintf(f,"wait 0\n");
+  fprintf(f,"read 80 42 00 00 10 ="); PutHex(f,cwData,CW_LEN); fprintf(f," 90 00\n");
+  fclose(f);
+
+  snprintf(name,sizeof(name),"%s/t1.sim",dir);
+  if(!(f=fopen(name,"w"))) { perror(name); return false; }
+  // T=1, IFSC 0x20, BWI 4 CWI 5
+  unsigned char atr[] = { 0x3B,0x80,0x81,0x31,0x20,0x45,0x00 };
+  atr[sizeof(atr)-1]=XorSum(atr+1,sizeof(atr)-2);
+  fprintf(f,"atr"); PutHex(f,atr,sizeof(atr)); fprintf(f,"\n");
+  fprintf(f,"wait %d\n",wait);
+  fprintf(f,"block 00 00 %02X = 00 00 %02X",ECM_LEN,CW_LEN+2); PutHex(f,cwData,CW_LEN); fprintf(f," 90 00\n");
+  fclose(f);
+
+  snprintf(name,sizeof(name),"%s/cardslot.conf",dir);
+  if(!(f=fopen(name,"w"))) { perror(name); return false; }
+  fprintf(f,"sim:%s/t0.sim:%d:%d\n",dir,delay,jitter);
+  fprintf(f,"sim:%s/t1.sim:%d:%d\n",dir,delay,jitter);
+  fclose(f);
+  return true;
+}
+
+static int CmpInt(const void *a, const void *b)
+{
+  return *(const int *)a-*(const int *)b;
+}
+
+static uint64_t NowUs(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return (uint64_t)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+static int Bench(int id, const char *name, int count)
+{
+  if(!smartcards.HaveCard(id)) {
+    printf("%s: card not detected\n",name);
+    return count;
+    }
+  unsigned char ecm[ECM_LEN], cw[CW_LEN];
+  for(int i=0; i<ECM_LEN; i++) ecm[i]=i;
+  int *t=MALLOC(int,count), bad=0;
+  if(!t) return count;
+  for(int i=0; i<count; i++) {
+    memset(cw,0,sizeof(cw));
+    uint64_t start=NowUs();
+    cSmartCard *card=smartcards.LockCard(id,SC_PRI_ECM);
+    bool ok=false;
+    if(card) {
+      ok=card->Decode(0,ecm,cw);
+      smartcards.ReleaseCard(card);
+      }
+    t[i]=(int)(NowUs()-start);
+    if(!ok || memcmp(cw,cwData,CW_LEN)) bad++;
+    }
+  qsort(t,count,sizeof(int),CmpInt);
+  long long sum=0;
+  for(int i=0; i<count; i++) sum+=t[i];
+  printf("%s: %d exchanges, %d failed, min %d avg %lld p50 %d p99 %d max %d us\n",
+         name,count,bad,t[0],sum/count,t[count/2],t[(count*99)/100],t[count-1]);
+  free(t);
+  return bad;
+}
+
+int main(int argc, char *argv[])
+{
+  int count=50, delay=0, jitter=0, wait=20000, opt;
+  bool verbose=false;
+  while((opt=getopt(argc,argv,"n:d:j:w:v"))!=-1) {
+    switch(opt) {
+      case 'n': count=max(atoi(optarg),1); break;
+      case 'd': delay=atoi(optarg); break;
+      case 'j': jitter=atoi(optarg); break;
+      case 'w': wait=atoi(optarg); break;
+      case 'v': verbose=true; break;
+      default:  printf("usage: %s [-n count] [-d delay] [-j jitter] [-w wait] [-v]\n",argv[0]); exit(1);
+      }
+    }
+  if(verbose) LogAll(); else LogNone();
+
+  char dir[]="/tmp/testCardSim.XXXXXX";
+  if(!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+  if(!WriteScripts(dir,delay,jitter,wait)) return 1;
+  Feature.NeedsSmartCard();
+  InitAll(dir);
+
+  int bad=Bench(MAKE_SC_ID('B','N','C','0'),"T0",count);
+  bad+=Bench(MAKE_SC_ID('B','N','C','1'),"T1",count);
+  smartcards.Shutdown();
+
+  char cmd[64];
+  snprintf(cmd,sizeof(cmd),"rm -rf %s",dir);
+  if(system(cmd)) printf("cleanup of %s failed\n",dir);
+  return bad ? 1:0;
+}
@@ -0,0 +1,422 @@
+/*
+ * Test vectors and micro-benchmarks for the crypto core (crypto.c).
+ *
+ * DES: known answer tests, a bit-exact comparison of cDes::Des() against
+ * the original bit-by-bit implementation for all mode flag combinations
+ * (including custom PC1/PC2 tables and a Viaccess style Mod()), and a speed
+ * comparison of both.
+ *
+ * AES: FIPS-197 vector, cAES against openssl's low level AES and the
+ * constant time support code, and per message timings (new cAES, SetKey,
+ * Decrypt) of the old AES_set_*_key()/AES_decrypt() code, cAES and the
+ * constant time code.
+ *
+ * RSA: cRSA (cached Montgomery contexts) and RSABatch() against a plain
+ * BN_mod_exp() for odd and even moduli, and per message timings of the old
+ * fresh-context BN_mod_exp() and cRSA for some modulus/exponent sizes.
+ *
+ * usage: testCrypto [-n count]
+ *   -n count   iterations per benchmark (default 200000)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <openssl/aes.h>
+
+#include <ffdecsawrapper/tools.h>
+
+#include "crypto.h"
+#include "helper.h"
+#include "misc.h"
+#include "compat.h"
+
+static int fails=0;
+
+static void Check(bool ok, const char *what)
+{
+  if(!ok) { printf("FAIL: %s\n",what); fails++; }
+}
+
+static uint64_t NowUs(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv,0);
+  return (uint64_t)tv.tv_sec*1000000+tv.tv_usec;
+}
+
+static void Hex(unsigned char *out, const char *hex, int len)
+{
+  const char *p=hex;
+  if(GetHex(p,out,len,false)!=len) { printf("bad test vector %s\n",hex); exit(1); }
+}
+
+static void Random(unsigned char *d, int len)
+{
+  for(int i=0; i<len; i++) d[i]=rand();
+}
+
+// -- DES ----------------------------------------------------------------------
+
+// the original bit-by-bit implementation, as reference
+#define shiftin(V,R,n) ((V<<1)+(((R)>>(n))&1))
+#define rol28(V,n) ((V<<(n) ^ V>>(28-(n)))&0xfffffffL)
+#define ror28(V,n) ((V>>(n) ^ V<<(28-(n)))&0xfffffffL)
+#define hash(T) ((T&0x0000ffffL) | ((T>>8)&0x00ff0000L) | ((T<<8)&0xff000000L))
+
+#define DESROUND(C,D,T) { \
+   unsigned int s=0; \
+   for(int j=7, k=0; j>=0; j--) { \
+     unsigned int v=0, K=0; \
+     for(int t=5; t>=0; t--, k++) { \
+       v=shiftin(v,T,E[k]); \
+       if(PC2[k]<29) K=shiftin(K,C,28-PC2[k]); \
+       else          K=shiftin(K,D,56-PC2[k]); \
+       } \
+     s=(s<<4) + S[7-j][v^K]; \
+     } \
+   T=0; \
+   for(int j=31; j>=0; j--) T=shiftin(T,s,P[j]); \
+   }
+
+#define DESHASH(T) { if(mode&DES_HASH) T=hash(T); }
+
+class cDesRef : public cDes {
+public:
+  cDesRef(const unsigned char *pc1=0, const unsigned char *pc2=0):cDes(pc1,pc2) {}
+  void DesRef(unsigned char *data, const unsigned char *key, int mode) const;
+  };
+
+void cDesRef::DesRef(unsigned char *data, const unsigned char *key, int mode) const
+{
+  unsigned char mkey[8];
+  if(mode&DES_PC1) {
+    memcpy(mkey,key,sizeof(mkey));
+    Permute(mkey,PC1,56);
+    key=mkey;
+    }
+  if(mode&DES_IP) Permute(data,IP,64);
+  unsigned int C=UINT32_BE(key  ) >> 4;
+  unsigned int D=UINT32_BE(key+3) & 0xfffffffL;
+  unsigned int L=UINT32_BE(data  );
+  unsigned int R=UINT32_BE(data+4);
+  if(!(mode&DES_RIGHT)) {
+    for(int i=15; i>=0; i--) {
+      C=rol28(C,LS[15-i]); D=rol28(D,LS[15-i]);
+      unsigned int T=R;
+      if(mode&DES_MOD) T=Mod(T,key[7]);
+      DESROUND(C,D,T);
+      DESHASH(T);
+      T^=L; L=R; R=T;
+      }
+    }
+  else {
+    for(int i=15; i>=0; i--) {
+      unsigned int T=R;
+      if(mode&DES_MOD) T=Mod(T,key[7]);
+      DESROUND(C,D,T);
+      DESHASH(T);
+      T^=L; L=R; R=T;
+      C=ror28(C,LS[i]); D=ror28(D,LS[i]);
+      }
+    }
+  BYTE4_BE(data  ,R);
+  BYTE4_BE(data+4,L);
+  if(mode&DES_FP) Permute(data,FP,64);
+}
+
+// same modification as cViaccess
+class cDesRefMod : public cDesRef {
+protected:
+  virtual unsigned int Mod(unsigned int R, unsigned int key7) const
+  {
+    if(key7!=0) {
+      const unsigned int key5=(R>>24)&0xff;
+      unsigned int al=key7*key5 + key7 + key5;
+      al=(al&0xff)-((al>>8)&0xff);
+      if(al&0x100) al++;
+      R=(R&0x00ffffffL) + (al<<24);
+      }
+    return R;
+  }
+  };
+
+static void DesVectors(void)
+{
+  static const struct { const char *key, *plain, *crypt; } vec[] = {
+    { "133457799BBCDFF1","0123456789ABCDEF","85E813540F0AB405" },
+    { "0000000000000000","0000000000000000","8CA64DE9C1B123A7" },
+    { "FFFFFFFFFFFFFFFF","FFFFFFFFFFFFFFFF","7359B2163E4EDC58" },
+    { "0123456789ABCDEF","4E6F772069732074","3FA40E8A984D4815" },
+    { "0E329232EA6D0D73","8787878787878787","0000000000000000" },
+    };
+  cDes des;
+  for(unsigned int i=0; i<sizeof(vec)/sizeof(vec[0]); i++) {
+    unsigned char key[8], plain[8], crypt[8], data[8];
+    Hex(key,vec[i].key,8); Hex(plain,vec[i].plain,8); Hex(crypt,vec[i].crypt,8);
+    memcpy(data,plain,8);
+    des.Des(data,key,PRV_DES_ENCRYPT);
+    Check(!memcmp(data,crypt,8),"DES encrypt vector");
+    des.Des(data,key,PRV_DES_DECRYPT);
+    Check(!memcmp(data,plain,8),"DES decrypt vector");
+    }
+}
+
+static void DesCompare(const cDesRef &des, const char *name)
+{
+  static const int flags[] = { DES_RIGHT, DES_HASH, DES_PC1, DES_IP, DES_FP, DES_MOD };
+  const int nf=sizeof(flags)/sizeof(flags[0]);
+  int bad=0;
+  for(int m=0; m<(1<<nf); m++) {
+    int mode=0;
+    for(int f=0; f<nf; f++) if(m&(1<<f)) mode|=flags[f];
+    // key byte 7 is undefined for Mod() after PC1
+    if((mode&DES_PC1) && (mode&DES_MOD)) continue;
+    for(int i=0; i<200; i++) {
+      unsigned char key[8], d1[8], d2[8];
+      Random(key,8); Random(d1,8);
+      if(i&1) key[7]=0;
+      memcpy(d2,d1,8);
+      des.Des(d1,key,mode);
+      des.DesRef(d2,key,mode);
+      if(memcmp(d1,d2,8)) bad++;
+      // again from the key schedule cache
+      des.Des(d1,key,mode);
+      des.DesRef(d2,key,mode);
+      if(memcmp(d1,d2,8)) bad++;
+      }
+    }
+  if(bad) printf("%s: %d mismatches\n",name,bad);
+  Check(!bad,name);
+}
+
+static void RandomPerm(unsigned char *p, int n, int from, int to, bool noParity)
+{
+  unsigned char pool[64];
+  int c=0;
+  for(int i=from; i<=to; i++) if(!noParity || (i&7)) pool[c++]=i;
+  for(int i=0; i<n; i++) {
+    int k=i+rand()%(c-i);
+    unsigned char t=pool[i]; pool[i]=pool[k]; pool[k]=t;
+    p[i]=pool[i];
+    }
+}
+
+static void DesBench(const cDesRef &des, int mode, const char *name, int count)
+{
+  unsigned char key[8], data[8];
+  Random(key,8); Random(data,8);
+  uint64_t t0=NowUs();
+  for(int i=0; i<count; i++) des.DesRef(data,key,mode);
+  uint64_t t1=NowUs();
+  for(int i=0; i<count; i++) des.Des(data,key,mode);
+  uint64_t t2=NowUs();
+  for(int i=0; i<count; i++) { key[i&7]^=data[0]; des.Des(data,key,mode); }
+  uint64_t t3=NowUs();
+  printf("%-14s ref %6.0f ns  new %5.0f ns (%4.1fx)  new, key changing %5.0f ns\n",name,
+         (t1-t0)*1000.0/count,(t2-t1)*1000.0/count,(double)(t1-t0)/(t2-t1+1),(t3-t2)*1000.0/count);
+}
+
+static void TestDes(int count)
+{
+  DesVectors();
+  cDesRef des;
+  DesCompare(des,"DES std tables");
+  cDesRefMod mdes;
+  DesCompare(mdes,"DES with Mod()");
+  unsigned char pc1[56], pc2[48];
+  RandomPerm(pc1,56,1,64,true);
+  RandomPerm(pc2,48,1,56,false);
+  cDesRef cdes(pc1,pc2);
+  DesCompare(cdes,"DES custom PC1/PC2");
+
+  DesBench(des,PRV_DES_ENCRYPT,"DES encrypt",count);
+  DesBench(des,PRV_DES_DECRYPT,"DES decrypt",count);
+  DesBench(mdes,VIA_DES_HASH,"VIA DES hash",count);
+}
+
+// -- AES ----------------------------------------------------------------------
+
+#include "support/aes_ct.c"
+
+// what cAES did before: both key schedules on SetKey, block by block
+static void AesRef(const unsigned char *key, unsigned char *data, int len)
+{
+  AES_KEY dkey, ekey;
+  AES_set_decrypt_key(key,128,&dkey);
+  AES_set_encrypt_key(key,128,&ekey);
+  for(int i=0; i<len; i+=16) AES_decrypt(data+i,data+i,&dkey);
+}
+
+static void AesVectors(void)
+{
+  unsigned char key[16], plain[16], crypt[16], data[16], rk[176];
+  Hex(key,"000102030405060708090a0b0c0d0e0f",16);
+  Hex(plain,"00112233445566778899aabbccddeeff",16);
+  Hex(crypt,"69c4e0d86a7b0430d8cdb78070b4c55a",16);
+  cAES aes;
+  aes.SetKey(key);
+  Check(aes.Encrypt(plain,16,data)==16 && !memcmp(data,crypt,16),"AES encrypt vector");
+  Check(aes.Decrypt(data,16) && !memcmp(data,plain,16),"AES decrypt vector");
+  AesCtSetKey(rk,key);
+  AesCtEncrypt(rk,plain,data);
+  Check(!memcmp(data,crypt,16),"AES-ct encrypt vector");
+  AesCtDecrypt(rk,data,data);
+  Check(!memcmp(data,plain,16),"AES-ct decrypt vector");
+}
+
+static void AesCompare(void)
+{
+  int bad=0;
+  for(int i=0; i<500; i++) {
+    unsigned char key[16], d1[256], d2[256], d3[256], rk[176];
+    const int len=16*(1+i%16);
+    Random(key,16); Random(d1,len);
+    AES_KEY ekey;
+    AES_set_encrypt_key(key,128,&ekey);
+    for(int j=0; j<len; j+=16) AES_encrypt(d1+j,d2+j,&ekey);
+    cAES aes;
+    aes.SetKey(key);
+    if(aes.Encrypt(d1,len,d3)!=len || memcmp(d2,d3,len)) bad++;
+    AesCtSetKey(rk,key);
+    for(int j=0; j<len; j+=16) AesCtEncrypt(rk,d1+j,d3+j);
+    if(memcmp(d2,d3,len)) bad++;
+    for(int j=0; j<len; j+=16) AesCtDecrypt(rk,d2+j,d3+j);
+    if(memcmp(d1,d3,len)) bad++;
+    if(!aes.Decrypt(d2,len,d3) || memcmp(d1,d3,len)) bad++;
+    AesRef(key,d2,len);
+    if(memcmp(d1,d2,len)) bad++;
+    }
+  if(bad) printf("AES: %d mismatches\n",bad);
+  Check(!bad,"AES compare");
+}
+
+static void AesBench(int len, int count)
+{
+  unsigned char key[16], data[1024], rk[176];
+  Random(key,16); Random(data,len);
+  uint64_t t0=NowUs();
+  for(int i=0; i<count; i++) AesRef(key,data,len);
+  uint64_t t1=NowUs();
+  for(int i=0; i<count; i++) {
+    cAES aes;
+    aes.SetKey(key);
+    aes.Decrypt(data,len);
+    }
+  uint64_t t2=NowUs();
+  const int ctCount=max(count/50,1);
+  for(int i=0; i<ctCount; i++) {
+    AesCtSetKey(rk,key);
+    for(int j=0; j<len; j+=16) AesCtDecrypt(rk,data+j,data+j);
+    }
+  uint64_t t3=NowUs();
+  printf("AES %4d bytes  ref %6.0f ns  cAES %5.0f ns (%4.1fx)  const time %7.0f ns\n",len,
+         (t1-t0)*1000.0/count,(t2-t1)*1000.0/count,(double)(t1-t0)/(t2-t1+1),(t3-t2)*1000.0/ctCount);
+}
+
+static void TestAes(int count)
+{
+  AesVectors();
+  AesCompare();
+  AesBench(16,count);
+  AesBench(128,count);
+  AesBench(1024,count/8);
+}
+
+// -- RSA ----------------------------------------------------------------------
+
+// what cRSA did before: new BN_CTX and Montgomery setup on every call
+static int RsaRef(unsigned char *out, const unsigned char *in, int n, const BIGNUM *exp, const BIGNUM *mod)
+{
+  cBN r, d;
+  cBNctx ctx;
+  if(!d.GetLE(in,n) || !BN_mod_exp(r,d,exp,mod,ctx)) return 0;
+  return r.PutLE(out,n);
+}
+
+static void RsaKey(cBN &exp, cBN &mod, int bits, int ebits, bool odd)
+{
+  BN_rand(mod,bits,BN_RAND_TOP_ONE,odd ? BN_RAND_BOTTOM_ODD:BN_RAND_BOTTOM_ANY);
+  if(!odd) BN_clear_bit(mod,0);
+  if(ebits<=17) BN_set_word(exp,ebits<=2 ? 3:65537);
+  else BN_rand(exp,ebits,BN_RAND_TOP_ONE,BN_RAND_BOTTOM_ANY);
+}
+
+static void RsaCompare(void)
+{
+  cRSA rsa;
+  int bad=0;
+  for(int i=0; i<200; i++) {
+    cBN exp, mod;
+    const int bits=256+64*(i%13);
+    RsaKey(exp,mod,bits,(i&1) ? bits:17,i%7!=3);
+    // mod bytes plus some, so that the input may exceed the modulus
+    const int n=bits/8+(i%3);
+    unsigned char in[4][160], o1[160], o2[160];
+    Random(in[0],n);
+    const int r1=RsaRef(o1,in[0],n,exp,mod);
+    const int r2=rsa.RSA(o2,in[0],n,exp,mod);
+    if(r1!=r2 || memcmp(o1,o2,n)) bad++;
+    struct RsaJob jobs[4];
+    unsigned char out[4][160];
+    for(int j=0; j<4; j++) {
+      if(j) Random(in[j],n);
+      jobs[j].in=in[j]; jobs[j].out=out[j]; jobs[j].len=n;
+      }
+    if(rsa.RSABatch(jobs,4,exp,mod)!=4) bad++;
+    for(int j=0; j<4; j++)
+      if(RsaRef(o1,in[j],n,exp,mod)!=jobs[j].res || memcmp(o1,out[j],n)) bad++;
+    }
+  if(bad) printf("RSA: %d mismatches\n",bad);
+  Check(!bad,"RSA compare");
+}
+
+static void RsaBench(int bits, int ebits, int count)
+{
+  cRSA rsa;
+  cBN exp, mod;
+  RsaKey(exp,mod,bits,ebits,true);
+  const int n=bits/8;
+  unsigned char data[128], out[128];
+  Random(data,n);
+  data[n-1]&=0x7f;
+  uint64_t t0=NowUs();
+  for(int i=0; i<count; i++) RsaRef(out,data,n,exp,mod);
+  uint64_t t1=NowUs();
+  for(int i=0; i<count; i++) rsa.RSA(out,data,n,exp,mod);
+  uint64_t t2=NowUs();
+  printf("RSA %4d bit mod, %4d bit exp  ref %8.0f ns  cRSA %8.0f ns (%4.2fx)\n",bits,BN_num_bits(exp),
+         (t1-t0)*1000.0/count,(t2-t1)*1000.0/count,(double)(t1-t0)/(t2-t1+1));
+}
+
+static void TestRsa(int count)
+{
+  RsaCompare();
+  RsaBench(512,17,count/4);
+  RsaBench(1024,17,count/8);
+  RsaBench(512,512,count/200);
+  RsaBench(1024,1024,count/1000);
+}
+
+// ----------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+  int count=200000, opt;
+  while((opt=getopt(argc,argv,"n:"))!=-1) {
+    switch(opt) {
+      case 'n': count=max(atoi(optarg),1); break;
+      default:  printf("usage: %s [-n count]\n",argv[0]); exit(1);
+      }
+    }
+  LogNone();
+  srand(1);
+  TestDes(count);
+  TestAes(count);
+  TestRsa(count);
+  if(fails) printf("%d tests FAILED\n",fails);
+  else printf("all tests passed\n");
+  return fails ? 1:0;
+}
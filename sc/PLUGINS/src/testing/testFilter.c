@@ -0,0 +1,209 @@
+/*
+ * cAction timer tests, without a device.
+ * Filters are never started, Wakeup() stands in for data arrival as it
+ * bumps the filter's data time in the same way as a section read does.
+ *
+ * idle:    a filter gets data before its idle deadline and then goes quiet,
+ *          the idle call must still follow one idle time after the data.
+ * timer:   a re-set SetTimer() fires once, at the last deadline.
+ * detach:  an action detaching from inside its Process() doesn't hang and
+ *          isn't called again.
+ * wakeup:  Wakeup() starts an action without filters and calls Woken(), and
+ *          doesn't wait while a slow Process() of the action runs.
+ * shutdown: actions still attached when the reactors are shut down can be
+ *          deleted afterwards (best run under valgrind).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <ffdecsawrapper/tools.h>
+
+#include "filter.h"
+#include "misc.h"
+#include "log.h"
+#include "compat.h"
+
+#define IDLE_MS   200
+#define SLACK_MS  80
+
+static int fails=0;
+
+static void Check(bool ok, const char *what)
+{
+  if(!ok) { printf("FAIL: %s\n",what); fails++; }
+}
+
+// -- cTestAction --------------------------------------------------------------
+
+class cTestAction : public cAction {
+private:
+  cMutex mutex;
+  uint64_t start;
+  int calls[2], last[2];
+protected:
+  virtual void Process(cPidFilter *filter, unsigned char *data, int len);
+public:
+  cPidFilter *f[2];
+  bool detach;
+  //
+  cTestAction(void);
+  virtual ~cTestAction();
+  void Wakeup(int n) { f[n]->Wakeup(); }
+  int Elapsed(void) { return (int)(cTimeMs::Now()-start); }
+  int Calls(int n) { cMutexLock lock(&mutex); return calls[n]; }
+  int Last(int n) { cMutexLock lock(&mutex); return last[n]; }
+  };
+
+cTestAction::cTestAction(void)
+:cAction("test",0,"dev0")
+{
+  memset(calls,0,sizeof(calls)); memset(last,0,sizeof(last));
+  detach=false;
+  start=cTimeMs::Now();
+  f[0]=NewFilter(IDLE_MS);
+  f[1]=NewFilter(0);
+}
+
+cTestAction::~cTestAction()
+{
+  Detach();
+}
+
+void cTestAction::Process(cPidFilter *filter, unsigned char *data, int len)
+{
+  cMutexLock lock(&mutex);
+  int n=filter==f[0] ? 0:1;
+  calls[n]++;
+  last[n]=Elapsed();
+  if(detach) Detach();
+}
+
+// -- cWakeAction --------------------------------------------------------------
+
+class cWakeAction : public cAction {
+private:
+  cMutex mutex;
+  int woken;
+protected:
+  virtual void Process(cPidFilter *filter, unsigned char *data, int len);
+  virtual void Woken(void);
+public:
+  cPidFilter *f;
+  //
+  cWakeAction(void);
+  virtual ~cWakeAction();
+  void Wake(void) { Wakeup(); }
+  void Start(void) { f=NewFilter(0); f->Wakeup(); }
+  int Woke(void) { cMutexLock lock(&mutex); return woken; }
+  };
+
+cWakeAction::cWakeAction(void)
+:cAction("wake",0,"dev0")
+{
+  woken=0; f=0;
+  Priority(10);
+}
+
+cWakeAction::~cWakeAction()
+{
+  Detach();
+}
+
+void cWakeAction::Process(cPidFilter *filter, unsigned char *data, int len)
+{
+  // stands in for a slow card update
+  cCondWait::SleepMs(IDLE_MS);
+}
+
+void cWakeAction::Woken(void)
+{
+  cMutexLock lock(&mutex);
+  woken++;
+}
+
+// ----------------------------------------------------------------
+
+static void TestIdle(void)
+{
+  cTestAction a;
+  cCondWait::SleepMs(IDLE_MS/2);
+  a.Wakeup(0);
+  // wait for the wakeup call to run
+  for(int i=0; i<50 && a.Calls(0)<1; i++) cCondWait::SleepMs(2);
+  const int data=a.Elapsed();
+  cCondWait::SleepMs(IDLE_MS+SLACK_MS);
+  const int n=a.Calls(0), at=a.Last(0);
+  printf("idle: data at %d ms, %d calls, last at %d ms\n",data,n,at);
+  Check(n==2,"idle call after data");
+  Check(n!=2 || (at>=data+IDLE_MS-SLACK_MS/4 && at<=data+IDLE_MS+SLACK_MS),"idle call timing");
+}
+
+static void TestTimer(void)
+{
+  cTestAction a;
+  a.f[1]->SetTimer(IDLE_MS/4);
+  a.f[1]->SetTimer(0);
+  a.f[1]->SetTimer(IDLE_MS/2);
+  cCondWait::SleepMs(IDLE_MS);
+  const int n=a.Calls(1), at=a.Last(1);
+  printf("timer: %d calls, at %d ms\n",n,at);
+  Check(n==1,"timer fires once");
+  Check(n!=1 || (at>=IDLE_MS/2 && at<=IDLE_MS/2+SLACK_MS),"timer timing");
+}
+
+static void TestDetach(void)
+{
+  cTestAction a;
+  a.detach=true;
+  a.Wakeup(1);
+  for(int i=0; i<100 && a.Calls(1)<1; i++) cCondWait::SleepMs(2);
+  cCondWait::SleepMs(20);
+  a.Wakeup(1);
+  cCondWait::SleepMs(50);
+  printf("detach: %d calls\n",a.Calls(1));
+  Check(a.Calls(1)==1,"detach from Process()");
+}
+
+static void TestWakeup(void)
+{
+  cWakeAction a;
+  a.Wake();
+  for(int i=0; i<50 && a.Woke()<1; i++) cCondWait::SleepMs(2);
+  Check(a.Woke()==1,"woken without filters");
+  a.Start();
+  cCondWait::SleepMs(SLACK_MS/4);
+  cTimeMs t;
+  a.Wake();
+  const int took=t.Elapsed();
+  for(int i=0; i<2*IDLE_MS && a.Woke()<3; i++) cCondWait::SleepMs(2);
+  printf("wakeup: %d ms during Process(), woken %d times\n",took,a.Woke());
+  Check(took<SLACK_MS/4,"wakeup doesn't wait for Process()");
+  Check(a.Woke()==3,"woken after Process()");
+}
+
+static void TestShutdown(void)
+{
+  cTestAction *a=new cTestAction;
+  cTestAction *b=new cTestAction;
+  a->Wakeup(0);
+  cCondWait::SleepMs(20);
+  delete b;
+  reactors.Shutdown();
+  delete a;
+  printf("shutdown: done\n");
+}
+
+int main(int argc, char *argv[])
+{
+  LogNone();
+  TestIdle();
+  TestTimer();
+  TestDetach();
+  TestWakeup();
+  TestShutdown();
+  if(fails) printf("%d tests FAILED\n",fails);
+  else printf("all tests passed\n");
+  return fails ? 1:0;
+}
@@ -0,0 +1,178 @@
+/*
+ * cPlainKeys lookup benchmark.
+ * Writes a synthetic SoftCam.Key with many entries to a temporary directory,
+ * loads it and times FindKey() lookups and key updates. The results of the
+ * indexed lookup are checked against a plain scan of the key list, also after
+ * two threads added new keys concurrently, which grows the index.
+ * Finally the file is changed in a few lines and reloaded, checking that
+ * items of unchanged lines are reused and the list keeps the file order.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "data.h"
+#include "system-common.h"
+#include "log.h"
+#include "compat.h"
+
+static cPlainKeyTypeReg<cPlainKeyStd,'X'> KeyReg;
+
+static cPlainKey *ScanKey(int Type, int Id, int Keynr, int Size, cPlainKey *key)
+{
+  for(key=key?keys.Next(key):keys.First(); key; key=keys.Next(key))
+    if(key->type==Type && key->id==Id && key->keynr==Keynr && (Size<0 || key->Size()==Size))
+      break;
+  return key;
+}
+
+static bool VerifyKey(int id, int nr)
+{
+  cPlainKey *a=0, *b=0;
+  do {
+    a=keys.FindKeyNoTrig('X',id,nr,8,a);
+    b=ScanKey('X',id,nr,8,b);
+    if(a!=b) return false;
+    } while(a);
+  return true;
+}
+
+static int Verify(const int *ids, int n)
+{
+  int errors=0;
+  for(int i=0; i<n; i++)
+    if(!VerifyKey(ids[i]&0xFFFF,ids[i]&1)) errors++;
+  return errors;
+}
+
+class cUpdater : public cThread {
+private:
+  int base, num;
+protected:
+  virtual void Action(void);
+public:
+  cUpdater(int Base, int Num):cThread("updater") { base=Base; num=Num; }
+  };
+
+void cUpdater::Action(void)
+{
+  unsigned char k[8];
+  for(int i=0; i<num; i++) {
+    for(int j=0; j<8; j++) k[j]=i>>(j&3);
+    keys.NewKey('X',base+i/2,i&1,k,sizeof(k));
+    }
+}
+
+static bool WriteKeys(const char *name, int lines, int changed)
+{
+  FILE *f=fopen(name,"w");
+  if(!f) { perror(name); return false; }
+  srand(4711);
+  for(int i=0; i<lines; i++) {
+    // every 16th id gets a second key with the same keynr
+    int r1=rand(), r2=rand();
+    if(changed && i%changed==0) r1^=0x5A5A;
+    fprintf(f,"X %04X %02X %08X%08X ; line %d\n",(i/2)&0xFFFF,i&1,r1,r2,i);
+    if((i&15)==0) fprintf(f,"X %04X %02X %08X%08X\n",(i/2)&0xFFFF,i&1,rand(),rand());
+    }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  int lines=argc>1 ? atoi(argv[1]) : 50000;
+  int loops=argc>2 ? atoi(argv[2]) : 200000;
+  LogNone();
+
+  char dir[]="/tmp/testKeys.XXXXXX";
+  if(!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+  char name[64];
+  snprintf(name,sizeof(name),"%s/SoftCam.Key",dir);
+  if(!WriteKeys(name,lines,0)) return 1;
+
+  cStructLoaders::SetCfgDir(dir);
+  cTimeMs start;
+  keys.Load(false);
+  printf("loaded %d keys in %d ms\n",keys.Count(),(int)start.Elapsed());
+
+  int *ids=MALLOC(int,loops);
+  for(int i=0; i<loops; i++) ids[i]=rand()%(lines/2+lines/8); // some misses
+
+  int errors=Verify(ids,loops/100);
+  printf("verify: %d mismatches\n",errors);
+
+  // id 1 keynr 1 stays, id 0 keynr 0 changes with every 1000th line
+  cPlainKey *same=keys.FindKeyNoTrig('X',1,1,8);
+  cPlainKey *old=keys.FindKeyNoTrig('X',0,0,8);
+  if(!WriteKeys(name,lines,1000)) return 1;
+  struct utimbuf ut;
+  ut.actime=ut.modtime=time(0)+10;
+  utime(name,&ut);
+  start.Set();
+  keys.Load(true);
+  printf("reloaded %d keys in %d ms\n",keys.Count(),(int)start.Elapsed());
+  int bad=0;
+  if(!same || keys.FindKeyNoTrig('X',1,1,8)!=same) { printf("reload: unchanged key not reused\n"); bad++; }
+  if(!old || keys.FindKeyNoTrig('X',0,0,8)==old) { printf("reload: changed key not replaced\n"); bad++; }
+  keys.Purge();
+  int line=-1, order=0;
+  for(cPlainKey *k=keys.First(); k; k=keys.Next(k)) {
+    int l;
+    if(k->Comment() && sscanf(k->Comment()," ; line %d",&l)==1) {
+      if(l<=line) order++;
+      line=l;
+      }
+    }
+  if(order || line!=lines-1) { printf("reload: %d items out of order (last line %d)\n",order,line); bad++; }
+
+  int found=0;
+  start.Set();
+  for(int i=0; i<loops/100; i++)
+    if(ScanKey('X',ids[i]&0xFFFF,ids[i]&1,8,0)) found++;
+  int scan=start.Elapsed();
+  printf("scan : %d lookups in %d ms (%d found)\n",loops/100,scan,found);
+  found=0;
+  start.Set();
+  for(int i=0; i<loops; i++)
+    if(keys.FindKeyNoTrig('X',ids[i]&0xFFFF,ids[i]&1,8)) found++;
+  printf("index: %d lookups in %d ms (%d found)\n",loops,(int)start.Elapsed(),found);
+
+  start.Set();
+  unsigned char k[8];
+  for(int i=0; i<1000; i++) {
+    for(int j=0; j<8; j++) k[j]=rand();
+    keys.NewKey('X',rand()%(lines/2),rand()&1,k,sizeof(k));
+    }
+  printf("1000 key updates in %d ms\n",(int)start.Elapsed());
+
+  errors+=Verify(ids,loops/100);
+  printf("verify after updates: %d mismatches\n",errors);
+
+  // new ids beyond the file, enough to grow the index at least once
+  const int add=keys.Count()*2;
+  cUpdater u1(0x8000,add/2), u2(0xC000,add/2);
+  start.Set();
+  u1.Start(); u2.Start();
+  int hits=0;
+  while(u1.Active() || u2.Active())
+    for(int i=0; i<1000; i++)
+      if(keys.FindKeyNoTrig('X',0x8000+(i>>1),i&1,8)) hits++;
+  printf("%d concurrent key updates in %d ms (%d found meanwhile)\n",add,(int)start.Elapsed(),hits);
+  int nerr=Verify(ids,loops/100);
+  for(int i=0; i<add/2; i++) {
+    // full chain check for some, the scan takes long
+    if(!keys.FindKeyNoTrig('X',0x8000+i/2,i&1,8) || (i%256==0 && !VerifyKey(0x8000+i/2,i&1))) nerr++;
+    if(!keys.FindKeyNoTrig('X',0xC000+i/2,i&1,8) || (i%256==1 && !VerifyKey(0xC000+i/2,i&1))) nerr++;
+    }
+  printf("verify after concurrent updates: %d mismatches\n",nerr);
+  errors+=nerr;
+
+  free(ids);
+  unlink(name);
+  rmdir(dir);
+  return errors>0 || bad>0;
+}
@@ -0,0 +1,73 @@
+/*
+ * cMsgCache micro-benchmark.
+ * Feeds a stream of pseudo random ECM/EMM sized messages, where a part of
+ * them are repeats of recent ones, through Get()/Cache() and reports the
+ * throughput for each lookup/hash combination. Index and linear scan must
+ * give identical results for the same hash function.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "system.h"
+#include "misc.h"
+#include "log.h"
+#include "compat.h"
+
+#define MSG_LEN   184
+#define NUM_MSGS  512
+
+static unsigned char msgs[NUM_MSGS][MSG_LEN];
+
+static void MakeMsgs(void)
+{
+  srand(4711);
+  for(int i=0; i<NUM_MSGS; i++)
+    for(int j=0; j<MSG_LEN; j++) msgs[i][j]=rand();
+}
+
+static double Run(int numCache, int flags, int loops, int &hits)
+{
+  cMsgCache cache(numCache,0,flags);
+  cache.SetMaxFail(2);
+  hits=0;
+  srand(42);
+  cTimeMs start;
+  for(int i=0; i<loops; i++) {
+    // 3/4 of the messages come from a small working set (repeats)
+    int n=(rand()&3) ? rand()%(numCache/2) : rand()%NUM_MSGS;
+    int id=cache.Get(msgs[n],MSG_LEN,0);
+    if(id>0) cache.Cache(id,(n&1)!=0,0);
+    else hits++;
+    }
+  return (double)loops*1000.0/(start.Elapsed()+1);
+}
+
+int main(int argc, char *argv[])
+{
+  int loops=argc>1 ? atoi(argv[1]) : 1000000;
+  LogNone();
+  MakeMsgs();
+  static const struct { int flags; const char *name; } modes[] = {
+    { MSGCACHE_MD5,                "scan/md5"    },
+    { 0,                           "scan/hash128"},
+    { MSGCACHE_INDEX|MSGCACHE_MD5, "index/md5"   },
+    { MSGCACHE_INDEX,              "index/hash128"},
+    };
+  static const int sizes[] = { 32, 256 };
+  for(unsigned int s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+    int ref[2]={ -1,-1 };
+    for(unsigned int m=0; m<sizeof(modes)/sizeof(modes[0]); m++) {
+      int hits, md5=(modes[m].flags&MSGCACHE_MD5)!=0;
+      double rate=Run(sizes[s],modes[m].flags,loops,hits);
+      printf("cache %3d %-14s: %10.0f msg/s (%d cached)\n",sizes[s],modes[m].name,rate,hits);
+      if(ref[md5]<0) ref[md5]=hits;
+      else if(ref[md5]!=hits) {
+        printf("ERROR: cached count differs from linear scan (%d)\n",ref[md5]);
+        return 1;
+        }
+      }
+    }
+  return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * SC-Seca EMM filter tests, without a card.
+ * A cSmartCardSeca gets a fake UA and provider through TestSetup() and
+ * AddEmmPid() is checked for every Blocker setting: which updates it claims
+ * and which section filters it adds for them.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#define TESTER
+#include "systems/sc-seca/sc-seca.c"
+
+#include "compat.h"
+
+#define EMM_PID 0x100
+
+static int fails=0;
+
+static void Check(bool ok, const char *what, int block)
+{
+  if(!ok) { printf("FAIL: %s (blocker %d)\n",what,block); fails++; }
+}
+
+static void Test(cSmartCardSeca *sc, int block, int sct, int mask, bool claim, int npids, const unsigned char *match)
+{
+  cPids pids;
+  blocker=block;
+  bool done=sc->AddEmmPid(&pids,0x0100,EMM_PID,sct,mask);
+  printf("blocker %d sct %02x: %s, %d filters\n",block,sct,done?"claimed":"default",pids.Count());
+  Check(done==claim,"claimed",block);
+  Check(pids.Count()==npids,"filter count",block);
+  if(match && pids.Count()>0) {
+    cPid *p=pids.First();
+    Check(p->pid==EMM_PID && p->sf.Matches(match,12),"filter matches",block);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned char ua[]  = { 0x00,0x00,0x12,0x34,0x56,0x78 };
+  static const unsigned char pi[]  = { 0x00,0x65 };
+  static const unsigned char sa[]  = { 0xAB,0xCD,0xEF };
+  static const unsigned char unique[12] = { 0x82,0x70,0x20,0x00,0x00,0x12,0x34,0x56,0x78 };
+  static const unsigned char shared[12] = { 0x84,0x70,0x20,0x00,0x65,0xAB,0xCD,0xEF };
+
+  LogNone();
+  cSmartCardSeca *sc=new cSmartCardSeca;
+  // no card yet, default filters unless everything is blocked
+  Test(sc,0,0x82,0xFE,false,0,0);
+  Test(sc,3,0x82,0xFE,true,0,0);
+  Test(sc,3,0x84,0xFF,true,0,0);
+
+  sc->TestSetup(ua,pi,sa);
+  Test(sc,0,0x82,0xFE,true,1,unique);
+  Test(sc,0,0x84,0xFF,true,1,shared);
+  Test(sc,1,0x82,0xFE,true,0,0);
+  Test(sc,1,0x84,0xFF,true,1,shared);
+  Test(sc,2,0x82,0xFE,true,1,unique);
+  Test(sc,2,0x84,0xFF,true,0,0);
+  Test(sc,3,0x82,0xFE,true,0,0);
+  Test(sc,3,0x84,0xFF,true,0,0);
+  delete sc;
+
+  if(fails) printf("%d tests FAILED\n",fails);
+  else printf("all tests passed\n");
+  return fails ? 1:0;
+}
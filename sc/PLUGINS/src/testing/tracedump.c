@@ -0,0 +1,100 @@
+/*
+ * Renders a binary trace file (LogTrace) as text, in the same format as
+ * the log output of HEXDUMP/LDUMP.
+ *
+ * usage: tracedump [-i] [-t tag] tracefile
+ *   -i      prefix each line with the thread id
+ *   -t tag  only show records whose tag starts with tag (e.g. core.ecm)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+static void Stamp(char *buff, int len, uint64_t stamp)
+{
+  time_t t=stamp/1000000;
+  struct tm tm_r;
+  int q=strftime(buff,len,"%b %e %T",localtime_r(&t,&tm_r));
+  snprintf(buff+q,len-q,".%03u",(unsigned int)(stamp%1000000/1000));
+}
+
+int main(int argc, char *argv[])
+{
+  const char *filter=0;
+  bool showTid=false;
+  int opt;
+  while((opt=getopt(argc,argv,"it:"))!=-1) {
+    switch(opt) {
+      case 'i': showTid=true; break;
+      case 't': filter=optarg; break;
+      default:  printf("usage: %s [-i] [-t tag] tracefile\n",argv[0]); exit(1);
+      }
+    }
+  if(optind>=argc) {
+    printf("usage: %s [-i] [-t tag] tracefile\n",argv[0]);
+    exit(1);
+    }
+  const char *name=argv[optind];
+  int fd=open(name,O_RDONLY);
+  struct stat st;
+  if(fd<0 || fstat(fd,&st)<0) { perror(name); exit(1); }
+  if(st.st_size<(off_t)sizeof(struct TraceHeader)) {
+    printf("%s: file too short\n",name);
+    exit(1);
+    }
+  const unsigned char *map=(const unsigned char *)mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+  if(map==MAP_FAILED) { perror("mmap"); exit(1); }
+  const struct TraceHeader *hdr=(const struct TraceHeader *)map;
+  if(memcmp(hdr->magic,TRACE_MAGIC,sizeof(hdr->magic)) || hdr->version!=TRACE_VERSION
+     || (uint64_t)st.st_size<hdr->hdrSize+hdr->size) {
+    printf("%s: not a trace file or unsupported version\n",name);
+    exit(1);
+    }
+  // snapshot, the trace may still be written to
+  uint64_t size=hdr->size, head=hdr->head, tail=hdr->tail;
+  const unsigned char *data=map+hdr->hdrSize;
+  int recs=0;
+  while(tail<head) {
+    const struct TraceRecord *r=(const struct TraceRecord *)(data+tail%size);
+    if(r->len<8 || r->len>size-tail%size) {
+      printf("corrupt record at %llu\n",(unsigned long long)tail);
+      break;
+      }
+    tail+=r->len;
+    if(r->c==0) continue; // padding
+    const char *tag=(const char *)(r+1);
+    const char *text=tag+r->tagLen;
+    const unsigned char *d=(const unsigned char *)(text+r->textLen);
+    if(filter && (strlen(filter)>r->tagLen || strncmp(tag,filter,strlen(filter)))) continue;
+    char stamp[32], pre[128];
+    Stamp(stamp,sizeof(stamp),r->stamp);
+    if(showTid) snprintf(pre,sizeof(pre),"%s [%d] [%.*s]",stamp,r->tid,r->tagLen,tag);
+    else snprintf(pre,sizeof(pre),"%s [%.*s]",stamp,r->tagLen,tag);
+    if(r->flags&TRACE_LINEDUMP) {
+      printf("%s %.*s",pre,r->textLen,text);
+      for(unsigned int i=0; i<r->dataLen; i++) printf(" %02x",d[i]);
+      printf("\n");
+      }
+    else {
+      printf("%s %.*s\n",pre,r->textLen,text);
+      for(unsigned int i=0; i<r->dataLen;) {
+        printf("%s %04x:",pre,i);
+        for(int l=0; l<16 && i<r->dataLen; l++) printf(" %02x",d[i++]);
+        printf("\n");
+        }
+      }
+    recs++;
+    }
+  fprintf(stderr,"%d records\n",recs);
+  munmap((void *)map,st.st_size);
+  close(fd);
+  return 0;
+}
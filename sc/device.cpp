@@ -259,6 +259,16 @@ int cDevice::OpenFilter(u_short Pid, u_char Tid, u_char Mask)
   return -1;
 }
 
+int cDevice::OpenFilter(u_short Pid, const u_char *Filter, const u_char *Mask, const u_char *Mode)
+{
+  return OpenFilter(Pid, Filter[0], Mask[0]);
+}
+
+int cDevice::OpenTsFilter(u_short Pid, int BuffSize)
+{
+  return -1;
+}
+
 void cDevice::CloseFilter(int Handle)
 {
   close(Handle);
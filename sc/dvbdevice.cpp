@@ -109,6 +109,12 @@ bool cDvbDevice::SetPid(cPidHandle *Handle, int Type, bool On)
 }
 
 int cDvbDevice::OpenFilter(u_short Pid, u_char Tid, u_char Mask)
+{
+  u_char Filter[DMX_FILTER_SIZE] = { Tid }, FMask[DMX_FILTER_SIZE] = { Mask }, Mode[DMX_FILTER_SIZE] = { 0 };
+  return OpenFilter(Pid, Filter, FMask, Mode);
+}
+
+int cDvbDevice::OpenFilter(u_short Pid, const u_char *Filter, const u_char *Mask, const u_char *Mode)
 {
   const char *FileName = *cDvbName(DEV_DVB_DEMUX, CardIndex());
   int f = open(FileName, O_RDWR | O_NONBLOCK);
@@ -118,12 +124,39 @@ int cDvbDevice::OpenFilter(u_short Pid, u_char Tid, u_char Mask)
      sctFilterParams.pid = Pid;
      sctFilterParams.timeout = 0;
      sctFilterParams.flags = DMX_IMMEDIATE_START;
-     sctFilterParams.filter.filter[0] = Tid;
-     sctFilterParams.filter.mask[0] = Mask;
+     memcpy(sctFilterParams.filter.filter, Filter, DMX_FILTER_SIZE);
+     memcpy(sctFilterParams.filter.mask, Mask, DMX_FILTER_SIZE);
+     memcpy(sctFilterParams.filter.mode, Mode, DMX_FILTER_SIZE);
      if (ioctl(f, DMX_SET_FILTER, &sctFilterParams) >= 0)
         return f;
      else {
-        esyslog("ERROR: can't set filter (pid=%d, tid=%02X, mask=%02X): %m", Pid, Tid, Mask);
+        esyslog("ERROR: can't set filter (pid=%d, tid=%02X, mask=%02X): %m", Pid, Filter[0], Mask[0]);
+        close(f);
+        }
+     }
+  else
+     esyslog("ERROR: can't open filter handle on '%s'", FileName);
+  return -1;
+}
+
+int cDvbDevice::OpenTsFilter(u_short Pid, int BuffSize)
+{
+  const char *FileName = *cDvbName(DEV_DVB_DEMUX, CardIndex());
+  int f = open(FileName, O_RDWR | O_NONBLOCK);
+  if (f >= 0) {
+     if (BuffSize > 0 && ioctl(f, DMX_SET_BUFFER_SIZE, BuffSize) < 0)
+        esyslog("ERROR: can't set buffer size %d for TS filter (pid=%d): %m", BuffSize, Pid);
+     dmx_pes_filter_params pesFilterParams;
+     memset(&pesFilterParams, 0, sizeof(pesFilterParams));
+     pesFilterParams.pid = Pid;
+     pesFilterParams.input = DMX_IN_FRONTEND;
+     pesFilterParams.output = DMX_OUT_TSDEMUX_TAP;
+     pesFilterParams.pes_type = DMX_PES_OTHER;
+     pesFilterParams.flags = DMX_IMMEDIATE_START;
+     if (ioctl(f, DMX_SET_PES_FILTER, &pesFilterParams) >= 0)
+        return f;
+     else {
+        esyslog("ERROR: can't set TS filter (pid=%d): %m", Pid);
         close(f);
         }
      }
@@ -305,6 +305,14 @@ public:
        ///< Opens a file handle for the given filter data.
        ///< A derived device that provides section data must
        ///< implement this function.
+  virtual int OpenFilter(u_short Pid, const u_char *Filter, const u_char *Mask, const u_char *Mode);
+       ///< Like OpenFilter() above, but with the full DMX_FILTER_SIZE filter,
+       ///< mask and mode arrays. The default implementation only applies
+       ///< the table id.
+  virtual int OpenTsFilter(u_short Pid, int BuffSize);
+       ///< Opens a file handle that delivers the raw TS packets of the given
+       ///< Pid, using a demux buffer of BuffSize bytes. The handle is closed
+       ///< with CloseFilter(). Returns -1 if the device can't do this.
   virtual void CloseFilter(int Handle);
        ///< Closes a file handle that has previously been opened
        ///< by OpenFilter(). If this is as simple as calling close(Handle),
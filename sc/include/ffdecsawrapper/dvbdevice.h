@@ -79,6 +79,8 @@ protected:
 
 protected:
   virtual int OpenFilter(u_short Pid, u_char Tid, u_char Mask);
+  virtual int OpenFilter(u_short Pid, const u_char *Filter, const u_char *Mask, const u_char *Mode);
+  virtual int OpenTsFilter(u_short Pid, int BuffSize);
   virtual void CloseFilter(int Handle);
 
 // Common Interface facilities:
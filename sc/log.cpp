@@ -1,21 +1,32 @@
 #include <stdio.h>
 #include "log.h"
-extern int tmprintf(const char *plugin, const char *fmt, ...);
+extern void tmputs(const char *stamp, const char *plugin, const char *msg);
+extern int (*tmqueue)(const char *stamp, const char *plugin, const char *msg);
 static const char *plugin_name;
-static unsigned  *log_level, print_level, id;
+static const unsigned char *log_level;
+static unsigned print_level;
 
 static void LogPrintSasc(const struct LogHeader *lh, const char *txt) {
-  char tag[80];
-  if(print_level <= ((*log_level >> id) & 3)) {
-    sprintf(tag, "%s(%s)", plugin_name, lh->tag);
-    tmprintf(tag, "%s\n", txt);
+  char tag[80], msg[1024];
+  if(lh->c == L_GEN_RAW) {
+    // dprintf line from the loopback side, passed through the log writer
+    tmputs(lh->stamp, lh->tag, txt);
   }
+  else if(print_level <= __atomic_load_n(log_level, __ATOMIC_RELAXED)) {
+    snprintf(tag, sizeof(tag), "%s(%s)", plugin_name, lh->tag);
+    snprintf(msg, sizeof(msg), "%s\n", txt);
+    tmputs(lh->stamp, tag, msg);
+  }
+}
+
+static int QueueSasc(const char *stamp, const char *plugin, const char *msg) {
+  return cLogging::PutRaw(stamp, plugin, msg);
 }
 
-void SetCAMPrint(const char *_plugin_name, unsigned int plugin_id, unsigned int _print_level, unsigned int *_log_level) {
+void SetCAMPrint(const char *_plugin_name, unsigned int _print_level, const unsigned char *_log_level) {
   plugin_name = _plugin_name;
-  id = plugin_id;
   log_level = _log_level;
   print_level = _print_level;
   cLogging::SetLogPrint(&LogPrintSasc);
+  tmqueue = &QueueSasc;
 }